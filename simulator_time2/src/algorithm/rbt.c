@@ -8,7 +8,7 @@
 #include <header/algorithm.h>
 
 // shared with BST
-rbtree_node_interface default_i_rbt_node;
+extern rbtree_node_interface default_i_rbt_node;
 rb_tree_t *bst_construct_keystr(char *str);
 int internal_tree_compare(uint64_t a, uint64_t b, rbtree_node_interface *i_node, int is_rbt);
 void bst_internal_setchild(uint64_t parent, uint64_t child,
@@ -45,7 +45,6 @@ static uint64_t rbt_internal_rotate(uint64_t n, uint64_t p, uint64_t g,
     uint64_t p_left = i_node->get_leftchild(p);
     uint64_t p_right = i_node->get_rightchild(p);
     uint64_t g_left = i_node->get_leftchild(g);
-    uint64_t g_right = i_node->get_rightchild(g);
 
     if (i_node->compare_nodes(g_left, p) == 0)
     {
@@ -429,7 +428,7 @@ rb_node_t *rbt_find(rb_tree_t *tree, uint64_t key)
 
 rb_node_t *rbt_find_succ(rb_tree_t *tree, uint64_t key)
 {
-    return rbt_find_succ(tree, key);
+    return bst_find_succ(tree, key);
 }
 
 int rbt_compare(rb_tree_t *a, rb_tree_t *b)
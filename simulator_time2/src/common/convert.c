@@ -171,6 +171,119 @@ uint64_t string2uint_range(const char *str, int start, int end){
 }
 
 
+// one step of the same DFA, for parsers scanning character by character
+// the negative states keep *bmap as the two's complement as they go
+string2uint_state_t string2uint_next(string2uint_state_t state, char c, uint64_t *bmap)
+{
+    int d = -1;
+    if ('0' <= c && c <= '9'){
+        d = c - '0';
+    }
+    else if ('a' <= c && c <= 'f'){
+        d = c - 'a' + 10;
+    }
+    else if ('A' <= c && c <= 'F'){
+        d = c - 'A' + 10;
+    }
+
+    switch (state)
+    {
+        case STRING2UINT_LEADING_SPACE:
+            if (c == ' '){
+                return STRING2UINT_LEADING_SPACE;
+            }
+            else if (c == '0'){
+                *bmap = 0;
+                return STRING2UINT_FIRST_ZERO;
+            }
+            else if (c == '-'){
+                *bmap = 0;
+                return STRING2UINT_NEGATIVE;
+            }
+            else if (0 <= d && d <= 9){
+                *bmap = d;
+                return STRING2UINT_POSITIVE_DEC;
+            }
+            return STRING2UINT_FAILED;
+        case STRING2UINT_FIRST_ZERO:
+            if (c == 'x' || c == 'X'){
+                return STRING2UINT_POSITIVE_HEX;
+            }
+            else if (0 <= d && d <= 9){
+                *bmap = d;
+                return STRING2UINT_POSITIVE_DEC;
+            }
+            else if (c == ' '){
+                return STRING2UINT_ENDING_SPACE;
+            }
+            return STRING2UINT_FAILED;
+        case STRING2UINT_POSITIVE_DEC:
+            if (0 <= d && d <= 9){
+                *bmap = *bmap * 10 + d;
+                return STRING2UINT_POSITIVE_DEC;
+            }
+            else if (c == ' '){
+                return STRING2UINT_ENDING_SPACE;
+            }
+            return STRING2UINT_FAILED;
+        case STRING2UINT_POSITIVE_HEX:
+            if (0 <= d){
+                *bmap = *bmap * 16 + d;
+                return STRING2UINT_POSITIVE_HEX;
+            }
+            else if (c == ' '){
+                return STRING2UINT_ENDING_SPACE;
+            }
+            return STRING2UINT_FAILED;
+        case STRING2UINT_NEGATIVE:
+            if (c == '0'){
+                return STRING2UINT_NEGATIVE_FIRST_ZERO;
+            }
+            else if (0 <= d && d <= 9){
+                *bmap = -(uint64_t)d;
+                return STRING2UINT_NEGATIVE_DEC;
+            }
+            return STRING2UINT_FAILED;
+        case STRING2UINT_NEGATIVE_FIRST_ZERO:
+            if (c == 'x' || c == 'X'){
+                return STRING2UINT_NEGATIVE_HEX;
+            }
+            else if (0 <= d && d <= 9){
+                *bmap = -(uint64_t)d;
+                return STRING2UINT_NEGATIVE_DEC;
+            }
+            else if (c == ' '){
+                return STRING2UINT_ENDING_SPACE;
+            }
+            return STRING2UINT_FAILED;
+        case STRING2UINT_NEGATIVE_DEC:
+            if (0 <= d && d <= 9){
+                *bmap = *bmap * 10 - d;
+                return STRING2UINT_NEGATIVE_DEC;
+            }
+            else if (c == ' '){
+                return STRING2UINT_ENDING_SPACE;
+            }
+            return STRING2UINT_FAILED;
+        case STRING2UINT_NEGATIVE_HEX:
+            if (0 <= d){
+                *bmap = *bmap * 16 - d;
+                return STRING2UINT_NEGATIVE_HEX;
+            }
+            else if (c == ' '){
+                return STRING2UINT_ENDING_SPACE;
+            }
+            return STRING2UINT_FAILED;
+        case STRING2UINT_ENDING_SPACE:
+            if (c == ' '){
+                return STRING2UINT_ENDING_SPACE;
+            }
+            return STRING2UINT_FAILED;
+        default:
+            return STRING2UINT_FAILED;
+    }
+}
+
 // convert uin32_t to its float
 // ***************************第三期视频
 uint32_t uint2float(uint32_t u){
@@ -0,0 +1,262 @@
+/* BCST - Introduction to Computer Systems
+ * Author:      yangminz@outlook.com
+ * Github:      https://github.com/yangminz/bcst_csapp
+ * Bilibili:    https://space.bilibili.com/4564101
+ * Zhihu:       https://www.zhihu.com/people/zhao-yang-min
+ * This project (code repository and videos) is exclusively owned by yangminz
+ * and shall not be used for commercial and profitting purpose
+ * without yangminz's permission.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header/cpu.h"
+#include "header/interrupt.h"
+#include "header/machine.h"
+
+/*======================================*/
+/*      simulated-time events           */
+/*======================================*/
+
+// The timer and the devices post events at absolute simulated time.
+// The run loop executes instructions straight until the earliest deadline,
+// then `event_dispatch` handles the events due.
+// The events are kept in a binary min-heap ordered by (time, seq),
+// so the events posted for the same time are handled in posting order.
+
+#define MAX_NUM_EVENT (64)
+
+typedef struct
+{
+    uint64_t        time;
+    uint64_t        seq;
+    event_handler_t handler;
+    uint64_t        data;
+} event_t;
+
+struct EVENT_STATE
+{
+    event_t heap[MAX_NUM_EVENT];
+    int count;
+    uint64_t seq;
+
+    // local APIC timer
+    uint64_t timer_period;
+    // 0 - no tick is pending, e.g. only one process is runnable
+    int timer_running;
+    int timer_initialized;
+};
+
+// the events of each core, e.g. local APIC timer
+static inline struct EVENT_STATE *event_state()
+{
+    if (active_core->event == NULL)
+    {
+        active_core->event = machine_calloc(sizeof(struct EVENT_STATE));
+        active_core->event->timer_period = 5;
+    }
+    return active_core->event;
+}
+#define event_heap          (event_state()->heap)
+#define event_count         (event_state()->count)
+#define event_seq           (event_state()->seq)
+#define timer_period        (event_state()->timer_period)
+#define timer_running       (event_state()->timer_running)
+#define timer_initialized   (event_state()->timer_initialized)
+
+static int event_before(event_t *a, event_t *b)
+{
+    if (a->time != b->time)
+    {
+        return a->time < b->time;
+    }
+    return a->seq < b->seq;
+}
+
+static void event_swap(int i, int j)
+{
+    event_t t = event_heap[i];
+    event_heap[i] = event_heap[j];
+    event_heap[j] = t;
+}
+
+static void sift_up(int i)
+{
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (event_before(&event_heap[i], &event_heap[parent]) == 0)
+        {
+            return;
+        }
+        event_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void sift_down(int i)
+{
+    while (1)
+    {
+        int min = i;
+        int left = 2 * i + 1;
+        int right = 2 * i + 2;
+        if (left < event_count && event_before(&event_heap[left], &event_heap[min]) == 1)
+        {
+            min = left;
+        }
+        if (right < event_count && event_before(&event_heap[right], &event_heap[min]) == 1)
+        {
+            min = right;
+        }
+        if (min == i)
+        {
+            return;
+        }
+        event_swap(i, min);
+        i = min;
+    }
+}
+
+static void event_remove(int i)
+{
+    event_count -= 1;
+    if (i == event_count)
+    {
+        return;
+    }
+    event_heap[i] = event_heap[event_count];
+    sift_down(i);
+    sift_up(i);
+}
+
+/*--------------------------------------*/
+/*      local APIC timer                */
+/*--------------------------------------*/
+
+static void timer_event(uint64_t data)
+{
+    // the next tick is posted before the interrupt, which never returns
+    event_post(global_time + timer_period, &timer_event, 0);
+    interrupt_stack_switching(0x81);
+}
+
+// the first tick is at the time of one period
+static void lazy_initialize_timer()
+{
+    if (timer_initialized == 0)
+    {
+        timer_initialized = 1;
+        timer_start();
+    }
+}
+
+void timer_set_period(uint64_t period)
+{
+    assert(period > 0);
+    timer_period = period;
+
+    lazy_initialize_timer();
+    if (timer_running == 1)
+    {
+        // the pending tick is moved to the new period
+        event_cancel(&timer_event);
+        event_post(global_time + timer_period, &timer_event, 0);
+    }
+}
+
+// the next tick is one period later
+// nothing changed if the timer is running
+void timer_start()
+{
+    timer_initialized = 1;
+    if (timer_running == 1)
+    {
+        return;
+    }
+    event_post(global_time + timer_period, &timer_event, 0);
+    timer_running = 1;
+}
+
+void timer_stop()
+{
+    timer_initialized = 1;
+    event_cancel(&timer_event);
+    timer_running = 0;
+}
+
+/*--------------------------------------*/
+/*      event queue                     */
+/*--------------------------------------*/
+
+void event_post(uint64_t time, event_handler_t handler, uint64_t data)
+{
+    if (event_count >= MAX_NUM_EVENT)
+    {
+        printf("\033[31;1mEvent queue is full\033[0m\n");
+        exit(0);
+    }
+
+    event_t *e = &event_heap[event_count];
+    e->time = time;
+    e->seq = event_seq;
+    e->handler = handler;
+    e->data = data;
+    event_seq += 1;
+    event_count += 1;
+    sift_up(event_count - 1);
+}
+
+void event_cancel(event_handler_t handler)
+{
+    int i = 0;
+    while (i < event_count)
+    {
+        if (event_heap[i].handler == handler)
+        {
+            // the last event is moved to i, check i again
+            event_remove(i);
+            continue;
+        }
+        i += 1;
+    }
+}
+
+uint64_t event_deadline()
+{
+    lazy_initialize_timer();
+
+    if (event_count == 0)
+    {
+        return 0xffffffffffffffff;
+    }
+    return event_heap[0].time;
+}
+
+void event_dispatch()
+{
+    while (event_count > 0 && event_heap[0].time <= global_time)
+    {
+        // removed before handled, since the handler may not return
+        event_t e = event_heap[0];
+        event_remove(0);
+        e.handler(e.data);
+    }
+}
+
+// the handlers are host code, moved by `offset` when the snapshot
+// is restored in another process of the same binary
+void event_relocate(core_t *c, int64_t offset)
+{
+    struct EVENT_STATE *s = c->event;
+    if (s == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < s->count; ++ i)
+    {
+        s->heap[i].handler = (event_handler_t)((uint64_t)s->heap[i].handler + offset);
+    }
+}
@@ -12,137 +12,393 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include "header/cpu.h"
 #include "header/memory.h"
 #include "header/common.h"
-#include "header/algorithm.h"
 #include "header/instruction.h"
+#include "header/address.h"
+#include "header/machine.h"
 
 /*======================================*/
 /*      parse assembly instruction      */
 /*======================================*/
 
 // the implementation of ISA
-extern void mov_handler             (od_t *src_od, od_t *dst_od);
-extern void push_handler            (od_t *src_od, od_t *dst_od);
-extern void pop_handler             (od_t *src_od, od_t *dst_od);
+extern void mov_r_r_handler         (od_t *src_od, od_t *dst_od);
+extern void mov_r_m_handler         (od_t *src_od, od_t *dst_od);
+extern void mov_m_r_handler         (od_t *src_od, od_t *dst_od);
+extern void mov_i_r_handler         (od_t *src_od, od_t *dst_od);
+extern void mov_i_m_handler         (od_t *src_od, od_t *dst_od);
+extern void push_r_handler          (od_t *src_od, od_t *dst_od);
+extern void push_i_handler          (od_t *src_od, od_t *dst_od);
+extern void pop_r_handler           (od_t *src_od, od_t *dst_od);
 extern void leave_handler           (od_t *src_od, od_t *dst_od);
-extern void call_handler            (od_t *src_od, od_t *dst_od);
+extern void call_i_handler          (od_t *src_od, od_t *dst_od);
+extern void call_m_handler          (od_t *src_od, od_t *dst_od);
 extern void ret_handler             (od_t *src_od, od_t *dst_od);
-extern void add_handler             (od_t *src_od, od_t *dst_od);
-extern void sub_handler             (od_t *src_od, od_t *dst_od);
-extern void cmp_handler             (od_t *src_od, od_t *dst_od);
-extern void jne_handler             (od_t *src_od, od_t *dst_od);
-extern void jmp_handler             (od_t *src_od, od_t *dst_od);
-extern void lea_handler             (od_t *src_od, od_t *dst_od);
-extern void int_handler             (od_t *src_od, od_t *dst_od);
+extern void add_r_r_handler         (od_t *src_od, od_t *dst_od);
+extern void add_i_r_handler         (od_t *src_od, od_t *dst_od);
+extern void add_m_r_handler         (od_t *src_od, od_t *dst_od);
+extern void add_r_m_handler         (od_t *src_od, od_t *dst_od);
+extern void add_i_m_handler         (od_t *src_od, od_t *dst_od);
+extern void sub_r_r_handler         (od_t *src_od, od_t *dst_od);
+extern void sub_i_r_handler         (od_t *src_od, od_t *dst_od);
+extern void sub_m_r_handler         (od_t *src_od, od_t *dst_od);
+extern void sub_r_m_handler         (od_t *src_od, od_t *dst_od);
+extern void sub_i_m_handler         (od_t *src_od, od_t *dst_od);
+extern void cmp_r_r_handler         (od_t *src_od, od_t *dst_od);
+extern void cmp_i_r_handler         (od_t *src_od, od_t *dst_od);
+extern void cmp_m_r_handler         (od_t *src_od, od_t *dst_od);
+extern void cmp_r_m_handler         (od_t *src_od, od_t *dst_od);
+extern void cmp_i_m_handler         (od_t *src_od, od_t *dst_od);
+extern void jne_i_handler           (od_t *src_od, od_t *dst_od);
+extern void jne_m_handler           (od_t *src_od, od_t *dst_od);
+extern void jmp_i_handler           (od_t *src_od, od_t *dst_od);
+extern void jmp_m_handler           (od_t *src_od, od_t *dst_od);
+extern void lea_m_r_handler         (od_t *src_od, od_t *dst_od);
+extern void int_i_handler           (od_t *src_od, od_t *dst_od);
 extern void nop_handler             (od_t *src_od, od_t *dst_od);
+extern void illegal_handler         (od_t *src_od, od_t *dst_od);
 
-static trie_node_t *register_mapping = NULL;
-static trie_node_t *operator_mapping = NULL;
-static void lazy_initialize_trie()
-{
-    // initialize the register mapping
-    if (register_mapping == NULL)
-    {
-        register_mapping = trie_construct();
-        register_mapping = trie_insert(register_mapping, "%rax",   (uint64_t)&(cpu_reg.rax)    );
-        register_mapping = trie_insert(register_mapping, "%eax",   (uint64_t)&(cpu_reg.eax)    );
-        register_mapping = trie_insert(register_mapping, "%ax",    (uint64_t)&(cpu_reg.ax)     );
-        register_mapping = trie_insert(register_mapping, "%ah",    (uint64_t)&(cpu_reg.ah)     );
-        register_mapping = trie_insert(register_mapping, "%al",    (uint64_t)&(cpu_reg.al)     );
-        register_mapping = trie_insert(register_mapping, "%rbx",   (uint64_t)&(cpu_reg.rbx)    );
-        register_mapping = trie_insert(register_mapping, "%ebx",   (uint64_t)&(cpu_reg.ebx)    );
-        register_mapping = trie_insert(register_mapping, "%bx",    (uint64_t)&(cpu_reg.bx)     );
-        register_mapping = trie_insert(register_mapping, "%bh",    (uint64_t)&(cpu_reg.bh)     );
-        register_mapping = trie_insert(register_mapping, "%bl",    (uint64_t)&(cpu_reg.bl)     );
-        register_mapping = trie_insert(register_mapping, "%rcx",   (uint64_t)&(cpu_reg.rcx)    );
-        register_mapping = trie_insert(register_mapping, "%ecx",   (uint64_t)&(cpu_reg.ecx)    );
-        register_mapping = trie_insert(register_mapping, "%cx",    (uint64_t)&(cpu_reg.cx)     );
-        register_mapping = trie_insert(register_mapping, "%ch",    (uint64_t)&(cpu_reg.ch)     );
-        register_mapping = trie_insert(register_mapping, "%cl",    (uint64_t)&(cpu_reg.cl)     );
-        register_mapping = trie_insert(register_mapping, "%rdx",   (uint64_t)&(cpu_reg.rdx)    );
-        register_mapping = trie_insert(register_mapping, "%edx",   (uint64_t)&(cpu_reg.edx)    );
-        register_mapping = trie_insert(register_mapping, "%dx",    (uint64_t)&(cpu_reg.dx)     );
-        register_mapping = trie_insert(register_mapping, "%dh",    (uint64_t)&(cpu_reg.dh)     );
-        register_mapping = trie_insert(register_mapping, "%dl",    (uint64_t)&(cpu_reg.dl)     );
-        register_mapping = trie_insert(register_mapping, "%rsi",   (uint64_t)&(cpu_reg.rsi)    );
-        register_mapping = trie_insert(register_mapping, "%esi",   (uint64_t)&(cpu_reg.esi)    );
-        register_mapping = trie_insert(register_mapping, "%si",    (uint64_t)&(cpu_reg.si)     );
-        register_mapping = trie_insert(register_mapping, "%sih",   (uint64_t)&(cpu_reg.sih)    );
-        register_mapping = trie_insert(register_mapping, "%sil",   (uint64_t)&(cpu_reg.sil)    );
-        register_mapping = trie_insert(register_mapping, "%rdi",   (uint64_t)&(cpu_reg.rdi)    );
-        register_mapping = trie_insert(register_mapping, "%edi",   (uint64_t)&(cpu_reg.edi)    );
-        register_mapping = trie_insert(register_mapping, "%di",    (uint64_t)&(cpu_reg.di)     );
-        register_mapping = trie_insert(register_mapping, "%dih",   (uint64_t)&(cpu_reg.dih)    );
-        register_mapping = trie_insert(register_mapping, "%dil",   (uint64_t)&(cpu_reg.dil)    );
-        register_mapping = trie_insert(register_mapping, "%rbp",   (uint64_t)&(cpu_reg.rbp)    );
-        register_mapping = trie_insert(register_mapping, "%ebp",   (uint64_t)&(cpu_reg.ebp)    );
-        register_mapping = trie_insert(register_mapping, "%bp",    (uint64_t)&(cpu_reg.bp)     );
-        register_mapping = trie_insert(register_mapping, "%bph",   (uint64_t)&(cpu_reg.bph)    );
-        register_mapping = trie_insert(register_mapping, "%bpl",   (uint64_t)&(cpu_reg.bpl)    );
-        register_mapping = trie_insert(register_mapping, "%rsp",   (uint64_t)&(cpu_reg.rsp)    );
-        register_mapping = trie_insert(register_mapping, "%esp",   (uint64_t)&(cpu_reg.esp)    );
-        register_mapping = trie_insert(register_mapping, "%sp",    (uint64_t)&(cpu_reg.sp)     );
-        register_mapping = trie_insert(register_mapping, "%sph",   (uint64_t)&(cpu_reg.sph)    );
-        register_mapping = trie_insert(register_mapping, "%spl",   (uint64_t)&(cpu_reg.spl)    );
-        register_mapping = trie_insert(register_mapping, "%r8",    (uint64_t)&(cpu_reg.r8)     );
-        register_mapping = trie_insert(register_mapping, "%r8d",   (uint64_t)&(cpu_reg.r8d)    );
-        register_mapping = trie_insert(register_mapping, "%r8w",   (uint64_t)&(cpu_reg.r8w)    );
-        register_mapping = trie_insert(register_mapping, "%r8b",   (uint64_t)&(cpu_reg.r8b)    );
-        register_mapping = trie_insert(register_mapping, "%r9",    (uint64_t)&(cpu_reg.r9)     );
-        register_mapping = trie_insert(register_mapping, "%r9d",   (uint64_t)&(cpu_reg.r9d)    );
-        register_mapping = trie_insert(register_mapping, "%r9w",   (uint64_t)&(cpu_reg.r9w)    );
-        register_mapping = trie_insert(register_mapping, "%r9b",   (uint64_t)&(cpu_reg.r9b)    );
-        register_mapping = trie_insert(register_mapping, "%r10",   (uint64_t)&(cpu_reg.r10)    );
-        register_mapping = trie_insert(register_mapping, "%r10d",  (uint64_t)&(cpu_reg.r10d)   );
-        register_mapping = trie_insert(register_mapping, "%r10w",  (uint64_t)&(cpu_reg.r10w)   );
-        register_mapping = trie_insert(register_mapping, "%r10b",  (uint64_t)&(cpu_reg.r10b)   );
-        register_mapping = trie_insert(register_mapping, "%r11",   (uint64_t)&(cpu_reg.r11)    );
-        register_mapping = trie_insert(register_mapping, "%r11d",  (uint64_t)&(cpu_reg.r11d)   );
-        register_mapping = trie_insert(register_mapping, "%r11w",  (uint64_t)&(cpu_reg.r11w)   );
-        register_mapping = trie_insert(register_mapping, "%r11b",  (uint64_t)&(cpu_reg.r11b)   );
-        register_mapping = trie_insert(register_mapping, "%r12",   (uint64_t)&(cpu_reg.r12)    );
-        register_mapping = trie_insert(register_mapping, "%r12d",  (uint64_t)&(cpu_reg.r12d)   );
-        register_mapping = trie_insert(register_mapping, "%r12w",  (uint64_t)&(cpu_reg.r12w)   );
-        register_mapping = trie_insert(register_mapping, "%r12b",  (uint64_t)&(cpu_reg.r12b)   );
-        register_mapping = trie_insert(register_mapping, "%r13",   (uint64_t)&(cpu_reg.r13)    );
-        register_mapping = trie_insert(register_mapping, "%r13d",  (uint64_t)&(cpu_reg.r13d)   );
-        register_mapping = trie_insert(register_mapping, "%r13w",  (uint64_t)&(cpu_reg.r13w)   );
-        register_mapping = trie_insert(register_mapping, "%r13b",  (uint64_t)&(cpu_reg.r13b)   );
-        register_mapping = trie_insert(register_mapping, "%r14",   (uint64_t)&(cpu_reg.r14)    );
-        register_mapping = trie_insert(register_mapping, "%r14d",  (uint64_t)&(cpu_reg.r14d)   );
-        register_mapping = trie_insert(register_mapping, "%r14w",  (uint64_t)&(cpu_reg.r14w)   );
-        register_mapping = trie_insert(register_mapping, "%r14b",  (uint64_t)&(cpu_reg.r14b)   );
-        register_mapping = trie_insert(register_mapping, "%r15",   (uint64_t)&(cpu_reg.r15)    );
-        register_mapping = trie_insert(register_mapping, "%r15d",  (uint64_t)&(cpu_reg.r15d)   );
-        register_mapping = trie_insert(register_mapping, "%r15w",  (uint64_t)&(cpu_reg.r15w)   );
-        register_mapping = trie_insert(register_mapping, "%r15b",  (uint64_t)&(cpu_reg.r15b)   );
-    }
-
-    // initialize the operator mapping
-    if (operator_mapping == NULL)
-    {
-        operator_mapping = trie_construct();
-        operator_mapping = trie_insert(operator_mapping, "movq",   (uint64_t)&mov_handler    );
-        operator_mapping = trie_insert(operator_mapping, "mov",    (uint64_t)&mov_handler    );
-        operator_mapping = trie_insert(operator_mapping, "push",   (uint64_t)&push_handler   );
-        operator_mapping = trie_insert(operator_mapping, "pushq",   (uint64_t)&push_handler   );
-        operator_mapping = trie_insert(operator_mapping, "pop",    (uint64_t)&pop_handler    );
-        operator_mapping = trie_insert(operator_mapping, "leaveq", (uint64_t)&leave_handler  );
-        operator_mapping = trie_insert(operator_mapping, "callq",  (uint64_t)&call_handler   );
-        operator_mapping = trie_insert(operator_mapping, "retq",   (uint64_t)&ret_handler    );
-        operator_mapping = trie_insert(operator_mapping, "add",    (uint64_t)&add_handler    );
-        operator_mapping = trie_insert(operator_mapping, "sub",    (uint64_t)&sub_handler    );
-        operator_mapping = trie_insert(operator_mapping, "cmpq",   (uint64_t)&cmp_handler    );
-        operator_mapping = trie_insert(operator_mapping, "jne",    (uint64_t)&jne_handler    );
-        operator_mapping = trie_insert(operator_mapping, "jmp",    (uint64_t)&jmp_handler    );
-        operator_mapping = trie_insert(operator_mapping, "lea",    (uint64_t)&lea_handler    );
-        operator_mapping = trie_insert(operator_mapping, "int",    (uint64_t)&int_handler    );
-        operator_mapping = trie_insert(operator_mapping, "nop",    (uint64_t)&nop_handler    );
+// handler table storing the handlers to different instruction types
+// indexed by the operator number `inst_op_t` and the types of src & dst
+// the combinations not listed are illegal instructions
+static op_t handler_table[NUM_INSTRTYPE][NUM_OPERAND_TYPE][NUM_OPERAND_TYPE] = 
+{
+    [INST_MOV][OD_REG][OD_REG]             = &mov_r_r_handler,
+    [INST_MOV][OD_REG][OD_MEM]             = &mov_r_m_handler,
+    [INST_MOV][OD_MEM][OD_REG]             = &mov_m_r_handler,
+    [INST_MOV][OD_IMM][OD_REG]             = &mov_i_r_handler,
+    [INST_MOV][OD_IMM][OD_MEM]             = &mov_i_m_handler,
+
+    [INST_PUSH][OD_REG][OD_EMPTY]          = &push_r_handler,
+    [INST_PUSH][OD_IMM][OD_EMPTY]          = &push_i_handler,
+
+    [INST_POP][OD_REG][OD_EMPTY]           = &pop_r_handler,
+
+    [INST_LEAVE][OD_EMPTY][OD_EMPTY]       = &leave_handler,
+
+    [INST_CALL][OD_IMM][OD_EMPTY]          = &call_i_handler,
+    [INST_CALL][OD_MEM][OD_EMPTY]          = &call_m_handler,
+
+    [INST_RET][OD_EMPTY][OD_EMPTY]         = &ret_handler,
+
+    [INST_ADD][OD_REG][OD_REG]             = &add_r_r_handler,
+    [INST_ADD][OD_IMM][OD_REG]             = &add_i_r_handler,
+    [INST_ADD][OD_MEM][OD_REG]             = &add_m_r_handler,
+    [INST_ADD][OD_REG][OD_MEM]             = &add_r_m_handler,
+    [INST_ADD][OD_IMM][OD_MEM]             = &add_i_m_handler,
+
+    [INST_SUB][OD_REG][OD_REG]             = &sub_r_r_handler,
+    [INST_SUB][OD_IMM][OD_REG]             = &sub_i_r_handler,
+    [INST_SUB][OD_MEM][OD_REG]             = &sub_m_r_handler,
+    [INST_SUB][OD_REG][OD_MEM]             = &sub_r_m_handler,
+    [INST_SUB][OD_IMM][OD_MEM]             = &sub_i_m_handler,
+
+    [INST_CMP][OD_REG][OD_REG]             = &cmp_r_r_handler,
+    [INST_CMP][OD_IMM][OD_REG]             = &cmp_i_r_handler,
+    [INST_CMP][OD_MEM][OD_REG]             = &cmp_m_r_handler,
+    [INST_CMP][OD_REG][OD_MEM]             = &cmp_r_m_handler,
+    [INST_CMP][OD_IMM][OD_MEM]             = &cmp_i_m_handler,
+
+    [INST_JNE][OD_IMM][OD_EMPTY]           = &jne_i_handler,
+    [INST_JNE][OD_MEM][OD_EMPTY]           = &jne_m_handler,
+
+    [INST_JMP][OD_IMM][OD_EMPTY]           = &jmp_i_handler,
+    [INST_JMP][OD_MEM][OD_EMPTY]           = &jmp_m_handler,
+
+    [INST_LEA][OD_MEM][OD_REG]             = &lea_m_r_handler,
+
+    [INST_INT][OD_IMM][OD_EMPTY]           = &int_i_handler,
+
+    [INST_NOP][OD_EMPTY][OD_EMPTY]         = &nop_handler,
+};
+
+// choose the handler specialized by operand forms
+static op_t select_handler(inst_t *inst)
+{
+    if (inst->src.type >= NUM_OPERAND_TYPE || inst->dst.type >= NUM_OPERAND_TYPE)
+    {
+        return &illegal_handler;
     }
+    op_t op = handler_table[inst->opcode][inst->src.type][inst->dst.type];
+    if (op == NULL)
+    {
+        return &illegal_handler;
+    }
+    return op;
 }
 
+// register table
+// the index is the register number in the binary encoding of instruction
+// the register is at the offset of `cpu_reg` in each core
+typedef struct
+{
+    char *name;
+    uint64_t offset;
+} register_entry_t;
+
+static register_entry_t register_table[] = 
+{
+    {"%rax",    offsetof(cpu_reg_t, rax)  },
+    {"%eax",    offsetof(cpu_reg_t, eax)  },
+    {"%ax",     offsetof(cpu_reg_t, ax)   },
+    {"%ah",     offsetof(cpu_reg_t, ah)   },
+    {"%al",     offsetof(cpu_reg_t, al)   },
+    {"%rbx",    offsetof(cpu_reg_t, rbx)  },
+    {"%ebx",    offsetof(cpu_reg_t, ebx)  },
+    {"%bx",     offsetof(cpu_reg_t, bx)   },
+    {"%bh",     offsetof(cpu_reg_t, bh)   },
+    {"%bl",     offsetof(cpu_reg_t, bl)   },
+    {"%rcx",    offsetof(cpu_reg_t, rcx)  },
+    {"%ecx",    offsetof(cpu_reg_t, ecx)  },
+    {"%cx",     offsetof(cpu_reg_t, cx)   },
+    {"%ch",     offsetof(cpu_reg_t, ch)   },
+    {"%cl",     offsetof(cpu_reg_t, cl)   },
+    {"%rdx",    offsetof(cpu_reg_t, rdx)  },
+    {"%edx",    offsetof(cpu_reg_t, edx)  },
+    {"%dx",     offsetof(cpu_reg_t, dx)   },
+    {"%dh",     offsetof(cpu_reg_t, dh)   },
+    {"%dl",     offsetof(cpu_reg_t, dl)   },
+    {"%rsi",    offsetof(cpu_reg_t, rsi)  },
+    {"%esi",    offsetof(cpu_reg_t, esi)  },
+    {"%si",     offsetof(cpu_reg_t, si)   },
+    {"%sih",    offsetof(cpu_reg_t, sih)  },
+    {"%sil",    offsetof(cpu_reg_t, sil)  },
+    {"%rdi",    offsetof(cpu_reg_t, rdi)  },
+    {"%edi",    offsetof(cpu_reg_t, edi)  },
+    {"%di",     offsetof(cpu_reg_t, di)   },
+    {"%dih",    offsetof(cpu_reg_t, dih)  },
+    {"%dil",    offsetof(cpu_reg_t, dil)  },
+    {"%rbp",    offsetof(cpu_reg_t, rbp)  },
+    {"%ebp",    offsetof(cpu_reg_t, ebp)  },
+    {"%bp",     offsetof(cpu_reg_t, bp)   },
+    {"%bph",    offsetof(cpu_reg_t, bph)  },
+    {"%bpl",    offsetof(cpu_reg_t, bpl)  },
+    {"%rsp",    offsetof(cpu_reg_t, rsp)  },
+    {"%esp",    offsetof(cpu_reg_t, esp)  },
+    {"%sp",     offsetof(cpu_reg_t, sp)   },
+    {"%sph",    offsetof(cpu_reg_t, sph)  },
+    {"%spl",    offsetof(cpu_reg_t, spl)  },
+    {"%r8",     offsetof(cpu_reg_t, r8)   },
+    {"%r8d",    offsetof(cpu_reg_t, r8d)  },
+    {"%r8w",    offsetof(cpu_reg_t, r8w)  },
+    {"%r8b",    offsetof(cpu_reg_t, r8b)  },
+    {"%r9",     offsetof(cpu_reg_t, r9)   },
+    {"%r9d",    offsetof(cpu_reg_t, r9d)  },
+    {"%r9w",    offsetof(cpu_reg_t, r9w)  },
+    {"%r9b",    offsetof(cpu_reg_t, r9b)  },
+    {"%r10",    offsetof(cpu_reg_t, r10)  },
+    {"%r10d",   offsetof(cpu_reg_t, r10d) },
+    {"%r10w",   offsetof(cpu_reg_t, r10w) },
+    {"%r10b",   offsetof(cpu_reg_t, r10b) },
+    {"%r11",    offsetof(cpu_reg_t, r11)  },
+    {"%r11d",   offsetof(cpu_reg_t, r11d) },
+    {"%r11w",   offsetof(cpu_reg_t, r11w) },
+    {"%r11b",   offsetof(cpu_reg_t, r11b) },
+    {"%r12",    offsetof(cpu_reg_t, r12)  },
+    {"%r12d",   offsetof(cpu_reg_t, r12d) },
+    {"%r12w",   offsetof(cpu_reg_t, r12w) },
+    {"%r12b",   offsetof(cpu_reg_t, r12b) },
+    {"%r13",    offsetof(cpu_reg_t, r13)  },
+    {"%r13d",   offsetof(cpu_reg_t, r13d) },
+    {"%r13w",   offsetof(cpu_reg_t, r13w) },
+    {"%r13b",   offsetof(cpu_reg_t, r13b) },
+    {"%r14",    offsetof(cpu_reg_t, r14)  },
+    {"%r14d",   offsetof(cpu_reg_t, r14d) },
+    {"%r14w",   offsetof(cpu_reg_t, r14w) },
+    {"%r14b",   offsetof(cpu_reg_t, r14b) },
+    {"%r15",    offsetof(cpu_reg_t, r15)  },
+    {"%r15d",   offsetof(cpu_reg_t, r15d) },
+    {"%r15w",   offsetof(cpu_reg_t, r15w) },
+    {"%r15b",   offsetof(cpu_reg_t, r15b) },
+};
+#define NUM_REGISTER (sizeof(register_table) / sizeof(register_entry_t))
+
+// operator table
+// the index is used by the hash only
+typedef struct
+{
+    char *name;
+    inst_op_t opcode;
+} operator_entry_t;
+
+static operator_entry_t operator_table[] =
+{
+    {"movq",    INST_MOV    },
+    {"mov",     INST_MOV    },
+    {"push",    INST_PUSH   },
+    {"pushq",   INST_PUSH   },
+    {"pop",     INST_POP    },
+    {"leaveq",  INST_LEAVE  },
+    {"callq",   INST_CALL   },
+    {"retq",    INST_RET    },
+    {"add",     INST_ADD    },
+    {"sub",     INST_SUB    },
+    {"cmpq",    INST_CMP    },
+    {"jne",     INST_JNE    },
+    {"jmp",     INST_JMP    },
+    {"lea",     INST_LEA    },
+    {"int",     INST_INT    },
+    {"nop",     INST_NOP    },
+};
+#define NUM_OPERATOR (sizeof(operator_table) / sizeof(operator_entry_t))
+
+/*  Perfect hash of the names
+ *
+ *  The parser collects the characters of an operator or a register and
+ *  looks it up at the end of the token: one hash, one slot, one compare.
+ *  The slots are constant tables, no allocation or initialization.
+ *  The seed is searched until no two names of a table share a slot, so
+ *  the slots must be generated again when a name is added:
+ *  `print_name_hash` (-DDEBUG_NAME_HASH) prints them.
+ */
+
+#define NAME_SLOT_EMPTY (0xff)
+
+#define REGISTER_HASH_SEED (164363)
+#define REGISTER_HASH_BITS (8)
+#define OPERATOR_HASH_SEED (249)
+#define OPERATOR_HASH_BITS (5)
+
+#define ___ NAME_SLOT_EMPTY
+static const uint8_t register_slot[1 << REGISTER_HASH_BITS] =
+{
+    ___, ___, ___, ___, ___, ___, ___,  65, ___, ___, ___, ___, ___,  17,   0,  51,
+    ___, ___,  22, ___,  70, ___, ___, ___, ___,  67,  15, ___, ___, ___, ___,  23,
+    ___,  54, ___,  71, ___,  58,  52, ___, ___, ___, ___, ___, ___, ___, ___,  30,
+      8,   6, ___, ___, ___,  46, ___, ___, ___, ___, ___, ___, ___,  40, ___, ___,
+    ___, ___, ___,  16, ___, ___, ___, ___, ___,  35,   1, ___, ___, ___, ___, ___,
+    ___, ___,  20, ___, ___, ___, ___, ___,  28,  49,  10, ___, ___, ___, ___, ___,
+     59, ___,  33, ___,  44, ___, ___, ___, ___, ___, ___, ___,  27, ___, ___,  68,
+    ___, ___, ___, ___,  34,  55,  69, ___, ___,  11,  63, ___,  21, ___, ___, ___,
+    ___, ___, ___, ___, ___, ___, ___,  39, ___, ___, ___,   2, ___, ___,  45,  42,
+    ___, ___, ___, ___,   3, ___, ___,  53, ___,  47, ___,   7, ___, ___,   5, ___,
+     32, ___, ___, ___, ___, ___, ___, ___, ___, ___,  37, ___, ___, ___,  38, ___,
+    ___, ___, ___, ___, ___,  66,  60, ___, ___, ___, ___,  57,   9, ___,  18,  64,
+    ___,  48, ___, ___, ___, ___, ___, ___, ___, ___,   4,  29, ___,  50, ___,  24,
+     41, ___,  36, ___, ___, ___,  56, ___,  62,  26, ___, ___, ___,  19,  43, ___,
+    ___, ___, ___, ___, ___, ___, ___,  13, ___, ___, ___, ___, ___, ___, ___, ___,
+    ___, ___, ___, ___, ___, ___,  25,  31,  61,  14, ___, ___, ___, ___, ___,  12,
+};
+
+static const uint8_t operator_slot[1 << OPERATOR_HASH_BITS] =
+{
+    ___, ___,   9, ___, ___,  12, ___,   1,   0,  15, ___,   6,   2, ___,  14,  13,
+     11,   7, ___,   3, ___,   8, ___, ___,  10,   4,   5, ___, ___, ___, ___, ___,
+};
+#undef ___
+
+// the name is a span of `len` characters, not terminated
+static inline uint64_t name_hash(const char *name, int len, uint32_t seed, int bits)
+{
+    // FNV-1a, then mixed so the high bits depend on all characters
+    uint32_t h = seed;
+    for (int i = 0; i < len; ++ i)
+    {
+        h = (h ^ (uint8_t)name[i]) * 0x01000193;
+    }
+    h ^= h >> 15;
+    h *= 0x2c1b3c6d;
+    h ^= h >> 12;
+    return h >> (32 - bits);
+}
+
+// the index in the table, -1 if not found
+static int lookup_register(const char *name, int len)
+{
+    uint8_t i = register_slot[name_hash(name, len, REGISTER_HASH_SEED, REGISTER_HASH_BITS)];
+    if (i != NAME_SLOT_EMPTY &&
+        strncmp(register_table[i].name, name, len) == 0 &&
+        register_table[i].name[len] == '\0')
+    {
+        return i;
+    }
+    return -1;
+}
+
+static int lookup_operator(const char *name, int len)
+{
+    uint8_t i = operator_slot[name_hash(name, len, OPERATOR_HASH_SEED, OPERATOR_HASH_BITS)];
+    if (i != NAME_SLOT_EMPTY &&
+        strncmp(operator_table[i].name, name, len) == 0 &&
+        operator_table[i].name[len] == '\0')
+    {
+        return i;
+    }
+    return -1;
+}
+
+#ifdef DEBUG_NAME_HASH
+static int search_name_hash(const char *names[], int num, int bits, uint8_t *slot)
+{
+    for (uint32_t seed = 1; seed < 0xffffffff; ++ seed)
+    {
+        memset(slot, NAME_SLOT_EMPTY, 1 << bits);
+        int i = 0;
+        while (i < num)
+        {
+            uint64_t h = name_hash(names[i], strlen(names[i]), seed, bits);
+            if (slot[h] != NAME_SLOT_EMPTY)
+            {
+                break;
+            }
+            slot[h] = i;
+            i += 1;
+        }
+        if (i == num)
+        {
+            return seed;
+        }
+    }
+    assert(0);
+}
+
+static void print_slots(const char *name, int seed, int bits, uint8_t *slot)
+{
+    printf("%s seed %d bits %d\n", name, seed, bits);
+    for (int i = 0; i < (1 << bits); ++ i)
+    {
+        if (slot[i] == NAME_SLOT_EMPTY)
+        {
+            printf("___, ");
+        }
+        else
+        {
+            printf("%3d, ", slot[i]);
+        }
+        if (i % 16 == 15)
+        {
+            printf("\n");
+        }
+    }
+}
+
+// print the seeds and slots of the tables
+void print_name_hash()
+{
+    const char *names[256];
+    uint8_t slot[256];
+
+    for (int i = 0; i < NUM_REGISTER; ++ i)
+    {
+        names[i] = register_table[i].name;
+    }
+    int seed = search_name_hash(names, NUM_REGISTER, REGISTER_HASH_BITS, slot);
+    print_slots("register", seed, REGISTER_HASH_BITS, slot);
+
+    for (int i = 0; i < NUM_OPERATOR; ++ i)
+    {
+        names[i] = operator_table[i].name;
+    }
+    seed = search_name_hash(names, NUM_OPERATOR, OPERATOR_HASH_BITS, slot);
+    print_slots("operator", seed, OPERATOR_HASH_BITS, slot);
+}
+#endif
+
+static uint64_t register_address(uint64_t index);
+
 typedef enum
 {
     INST_PARSE_START,
@@ -197,10 +453,14 @@ typedef enum
     MEM_PARSE_PARSED,
 } mem_parse_state_t;
 
+// the longest name: `leaveq`
+#define MAX_TOKEN_LENGTH (8)
+
 typedef struct
 {
-    // parser for string
-    trie_node_t *trie_node;
+    // the name being parsed: operator or register
+    char token[MAX_TOKEN_LENGTH + 1];
+    int token_len;
 
     // parser for number
     string2uint_state_t imm_state;
@@ -227,10 +487,49 @@ typedef struct
     inst_t *inst;
 } inst_parser_t;
 
+static void token_start(inst_parser_t *p)
+{
+    p->token_len = 0;
+    p->token[0] = '\0';
+}
+
+static void token_append(inst_parser_t *p, char c)
+{
+    assert(p->token_len < MAX_TOKEN_LENGTH);
+    p->token[p->token_len] = c;
+    p->token_len += 1;
+    p->token[p->token_len] = '\0';
+}
+
+static inst_op_t token_operator(inst_parser_t *p)
+{
+    int i = lookup_operator(p->token, p->token_len);
+    assert(i >= 0);
+    return operator_table[i].opcode;
+}
+
+static uint64_t token_register(inst_parser_t *p)
+{
+    int i = lookup_register(p->token, p->token_len);
+    assert(i >= 0);
+    return register_address(i);
+}
+
 static inst_parser_t *parse_instruction_next(inst_parser_t *p, char c);
 static inst_parser_t *parse_operand_next(inst_parser_t *p, char c);
 static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c);
 
+uint64_t zero_register = 0;
+
+static void set_operand(od_t *od, od_type_t type, uint64_t imm, uint64_t scal, uint64_t reg1, uint64_t reg2)
+{
+    od->type = type;
+    od->imm = imm;
+    od->scal = scal;
+    od->reg1 = reg1;
+    od->reg2 = reg2;
+}
+
 // DFA to parse instruction in one-time left-right scanning
 static inst_parser_t *parse_instruction_next(inst_parser_t *p, char c)
 {
@@ -244,10 +543,9 @@ static inst_parser_t *parse_instruction_next(inst_parser_t *p, char c)
             if ('a' <= c && c <= 'z')
             {
                 // start parsing operator
-                p->trie_node = operator_mapping;
+                token_start(p);
                 // accepting first char in operator
-                p->trie_node = trie_next(p->trie_node, c);
-                assert(p->trie_node != NULL);
+                token_append(p, c);
                 p->inst_state = INST_PARSE_OPERATOR;
                 return p;
             }
@@ -260,17 +558,14 @@ static inst_parser_t *parse_instruction_next(inst_parser_t *p, char c)
         case INST_PARSE_OPERATOR:
             if ('a' <= c && c <= 'z')
             {
-                p->trie_node = trie_next(p->trie_node, c);
-                assert(p->trie_node != NULL);
+                token_append(p, c);
                 return p;
             }
             else if (c == ' ' || c == '\t' || c == '\r')
             {
                 // operator parsed
-                assert(p->trie_node != NULL);
-                assert(p->trie_node->isvalue == 1);
                 // get operator
-                p->inst->op = (op_t)p->trie_node->value;
+                p->inst->opcode = token_operator(p);
 
                 // transfer to first operand
                 p->inst_state = INST_PARSE_SPACE_SRC_OPERAND;
@@ -279,16 +574,12 @@ static inst_parser_t *parse_instruction_next(inst_parser_t *p, char c)
             else if (c == '\n')
             {
                 // instruction ends without operand like: `NOP`, `RET`
-                assert(p->trie_node != NULL);
-                assert(p->trie_node->isvalue == 1);
                 // get operator
-                p->inst->op = (op_t)p->trie_node->value;
+                p->inst->opcode = token_operator(p);
 
                 p->inst_state = INST_PARSE_PARSED;
-                p->inst->src.type = OD_EMPTY;
-                p->inst->src.value = 0;
-                p->inst->dst.type = OD_EMPTY;
-                p->inst->dst.value = 0;
+                set_operand(&(p->inst->src), OD_EMPTY, 0, 0, 0, 0);
+                set_operand(&(p->inst->dst), OD_EMPTY, 0, 0, 0, 0);
                 return p;
             }
             assert(0);
@@ -313,10 +604,8 @@ static inst_parser_t *parse_instruction_next(inst_parser_t *p, char c)
             {
                 // instruction ends without operand like: `NOP`, `RET`
                 p->inst_state = INST_PARSE_PARSED;
-                p->inst->src.type = OD_EMPTY;
-                p->inst->src.value = 0;
-                p->inst->dst.type = OD_EMPTY;
-                p->inst->dst.value = 0;
+                set_operand(&(p->inst->src), OD_EMPTY, 0, 0, 0, 0);
+                set_operand(&(p->inst->dst), OD_EMPTY, 0, 0, 0, 0);
                 return p;
             }
             assert(0);
@@ -327,15 +616,13 @@ static inst_parser_t *parse_instruction_next(inst_parser_t *p, char c)
             {
                 // src parsed
                 // copy the result to src
-                p->inst->src.type = p->operand.type;
-                p->inst->src.value = p->operand.value;
+                p->inst->src = p->operand;
 
                 // going to parse dst
                 if (c == '\n')
                 {
                     p->inst_state = INST_PARSE_PARSED;
-                    p->inst->dst.type = OD_EMPTY;
-                    p->inst->dst.value = 0;
+                    set_operand(&(p->inst->dst), OD_EMPTY, 0, 0, 0, 0);
                 }
                 else
                 {
@@ -364,8 +651,7 @@ static inst_parser_t *parse_instruction_next(inst_parser_t *p, char c)
             {
                 // instruction ends without dst operand
                 p->inst_state = INST_PARSE_PARSED;
-                p->inst->dst.type = OD_EMPTY;
-                p->inst->dst.value = 0;
+                set_operand(&(p->inst->dst), OD_EMPTY, 0, 0, 0, 0);
                 return p;
             }
             assert(0);
@@ -376,8 +662,7 @@ static inst_parser_t *parse_instruction_next(inst_parser_t *p, char c)
             {
                 // dst parsed
                 // copy the result to dst
-                p->inst->dst.type = p->operand.type;
-                p->inst->dst.value = p->operand.value;
+                p->inst->dst = p->operand;
 
                 // going to parse dst
                 p->inst_state = INST_PARSE_PARSED;
@@ -413,10 +698,9 @@ static inst_parser_t *parse_operand_next(inst_parser_t *p, char c)
             {
                 // register
                 // start parsing register
-                p->trie_node = register_mapping;
+                token_start(p);
                 // accepting first char in register ('%')
-                p->trie_node = trie_next(p->trie_node, c);
-                assert(p->trie_node != NULL);
+                token_append(p, c);
                 p->od_state = OPERAND_PARSE_REG;
                 return p;
             }
@@ -449,27 +733,23 @@ static inst_parser_t *parse_operand_next(inst_parser_t *p, char c)
             {
                 // end of parsing this operand: imm
                 p->od_state = OPERAND_PARSE_PARSED;
-                p->operand.type = OD_IMM;
-                p->operand.value = p->imm;
+                set_operand(&(p->operand), OD_IMM, p->imm, 0, 0, 0);
                 return p;
             }
             assert(0);
         case OPERAND_PARSE_REG:
             // register
-            if ('a' <= c && c <= 'z')
+            if (('a' <= c && c <= 'z') || ('0' <= c && c <= '9'))
             {
                 // still a register
-                p->trie_node = trie_next(p->trie_node, c);
-                assert(p->trie_node != NULL);
+                token_append(p, c);
                 return p;
             }
             else if (c == ',' || c == ' ' || c == '\t' || c == '\r' || c == '\n')
             {
                 // end of parsing this operand: reg
                 p->od_state = OPERAND_PARSE_PARSED;
-                assert(p->trie_node->isvalue == 1);
-                p->operand.type = OD_REG;
-                p->operand.value = p->trie_node->value;
+                set_operand(&(p->operand), OD_REG, 0, 0, token_register(p), 0);
                 return p;
             }
             assert(0);
@@ -485,8 +765,6 @@ static inst_parser_t *parse_operand_next(inst_parser_t *p, char c)
     }
 }
 
-uint64_t zero_register = 0;
-
 // DFA to parse effective address in one-time left-right scanning
 static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c)
 {
@@ -498,9 +776,15 @@ static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c)
     {
         case MEM_PARSE_START:
             // start parsing effective address
+            // `zero_register` is making the effective address safe to compute
+            // even without reg1 or reg2, so the handler will not check them
+            p->reg1 = (uint64_t)&zero_register;
+            p->reg2 = (uint64_t)&zero_register;
+            p->scal = 1;
             if (('0' <= c && c <= '9') || c == '-')
             {
                 // prefix immediate number
+                p->imm = 0;
                 p->imm_state = STRING2UINT_LEADING_SPACE;
                 p->imm_state = string2uint_next(p->imm_state, c, &(p->imm));
                 if (p->imm_state != STRING2UINT_FAILED)
@@ -540,10 +824,9 @@ static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c)
             {
                 // end of parsing this operand: reg
                 p->mem_state = MEM_PARSE_PARSED;
-                // computing of effective address
-                // this is the work of ALU
-                p->operand.type = OD_MEM;
-                p->operand.value = p->imm;
+                // the computing of effective address is the work of ALU
+                // it is done at run-time by the instruction handler
+                set_operand(&(p->operand), OD_MEM, p->imm, p->scal, p->reg1, p->reg2);
                 return p;
             }
             assert(0);
@@ -553,9 +836,8 @@ static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c)
             {
                 // *(reg1
                 // parsing reg1, '%' accepted
-                p->trie_node = register_mapping;
-                p->trie_node = trie_next(p->trie_node, c);
-                assert(p->trie_node != NULL);
+                token_start(p);
+                token_append(p, c);
                 p->mem_state = MEM_PARSE_FIRST_REGISTER;
                 return p;
             }
@@ -564,7 +846,7 @@ static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c)
                 // *(,reg2...
                 // initialize the second register
                 // and we have not accepted '%' here
-                p->trie_node = register_mapping;
+                token_start(p);
                 p->reg1 = (uint64_t)&zero_register;
                 p->mem_state = MEM_PARSE_SECOND_REGISTER;
                 return p;
@@ -572,34 +854,30 @@ static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c)
             assert(0);
         case MEM_PARSE_FIRST_REGISTER:
             // *(reg1...
-            if ('a' <= c && c <= 'z')
+            if (('a' <= c && c <= 'z') || ('0' <= c && c <= '9'))
             {
                 // parsing reg1
-                p->trie_node = trie_next(p->trie_node, c);
-                assert(p->trie_node != NULL);
+                token_append(p, c);
                 return p;
             }
             else if (c == ',')
             {
                 // end of parsing reg1
-                assert(p->trie_node->isvalue == 1);
-                p->reg1 = p->trie_node->value;
+                p->reg1 = token_register(p);
                 // initialize the second register
                 // and we have not accepted '%' here
-                p->trie_node = register_mapping;
+                token_start(p);
                 p->mem_state = MEM_PARSE_SECOND_REGISTER;
                 return p;
             }
             else if (c == ')')
             {
                 // end of parsing reg1
-                assert(p->trie_node->isvalue == 1);
-                p->reg1 = p->trie_node->value;
+                p->reg1 = token_register(p);
                 p->mem_state = MEM_PARSE_RIGHT_PARENTHESIS;
                 
-                // computing of effective address
-                p->operand.type = OD_MEM;
-                p->operand.value = *(uint64_t *)p->reg1 + p->imm;
+                // effective address: imm(reg1)
+                set_operand(&(p->operand), OD_MEM, p->imm, p->scal, p->reg1, p->reg2);
                 return p;
             }
             assert(0);
@@ -607,18 +885,16 @@ static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c)
             // `zero_register` is making the effective address safe to compute
             // even without reg1, the reg1 is set to zero_register
             // so the we can get 0 from reg1
-            if (c == '%' || ('a' <= c && c <= 'z'))
+            if (c == '%' || ('a' <= c && c <= 'z') || ('0' <= c && c <= '9'))
             {
                 // parsing reg2
-                p->trie_node = trie_next(p->trie_node, c);
-                assert(p->trie_node != NULL);
+                token_append(p, c);
                 return p;
             }
             else if (c == ',')
             {
                 // reg2 parsed
-                assert(p->trie_node->isvalue == 1);
-                p->reg2 = p->trie_node->value;
+                p->reg2 = token_register(p);
                 // going to parse scale
                 p->mem_state = MEM_PARSE_SCALE;
                 return p;
@@ -627,14 +903,12 @@ static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c)
             {
                 // *(*,reg2)
                 // reg2 parsed
-                assert(p->trie_node->isvalue == 1);
-                p->reg2 = p->trie_node->value;
+                p->reg2 = token_register(p);
                 p->scal = 1;
                 p->mem_state = MEM_PARSE_RIGHT_PARENTHESIS;
 
-                // computing of effective address
-                p->operand.type = OD_MEM;
-                p->operand.value = *(uint64_t *)p->reg2 + *(uint64_t *)p->reg1 + p->imm;
+                // effective address: imm(reg1,reg2)
+                set_operand(&(p->operand), OD_MEM, p->imm, p->scal, p->reg1, p->reg2);
                 return p;
             }
             assert(0);
@@ -642,18 +916,17 @@ static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c)
             if (c == '1' || c == '2' || c == '4' || c == '8')
             {
                 p->scal = c - '0';
-                p->od_state = MEM_PARSE_SCALE_PARSED;
+                p->mem_state = MEM_PARSE_SCALE_PARSED;
 
-                // computing of effective address
-                p->operand.type = OD_MEM;
-                p->operand.value = *(uint64_t *)p->reg2 * p->scal + *(uint64_t *)p->reg1 + p->imm;
+                // effective address: imm(reg1,reg2,scal)
+                set_operand(&(p->operand), OD_MEM, p->imm, p->scal, p->reg1, p->reg2);
                 return p;
             }
             assert(0);
         case MEM_PARSE_SCALE_PARSED:
             if (c == ')')
             {
-                p->od_state = MEM_PARSE_RIGHT_PARENTHESIS;
+                p->mem_state = MEM_PARSE_RIGHT_PARENTHESIS;
                 return p;
             }
             assert(0);
@@ -670,17 +943,17 @@ static inst_parser_t *parse_effective_address_next(inst_parser_t *p, char c)
     }
 }
 
-void parse_instruction(char *inst_str, inst_t *inst)
+// the character DFA, kept as the reference of the tokenizer below
+void parse_instruction_dfa(const char *inst_str, inst_t *inst)
 {
-    lazy_initialize_trie();
-
     inst_parser_t parser =
     {
         .inst = inst
     };
     inst_parser_t *p = &parser;
     
-    for (int i = 0; i < strlen(inst_str); ++ i)
+    int len = strlen(inst_str);
+    for (int i = 0; i < len; ++ i)
     {
         p = parse_instruction_next(p, inst_str[i]);
 
@@ -691,4 +964,535 @@ void parse_instruction(char *inst_str, inst_t *inst)
     }
     p = parse_instruction_next(p, '\n');
     assert(p->inst_state == INST_PARSE_PARSED);
-}
\ No newline at end of file
+
+    // operand forms are known after parsing
+    inst->op = select_handler(inst);
+}
+
+/*======================================*/
+/*      tokenizer                       */
+/*======================================*/
+
+// The line is copied to a block of MAX_INSTRUCTION_CHAR bytes and the
+// class of every byte is computed at once as two bitmaps:
+//
+//      space   ' ', '\t', '\r', '\n' and '\0' (the padding after the line)
+//      bound   space, ',', '(' and ')': the end of a token
+//
+// Then a token is the span from the current position to the next bit
+// of `bound`, found by counting trailing zeros, and the mnemonic,
+// register and immediate recognizers take whole spans.
+// `$` and `%` begin a token, so they are checked at its first byte.
+
+#if MAX_INSTRUCTION_CHAR != 64
+#error "the bitmaps of the tokenizer are 64 bits"
+#endif
+
+typedef struct
+{
+    char line[MAX_INSTRUCTION_CHAR] __attribute__((aligned(16)));
+    int len;
+    uint64_t space;
+    uint64_t bound;
+    int pos;
+} tokenizer_t;
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+static void classify_line(tokenizer_t *t)
+{
+    t->space = 0;
+    t->bound = 0;
+    for (int i = 0; i < MAX_INSTRUCTION_CHAR; i += 16)
+    {
+        __m128i v = _mm_load_si128((const __m128i *)&t->line[i]);
+        __m128i space = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+            _mm_or_si128(
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                    _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+                _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+        __m128i punct = _mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8(',')),
+            _mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('(')),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8(')'))));
+        t->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << i;
+        t->bound |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(space, punct)) << i;
+    }
+}
+#else
+static void classify_line(tokenizer_t *t)
+{
+    t->space = 0;
+    t->bound = 0;
+    for (int i = 0; i < MAX_INSTRUCTION_CHAR; ++ i)
+    {
+        char c = t->line[i];
+        uint64_t bit = (uint64_t)1 << i;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0')
+        {
+            t->space |= bit;
+            t->bound |= bit;
+        }
+        else if (c == ',' || c == '(' || c == ')')
+        {
+            t->bound |= bit;
+        }
+    }
+}
+#endif
+
+static void skip_space(tokenizer_t *t)
+{
+    uint64_t m = ~t->space & (~(uint64_t)0 << t->pos);
+    t->pos = m == 0 ? t->len : __builtin_ctzll(m);
+}
+
+// the end of the token at current position, exclusive
+static int token_end(tokenizer_t *t)
+{
+    // the padding after the line is space, so there is always a bound
+    return __builtin_ctzll(t->bound & (~(uint64_t)0 << t->pos));
+}
+
+static int token_ended(tokenizer_t *t)
+{
+    return t->pos >= t->len;
+}
+
+static uint64_t span_register(tokenizer_t *t)
+{
+    int end = token_end(t);
+    int i = lookup_register(&t->line[t->pos], end - t->pos);
+    assert(i >= 0);
+    t->pos = end;
+    return register_address(i);
+}
+
+// the number can be empty, e.g. `(%rax)`
+static uint64_t span_imm(tokenizer_t *t)
+{
+    int end = token_end(t);
+    uint64_t imm = 0;
+    if (end > t->pos)
+    {
+        imm = string2uint_range(t->line, t->pos, end - 1);
+    }
+    t->pos = end;
+    return imm;
+}
+
+static void span_operand(tokenizer_t *t, od_t *od)
+{
+    char c = t->line[t->pos];
+    if (c == '$')
+    {
+        // immediate number
+        t->pos += 1;
+        set_operand(od, OD_IMM, span_imm(t), 0, 0, 0);
+        return;
+    }
+    else if (c == '%')
+    {
+        // register
+        set_operand(od, OD_REG, 0, 0, span_register(t), 0);
+        return;
+    }
+
+    // effective address: imm(reg1,reg2,scal)
+    // `zero_register` is making the effective address safe to compute
+    // even without reg1 or reg2, so the handler will not check them
+    uint64_t imm = span_imm(t);
+    uint64_t reg1 = (uint64_t)&zero_register;
+    uint64_t reg2 = (uint64_t)&zero_register;
+    uint64_t scal = 1;
+    if (t->line[t->pos] == '(')
+    {
+        t->pos += 1;
+        if (t->line[t->pos] == '%')
+        {
+            reg1 = span_register(t);
+        }
+        if (t->line[t->pos] == ',')
+        {
+            t->pos += 1;
+            reg2 = span_register(t);
+            if (t->line[t->pos] == ',')
+            {
+                t->pos += 1;
+                c = t->line[t->pos];
+                assert(c == '1' || c == '2' || c == '4' || c == '8');
+                scal = c - '0';
+                t->pos += 1;
+            }
+        }
+        assert(t->line[t->pos] == ')');
+        t->pos += 1;
+    }
+    set_operand(od, OD_MEM, imm, scal, reg1, reg2);
+}
+
+void parse_instruction(const char *inst_str, inst_t *inst)
+{
+    tokenizer_t t;
+    t.len = strlen(inst_str);
+    assert(t.len < MAX_INSTRUCTION_CHAR);
+    memset(t.line, 0, MAX_INSTRUCTION_CHAR);
+    memcpy(t.line, inst_str, t.len);
+    t.pos = 0;
+    classify_line(&t);
+
+    // operator
+    skip_space(&t);
+    int end = token_end(&t);
+    int i = lookup_operator(&t.line[t.pos], end - t.pos);
+    assert(i >= 0);
+    inst->opcode = operator_table[i].opcode;
+    t.pos = end;
+
+    set_operand(&(inst->src), OD_EMPTY, 0, 0, 0, 0);
+    set_operand(&(inst->dst), OD_EMPTY, 0, 0, 0, 0);
+
+    skip_space(&t);
+    if (token_ended(&t) == 0)
+    {
+        span_operand(&t, &(inst->src));
+        skip_space(&t);
+        if (token_ended(&t) == 0)
+        {
+            assert(t.line[t.pos] == ',');
+            t.pos += 1;
+            skip_space(&t);
+            span_operand(&t, &(inst->dst));
+            skip_space(&t);
+            assert(token_ended(&t) == 1);
+        }
+    }
+
+    // operand forms are known after parsing
+    inst->op = select_handler(inst);
+}
+
+/*======================================*/
+/*      binary encoding                 */
+/*======================================*/
+
+#define ZERO_REGISTER_INDEX (0xff)
+
+static uint64_t register_index(uint64_t reg)
+{
+    if (reg == 0 || reg == (uint64_t)&zero_register)
+    {
+        return ZERO_REGISTER_INDEX;
+    }
+    for (int i = 0; i < NUM_REGISTER; ++ i)
+    {
+        if (reg == register_address(i))
+        {
+            // the aliases share the same address, e.g. %rax and %eax
+            // the first one is taken since handlers operate on 64 bits
+            return i;
+        }
+    }
+    assert(0);
+    return ZERO_REGISTER_INDEX;
+}
+
+static int register_index_valid(uint64_t index)
+{
+    return index == ZERO_REGISTER_INDEX || index < NUM_REGISTER;
+}
+
+static uint64_t register_address(uint64_t index)
+{
+    if (index == ZERO_REGISTER_INDEX)
+    {
+        return (uint64_t)&zero_register;
+    }
+    assert(index < NUM_REGISTER);
+    return (uint64_t)&cpu_reg + register_table[index].offset;
+}
+
+static uint64_t scale_log2(uint64_t scal)
+{
+    switch (scal)
+    {
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        default: return 0;
+    }
+}
+
+static int immediate_is_presented(od_t *od)
+{
+    return (od->type == OD_IMM || od->type == OD_MEM) && od->imm != 0;
+}
+
+static int fits_in_int32(uint64_t imm)
+{
+    return (int64_t)(int32_t)(uint32_t)imm == (int64_t)imm;
+}
+
+// encode the parsed instruction to 16 bytes
+static void encode_instruction(inst_t *inst, uint8_t *code)
+{
+    uint64_t head = 0;
+    uint64_t imm = 0;
+
+    head |= ((uint64_t)inst->opcode & 0xff) << 0;
+    head |= ((uint64_t)inst->src.type & 0xf) << 8;
+    head |= ((uint64_t)inst->dst.type & 0xf) << 12;
+    head |= scale_log2(inst->src.scal) << 16;
+    head |= scale_log2(inst->dst.scal) << 18;
+    head |= register_index(inst->src.reg1) << 24;
+    head |= register_index(inst->src.reg2) << 32;
+    head |= register_index(inst->dst.reg1) << 40;
+    head |= register_index(inst->dst.reg2) << 48;
+
+    int src_imm = immediate_is_presented(&(inst->src));
+    int dst_imm = immediate_is_presented(&(inst->dst));
+    if (src_imm == 1 && dst_imm == 1)
+    {
+        // e.g. cmpq $0x0,-0x8(%rbp)
+        // both are 32-bit signed as X86 does
+        assert(fits_in_int32(inst->src.imm));
+        assert(fits_in_int32(inst->dst.imm));
+        head |= (uint64_t)1 << 20;
+        imm = (inst->src.imm & 0xffffffff) | ((inst->dst.imm & 0xffffffff) << 32);
+    }
+    else if (dst_imm == 1)
+    {
+        head |= (uint64_t)1 << 21;
+        imm = inst->dst.imm;
+    }
+    else
+    {
+        imm = inst->src.imm;
+    }
+
+    for (int i = 0; i < 8; ++ i)
+    {
+        code[i] = (head >> (i * 8)) & 0xff;
+        code[i + 8] = (imm >> (i * 8)) & 0xff;
+    }
+}
+
+static void decode_operand_bits(od_t *od, uint64_t type, uint64_t scal_log2, 
+    uint64_t reg1, uint64_t reg2, uint64_t imm)
+{
+    od->type = (od_type_t)type;
+    od->imm = imm;
+    od->scal = (uint64_t)1 << scal_log2;
+    od->reg1 = register_address(reg1);
+    od->reg2 = register_address(reg2);
+}
+
+// decode the 16 bytes to instruction with shifts and masks
+static void decode_binary(const uint8_t *code, inst_t *inst)
+{
+    uint64_t head = 0;
+    uint64_t imm = 0;
+    for (int i = 0; i < 8; ++ i)
+    {
+        head |= (uint64_t)code[i] << (i * 8);
+        imm |= (uint64_t)code[i + 8] << (i * 8);
+    }
+
+    uint64_t opcode = head & 0xff;
+    inst->label = NULL;
+    inst->fused = NULL;
+    inst->fusion = FUSION_NONE;
+    if (opcode >= NUM_INSTRTYPE ||
+        register_index_valid((head >> 24) & 0xff) == 0 ||
+        register_index_valid((head >> 32) & 0xff) == 0 ||
+        register_index_valid((head >> 40) & 0xff) == 0 ||
+        register_index_valid((head >> 48) & 0xff) == 0)
+    {
+        // guest bytes that are no instruction: illegal instruction when run
+        // the opcode only has to be in range for the tables indexed by it
+        inst->opcode = INST_NOP;
+        decode_operand_bits(&(inst->src), OD_EMPTY, 0, 0, 0, 0);
+        decode_operand_bits(&(inst->dst), OD_EMPTY, 0, 0, 0, 0);
+        inst->op = &illegal_handler;
+        return;
+    }
+    inst->opcode = (inst_op_t)opcode;
+
+    uint64_t src_imm = 0;
+    uint64_t dst_imm = 0;
+    if (((head >> 20) & 0x1) == 1)
+    {
+        // split: sign-extend both 32-bit immediates
+        src_imm = (uint64_t)(int64_t)(int32_t)(uint32_t)(imm & 0xffffffff);
+        dst_imm = (uint64_t)(int64_t)(int32_t)(uint32_t)(imm >> 32);
+    }
+    else if (((head >> 21) & 0x1) == 1)
+    {
+        dst_imm = imm;
+    }
+    else
+    {
+        src_imm = imm;
+    }
+
+    decode_operand_bits(&(inst->src), (head >> 8) & 0xf, (head >> 16) & 0x3,
+        (head >> 24) & 0xff, (head >> 32) & 0xff, src_imm);
+    decode_operand_bits(&(inst->dst), (head >> 12) & 0xf, (head >> 18) & 0x3,
+        (head >> 40) & 0xff, (head >> 48) & 0xff, dst_imm);
+
+    inst->op = select_handler(inst);
+}
+
+// the assembler: translate one line of assembly to binary code
+void assemble_instruction(const char *inst_str, uint8_t *code)
+{
+    inst_t inst;
+    parse_instruction(inst_str, &inst);
+    encode_instruction(&inst, code);
+}
+
+/*======================================*/
+/*      decoded instruction cache       */
+/*======================================*/
+
+// Loops execute the same instructions again and again.
+// The decoded result of an instruction is kept by its physical address,
+// so the fetch & decode is done only on the first execution.
+// Since register values are not decoded into operands, the cached
+// instruction is valid until the code in DRAM is written.
+
+// from translate.c
+void block_cache_invalidate(uint64_t ppn);
+
+// from isa.c
+void softmmu_protect_code(uint64_t paddr);
+
+// one slot for each instruction in physical memory
+#define NUM_DECODED_INSTRUCTION (PHYSICAL_MEMORY_SPACE / INSTRUCTION_SIZE)
+
+typedef struct
+{
+    int valid;
+    inst_t inst;
+} decoded_inst_t;
+
+struct DECODE_STATE
+{
+    decoded_inst_t cache[NUM_DECODED_INSTRUCTION];
+    // the number of valid decoded instructions in each physical page
+    // a store to the page without any decoded instruction returns at once
+    int count[MAX_NUM_PHYSICAL_PAGE];
+};
+
+// the decoded instructions hold the addresses of the registers,
+// so they belong to the core
+static inline struct DECODE_STATE *decode_state()
+{
+    if (active_core->decode == NULL)
+    {
+        active_core->decode = machine_calloc(sizeof(struct DECODE_STATE));
+    }
+    return active_core->decode;
+}
+#define decoded_cache (decode_state()->cache)
+#define decoded_count (decode_state()->count)
+
+// fetch & decode the instruction at physical address
+inst_t *decode_instruction(uint64_t pc_paddr)
+{
+    assert(pc_paddr % INSTRUCTION_SIZE == 0);
+    assert(pc_paddr < PHYSICAL_MEMORY_SPACE);
+
+    decoded_inst_t *slot = &decoded_cache[pc_paddr / INSTRUCTION_SIZE];
+    if (slot->valid == 1)
+    {
+        // hit: no fetch, no decode
+        return &(slot->inst);
+    }
+
+    // miss: get the binary code from DRAM and decode it
+    uint8_t code[INSTRUCTION_SIZE];
+    cpu_readinst_dram(pc_paddr, code);
+    decode_binary(code, &(slot->inst));
+
+    slot->valid = 1;
+    if (decoded_count[pc_paddr >> PHYSICAL_PAGE_OFFSET_LENGTH] == 0)
+    {
+        // the first code of the page, its stores must invalidate it
+        softmmu_protect_code(pc_paddr);
+    }
+    decoded_count[pc_paddr >> PHYSICAL_PAGE_OFFSET_LENGTH] += 1;
+    return &(slot->inst);
+}
+
+// invalidate the decoded instructions of the active core
+static void invalidate_page(uint64_t ppn)
+{
+    if (active_core->decode == NULL || decoded_count[ppn] == 0)
+    {
+        return;
+    }
+
+    int start = (ppn << PHYSICAL_PAGE_OFFSET_LENGTH) / INSTRUCTION_SIZE;
+    for (int i = 0; i < PAGE_SIZE / INSTRUCTION_SIZE; ++ i)
+    {
+        decoded_cache[start + i].valid = 0;
+    }
+    decoded_count[ppn] = 0;
+
+    // blocks are translated from the decoded instructions
+    block_cache_invalidate(ppn);
+}
+
+// invalidate all decoded instructions in the physical page of paddr
+// this should be called by every write to DRAM
+// the code may be decoded by any core sharing the DRAM
+void decoded_cache_invalidate(uint64_t paddr)
+{
+    uint64_t ppn = paddr >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    if (ppn >= MAX_NUM_PHYSICAL_PAGE)
+    {
+        return;
+    }
+
+    core_t *self = active_core;
+    for (int i = 0; i < machine->num_cores; ++ i)
+    {
+        active_core = &(machine->cores[i]);
+        invalidate_page(ppn);
+    }
+    active_core = self;
+}
+
+// no core has decoded instructions in the physical page of paddr
+int decoded_cache_empty(uint64_t paddr)
+{
+    uint64_t ppn = paddr >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    if (ppn >= MAX_NUM_PHYSICAL_PAGE)
+    {
+        return 1;
+    }
+    for (int i = 0; i < machine->num_cores; ++ i)
+    {
+        struct DECODE_STATE *s = machine->cores[i].decode;
+        if (s != NULL && s->count[ppn] != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void decoded_cache_flush()
+{
+    for (int i = 0; i < MAX_NUM_PHYSICAL_PAGE; ++ i)
+    {
+        decoded_cache_invalidate(i << PHYSICAL_PAGE_OFFSET_LENGTH);
+    }
+}
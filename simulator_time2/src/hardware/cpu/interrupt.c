@@ -7,6 +7,7 @@
 #include "header/interrupt.h"
 #include "header/process.h"
 #include "header/address.h"
+#include "header/machine.h"
 
 typedef void (*interrupt_handler_t)();
 
@@ -29,6 +30,11 @@ void do_syscall(int syscall_no);
 void fix_pagefault();
 void os_schedule();
 
+#ifdef USE_PARALLEL
+// from dram.c
+int dram_buffered();
+#endif
+
 // initialize of IDT
 void idt_init()
 {
@@ -164,6 +170,8 @@ static void software_push_userframe()
     assert((rsp + tf_size) == get_kstack_top_TSS());
 
     // store user frame to kstack
+    // the lazy flags are computed before saved
+    cpu_flags_materialize();
     rsp -= uf_size;
     userframe_t uf = {
         .regs = cpu_reg,
@@ -213,6 +221,20 @@ static void software_pop_userframe()
 void interrupt_stack_switching(uint64_t int_vec)
 {
     assert(0 <= int_vec && int_vec <= 255);
+#ifdef USE_PARALLEL
+    if (dram_buffered() == 1)
+    {
+        // in the quantum of parallel run: the kernel writes DRAM, and the
+        // TLBs and decoded code of all cores. So the core stops here, and
+        // the kernel is entered at the barrier when no core is running.
+        active_core->interrupt_deferred = 1;
+        active_core->deferred_vector = int_vec;
+        longjmp(USER_INSTRUCTION_ON_IRET, 1);
+    }
+#endif
+#ifdef USE_PROFILE
+    profile_interrupt_vector = int_vec;
+#endif
 
     //  1.  Temporarily saves (internally) the current contents of 
     //      the SS, ESP, EFLAGS, CS, and EIP registers.
@@ -263,6 +285,23 @@ void interrupt_stack_switching(uint64_t int_vec)
     longjmp(USER_INSTRUCTION_ON_IRET, 1);
 }
 
+#ifdef USE_PARALLEL
+// enter the kernel for the interrupt deferred in the quantum of parallel run
+// it returns after the interrupt return
+void interrupt_deferred_enter()
+{
+    if (active_core->interrupt_deferred == 0)
+    {
+        return;
+    }
+    active_core->interrupt_deferred = 0;
+    if (setjmp(USER_INSTRUCTION_ON_IRET) == 0)
+    {
+        interrupt_stack_switching(active_core->deferred_vector);
+    }
+}
+#endif
+
 // interrupt return with stack switching (kernel --> user)
 void interrupt_return_stack_switching()
 {
@@ -348,7 +387,6 @@ static void print_kstack()
     
     // whole stack
     int size64 = sizeof(uint64_t);
-    int num64 = KERNEL_STACK_SIZE / size64;
     int n_cols = 8;
     uint64_t base = kstack_top_vaddr - size64;
     for (int r = 0; r < 3; ++ r)
@@ -15,20 +15,26 @@
 #include "header/cpu.h"
 #include "header/memory.h"
 #include "header/common.h"
+#include "header/address.h"
 #include "header/algorithm.h"
 #include "header/instruction.h"
 #include "header/interrupt.h"
+#include "header/machine.h"
 
 // update the rip pointer to the next instruction sequentially
 static inline void increase_pc()
 {
-    // we are handling the fixed-length of assembly string here
+    // we are handling the fixed-length of binary encoding here
     // but their size can be variable as true X86 instructions
     // that's because the operands' sizes follow the specific encoding rule
     // the risc-v is a fixed length ISA
-    cpu_pc.rip = cpu_pc.rip + sizeof(char) * MAX_INSTRUCTION_CHAR;
+    cpu_pc.rip = cpu_pc.rip + INSTRUCTION_SIZE;
 }
 
+// the number of retired instructions in the current `cpu_run`
+// in the core, so it is not lost by the longjmp of interrupt
+#define instruction_retired (active_core->instruction_retired)
+
 // instruction handlers
 
 /*  A Message from Interrupt & Page Fault:
@@ -53,109 +59,390 @@ static inline void increase_pc()
  *          process 1, second `mov`: no page fault
  */
 
-void mov_handler(od_t *src_od, od_t *dst_od)
+// The handlers are specialized by the operand forms:
+//      i - immediate number
+//      r - register
+//      m - memory, by the effective address
+// The form is chosen by the decoder in inst.c and stored in `inst_t.op`,
+// so the handlers do not check the operand types when executing.
+
+// register operand: the address of the register
+static inline uint64_t *register_of(od_t *od)
+{
+    return (uint64_t *)od->reg1;
+}
+
+// memory operand: the virtual address - effective address
+// reg1 and reg2 are `zero_register` when not presented
+// the registers are read here, not in decoding,
+// so the decoded instruction can be executed for many times
+static inline uint64_t effective_address(od_t *od)
+{
+    return od->imm + 
+        *(uint64_t *)(od->reg1) + 
+        *(uint64_t *)(od->reg2) * od->scal;
+}
+
+// dst + src, and record it for the condition flags
+static inline uint64_t add_and_set_flags(uint64_t src, uint64_t dst)
+{
+    // signed and unsigned value follow the same addition. e.g.
+    // 5 = 0000000000000101, 3 = 0000000000000011, -3 = 1111111111111101, 5 + (-3) = 0000000000000010
+    uint64_t val = dst + src;
+
+    cpu_flags.lazy_op = FLAGS_OP_ADD;
+    cpu_flags.lazy_src = src;
+    cpu_flags.lazy_dst = dst;
+    cpu_flags.lazy_val = val;
+    return val;
+}
+
+// dst - src = dst + (-src), and record it for the condition flags
+static inline uint64_t sub_and_set_flags(uint64_t src, uint64_t dst)
+{
+    uint64_t val = dst + (~src + 1);
+
+    cpu_flags.lazy_op = FLAGS_OP_SUB;
+    cpu_flags.lazy_src = src;
+    cpu_flags.lazy_dst = dst;
+    cpu_flags.lazy_val = val;
+    return val;
+}
+
+static inline void clear_flags()
 {
-    if (src_od->type == OD_REG && dst_od->type == OD_REG)
+    cpu_flags.__flags_value = 0;
+    cpu_flags.lazy_op = FLAGS_OP_NONE;
+}
+
+// compute the 4 flags only when they are read:
+// by the conditional jumps, or when the flags are saved as context
+void cpu_flags_materialize()
+{
+    uint64_t src = cpu_flags.lazy_src;
+    uint64_t dst = cpu_flags.lazy_dst;
+    uint64_t val = cpu_flags.lazy_val;
+
+    int val_sign = ((val >> 63) & 0x1);
+    int src_sign = ((src >> 63) & 0x1);
+    int dst_sign = ((dst >> 63) & 0x1);
+
+    switch (cpu_flags.lazy_op)
     {
-        // src: register
-        // dst: register
-        *(uint64_t *)(dst_od->value) = *(uint64_t *)(src_od->value);
-        increase_pc();
-        cpu_flags.__flags_value = 0;
-        return;
+        case FLAGS_OP_ADD:
+            cpu_flags.CF = (val < src); // unsigned
+            cpu_flags.ZF = (val == 0);
+            cpu_flags.SF = val_sign;
+            cpu_flags.OF = (src_sign == 0 && dst_sign == 0 && val_sign == 1) || (src_sign == 1 && dst_sign == 1 && val_sign == 0);
+            break;
+        case FLAGS_OP_SUB:
+            cpu_flags.CF = (val > dst); // unsigned
+            cpu_flags.ZF = (val == 0);
+            cpu_flags.SF = val_sign;
+            cpu_flags.OF = (src_sign == 1 && dst_sign == 0 && val_sign == 1) || (src_sign == 0 && dst_sign == 1 && val_sign == 0);
+            break;
+        default:
+            break;
     }
-    else if (src_od->type == OD_REG && dst_od->type == OD_MEM)
+    cpu_flags.lazy_op = FLAGS_OP_NONE;
+}
+
+// zero flag only: the result is all we need
+static inline uint16_t read_ZF()
+{
+    if (cpu_flags.lazy_op != FLAGS_OP_NONE)
     {
-        // src: register
-        // dst: virtual address
-        uint64_t dst_pa = va2pa(dst_od->value);
-        cpu_write64bits_dram(dst_pa, *(uint64_t *)(src_od->value));
-        increase_pc();
-        cpu_flags.__flags_value = 0;
-        return;
+        return (cpu_flags.lazy_val == 0);
+    }
+    return cpu_flags.ZF;
+}
+
+/*--------------------------------------*/
+/*      software TLB                    */
+/*--------------------------------------*/
+
+// With -DUSE_SOFTMMU the handlers access the memory by host pointers.
+// A direct-mapped table for each access type caches the host address
+// of the physical page of the virtual page, filled by `va2pa` when it
+// misses. So the 8 bytes inside a page are one probe and one host load
+// or store, not the translation and the bytes assembled from DRAM.
+//
+// A page is not cached for stores while any core has decoded
+// instructions in it, so self-modifying code still goes by
+// `cpu_write64bits_dram`, which invalidates the decoded instructions.
+// The table is flushed with the TLB and when CR3 is written, and it is
+// bypassed in SIM_DETAIL if the SRAM cache or the TLB is simulated,
+// since the models must see each access.
+
+#if defined(USE_SOFTMMU) && defined(USE_PARALLEL)
+#error "the software TLB is not supported by the buffered stores of parallel run"
+#endif
+
+#if defined(USE_SOFTMMU) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+#error "the software TLB loads and stores the little-endian DRAM by host"
+#endif
+
+// from inst.c
+int decoded_cache_empty(uint64_t paddr);
+
+#define SOFTMMU_SIZE (256)
+
+typedef enum
+{
+    SOFTMMU_LOAD,
+    SOFTMMU_STORE,
+    NUM_SOFTMMU_ACCESS,
+} softmmu_access_t;
+
+typedef struct
+{
+    uint64_t vpn;       // all ones if not valid
+    uint8_t *page;      // host address of the physical page in `pm`
+} softmmu_entry_t;
+
+struct SOFTMMU_STATE
+{
+    softmmu_entry_t table[NUM_SOFTMMU_ACCESS][SOFTMMU_SIZE];
+};
+
+static void flush_softmmu(struct SOFTMMU_STATE *s)
+{
+    for (int a = 0; a < NUM_SOFTMMU_ACCESS; ++ a)
+    {
+        for (int i = 0; i < SOFTMMU_SIZE; ++ i)
+        {
+            // no virtual page number is all ones
+            s->table[a][i].vpn = 0xffffffffffffffff;
+        }
     }
-    else if (src_od->type == OD_MEM && dst_od->type == OD_REG)
+}
+
+static inline struct SOFTMMU_STATE *softmmu_state()
+{
+    if (active_core->softmmu == NULL)
     {
-        // src: virtual address
-        // dst: register
-        uint64_t src_pa = va2pa(src_od->value);
-        *(uint64_t *)(dst_od->value) = cpu_read64bits_dram(src_pa);
-        increase_pc();
-        cpu_flags.__flags_value = 0;
-        return;
+        active_core->softmmu = machine_calloc(sizeof(struct SOFTMMU_STATE));
+        flush_softmmu(active_core->softmmu);
     }
-    else if (src_od->type == OD_IMM && dst_od->type == OD_REG)
+    return active_core->softmmu;
+}
+
+// remove the pages of all cores, with the TLB flush and shootdown
+void softmmu_flush()
+{
+    for (int i = 0; i < machine->num_cores; ++ i)
     {
-        // src: immediate number (uint64_t bit map)
-        // dst: register
-        *(uint64_t *)(dst_od->value) = (src_od->value);
-        increase_pc();
-        cpu_flags.__flags_value = 0;
-        return;
+        if (machine->cores[i].softmmu != NULL)
+        {
+            flush_softmmu(machine->cores[i].softmmu);
+        }
     }
 }
 
-void push_handler(od_t *src_od, od_t *dst_od)
+// remove the pages of active core, when its CR3 is written
+void softmmu_flush_core()
 {
-    if (src_od->type == OD_REG)
+    if (active_core->softmmu != NULL)
     {
-        // src: register
-        // dst: empty
-        cpu_reg.rsp = cpu_reg.rsp - 8;
-        uint64_t rsp_pa = va2pa(cpu_reg.rsp);
-        cpu_write64bits_dram(
-            rsp_pa, 
-            *(uint64_t *)(src_od->value));
-        increase_pc();
-        cpu_flags.__flags_value = 0;
-        return;
+        flush_softmmu(active_core->softmmu);
     }
 }
 
-void pop_handler(od_t *src_od, od_t *dst_od)
+// the physical page has decoded instructions from now on,
+// the stores to it must go by DRAM
+void softmmu_protect_code(uint64_t paddr)
 {
-    if (src_od->type == OD_REG)
+    uint8_t *page = &pm[paddr & ~(uint64_t)(PAGE_SIZE - 1)];
+    for (int i = 0; i < machine->num_cores; ++ i)
     {
-        // src: register
-        // dst: empty
-        uint64_t rsp_pa = va2pa(cpu_reg.rsp);
-        uint64_t old_val = cpu_read64bits_dram(rsp_pa);
-        cpu_reg.rsp = cpu_reg.rsp + 8;
-        *(uint64_t *)(src_od->value) = old_val;
-        increase_pc();
-        cpu_flags.__flags_value = 0;
+        struct SOFTMMU_STATE *s = machine->cores[i].softmmu;
+        for (int j = 0; s != NULL && j < SOFTMMU_SIZE; ++ j)
+        {
+            if (s->table[SOFTMMU_STORE][j].page == page)
+            {
+                s->table[SOFTMMU_STORE][j].vpn = 0xffffffffffffffff;
+            }
+        }
+    }
+}
+
+#if defined(USE_SRAM_CACHE) || defined(USE_TLB_HARDWARE)
+#define softmmu_bypassed() sim_detailed()
+#else
+#define softmmu_bypassed() (0)
+#endif
+
+// the entry of the page of the 8 bytes at `vaddr`, NULL if bypassed
+static inline softmmu_entry_t *softmmu_entry(uint64_t vaddr, softmmu_access_t access)
+{
+    if (softmmu_bypassed() || (vaddr & (PAGE_SIZE - 1)) > PAGE_SIZE - 8)
+    {
+        return NULL;
+    }
+    uint64_t vpn = vaddr >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    return &(softmmu_state()->table[access][vpn % SOFTMMU_SIZE]);
+}
+
+static inline void softmmu_fill(softmmu_entry_t *e, uint64_t vaddr, uint64_t paddr)
+{
+    e->vpn = vaddr >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    e->page = &pm[paddr & ~(uint64_t)(PAGE_SIZE - 1)];
+}
+
+// 8 bytes at the virtual address
+static inline uint64_t load64(uint64_t vaddr)
+{
+#ifdef USE_SOFTMMU
+    softmmu_entry_t *e = softmmu_entry(vaddr, SOFTMMU_LOAD);
+    if (e != NULL)
+    {
+        uint64_t val;
+        if (e->vpn != (vaddr >> PHYSICAL_PAGE_OFFSET_LENGTH))
+        {
+            softmmu_fill(e, vaddr, va2pa(vaddr));
+        }
+        memcpy(&val, e->page + (vaddr & (PAGE_SIZE - 1)), sizeof(uint64_t));
+        return val;
+    }
+#endif
+    return cpu_read64bits_dram(va2pa(vaddr));
+}
+
+static inline void store64(uint64_t vaddr, uint64_t data)
+{
+#ifdef USE_SOFTMMU
+    softmmu_entry_t *e = softmmu_entry(vaddr, SOFTMMU_STORE);
+    if (e != NULL)
+    {
+        if (e->vpn != (vaddr >> PHYSICAL_PAGE_OFFSET_LENGTH))
+        {
+            uint64_t paddr = va2pa(vaddr);
+            if (decoded_cache_empty(paddr) == 0)
+            {
+                // the code of the page is invalidated by DRAM
+                cpu_write64bits_dram(paddr, data);
+                return;
+            }
+            softmmu_fill(e, vaddr, paddr);
+        }
+        memcpy(e->page + (vaddr & (PAGE_SIZE - 1)), &data, sizeof(uint64_t));
         return;
     }
+#endif
+    cpu_write64bits_dram(va2pa(vaddr), data);
+}
+
+// read the memory operand
+static inline uint64_t read_memory(od_t *od)
+{
+    return load64(effective_address(od));
+}
+
+/*--------------------------------------*/
+/*      mov                             */
+/*--------------------------------------*/
+
+void mov_r_r_handler(od_t *src_od, od_t *dst_od)
+{
+    *register_of(dst_od) = *register_of(src_od);
+    increase_pc();
+    clear_flags();
+}
+
+void mov_r_m_handler(od_t *src_od, od_t *dst_od)
+{
+    store64(effective_address(dst_od), *register_of(src_od));
+    increase_pc();
+    clear_flags();
+}
+
+void mov_m_r_handler(od_t *src_od, od_t *dst_od)
+{
+    *register_of(dst_od) = read_memory(src_od);
+    increase_pc();
+    clear_flags();
+}
+
+void mov_i_r_handler(od_t *src_od, od_t *dst_od)
+{
+    // src: immediate number (uint64_t bit map)
+    *register_of(dst_od) = src_od->imm;
+    increase_pc();
+    clear_flags();
+}
+
+void mov_i_m_handler(od_t *src_od, od_t *dst_od)
+{
+    store64(effective_address(dst_od), src_od->imm);
+    increase_pc();
+    clear_flags();
+}
+
+/*--------------------------------------*/
+/*      stack                           */
+/*--------------------------------------*/
+
+void push_r_handler(od_t *src_od, od_t *dst_od)
+{
+    store64(cpu_reg.rsp - 8, *register_of(src_od));
+    cpu_reg.rsp = cpu_reg.rsp - 8;
+    increase_pc();
+    clear_flags();
+}
+
+void push_i_handler(od_t *src_od, od_t *dst_od)
+{
+    store64(cpu_reg.rsp - 8, src_od->imm);
+    cpu_reg.rsp = cpu_reg.rsp - 8;
+    increase_pc();
+    clear_flags();
+}
+
+void pop_r_handler(od_t *src_od, od_t *dst_od)
+{
+    uint64_t old_val = load64(cpu_reg.rsp);
+    cpu_reg.rsp = cpu_reg.rsp + 8;
+    *register_of(src_od) = old_val;
+    increase_pc();
+    clear_flags();
 }
 
 void leave_handler(od_t *src_od, od_t *dst_od)
 {
     // movq %rbp, %rsp
-    cpu_reg.rsp = cpu_reg.rbp;
-
     // popq %rbp
-    uint64_t rsp_pa = va2pa(cpu_reg.rsp);
-    uint64_t old_val = cpu_read64bits_dram(rsp_pa);
-    cpu_reg.rsp = cpu_reg.rsp + 8;
+    uint64_t old_val = load64(cpu_reg.rbp);
+    cpu_reg.rsp = cpu_reg.rbp + 8;
     cpu_reg.rbp = old_val;
     increase_pc();
-    cpu_flags.__flags_value = 0;
+    clear_flags();
 }
 
-void call_handler(od_t *src_od, od_t *dst_od)
+/*--------------------------------------*/
+/*      control transfer                */
+/*--------------------------------------*/
+
+// src: virtual address of target function starting
+static inline void call_target(uint64_t target)
 {
-    // src: immediate number: virtual address of target function starting
-    // dst: empty
     // push the return value
+    store64(cpu_reg.rsp - 8, cpu_pc.rip + INSTRUCTION_SIZE);
     cpu_reg.rsp = cpu_reg.rsp - 8;
-    uint64_t rsp_pa = va2pa(cpu_reg.rsp);
-    cpu_write64bits_dram(
-        rsp_pa,
-        cpu_pc.rip + sizeof(char) * MAX_INSTRUCTION_CHAR);
     // jump to target function address
     // TODO: support PC relative addressing
-    cpu_pc.rip = (src_od->value);
-    cpu_flags.__flags_value = 0;
+    cpu_pc.rip = target;
+    clear_flags();
+}
+
+void call_i_handler(od_t *src_od, od_t *dst_od)
+{
+    call_target(src_od->imm);
+}
+
+void call_m_handler(od_t *src_od, od_t *dst_od)
+{
+    // `callq 0x00400000`: the address is written as effective address
+    call_target(effective_address(src_od));
 }
 
 void ret_handler(od_t *src_od, od_t *dst_od)
@@ -163,208 +450,788 @@ void ret_handler(od_t *src_od, od_t *dst_od)
     // src: empty
     // dst: empty
     // pop rsp
-    uint64_t rsp_pa = va2pa(cpu_reg.rsp);
-    uint64_t ret_addr = cpu_read64bits_dram(rsp_pa);
+    uint64_t ret_addr = load64(cpu_reg.rsp);
     cpu_reg.rsp = cpu_reg.rsp + 8;
     // jump to return address
     cpu_pc.rip = ret_addr;
-    cpu_flags.__flags_value = 0;
+    clear_flags();
 }
 
-void add_handler(od_t *src_od, od_t *dst_od)
+static inline void jne_target(uint64_t target)
 {
-    if (src_od->type == OD_REG && dst_od->type == OD_REG)
+    if (read_ZF() == 0)
+    {
+        // last instruction value != 0
+        cpu_pc.rip = target;
+    }
+    else
     {
-        // src: register (value: int64_t bit map)
-        // dst: register (value: int64_t bit map)
-        uint64_t val = *(uint64_t *)(dst_od->value) + *(uint64_t *)(src_od->value);
-
-        int val_sign = ((val >> 63) & 0x1);
-        int src_sign = ((*(uint64_t *)(src_od->value) >> 63) & 0x1);
-        int dst_sign = ((*(uint64_t *)(dst_od->value) >> 63) & 0x1);
-
-        // set condition flags
-        cpu_flags.CF = (val < *(uint64_t *)(src_od->value)); // unsigned
-        cpu_flags.ZF = (val == 0);
-        cpu_flags.SF = val_sign;
-        cpu_flags.OF = (src_sign == 0 && dst_sign == 0 && val_sign == 1) || (src_sign == 1 && dst_sign == 1 && val_sign == 0);
-
-        // update registers
-        *(uint64_t *)(dst_od->value) = val;
-        // signed and unsigned value follow the same addition. e.g.
-        // 5 = 0000000000000101, 3 = 0000000000000011, -3 = 1111111111111101, 5 + (-3) = 0000000000000010
+        // last instruction value == 0
         increase_pc();
-        return;
     }
+    clear_flags();
 }
 
-void sub_handler(od_t *src_od, od_t *dst_od)
+void jne_i_handler(od_t *src_od, od_t *dst_od)
 {
-    if (src_od->type == OD_IMM && dst_od->type == OD_REG)
-    {
-        // src: register (value: int64_t bit map)
-        // dst: register (value: int64_t bit map)
-        // (dst_od->value) = (dst_od->value) - (src_od->value) = (dst_od->value) + (-(src_od->value))
-        uint64_t val = *(uint64_t *)(dst_od->value) + (~(src_od->value) + 1);
+    jne_target(src_od->imm);
+}
+
+void jne_m_handler(od_t *src_od, od_t *dst_od)
+{
+    // src_od is actually a instruction memory address
+    // but we are interpreting it as an immediate number
+    jne_target(effective_address(src_od));
+}
 
-        int val_sign = ((val >> 63) & 0x1);
-        int src_sign = (((src_od->value) >> 63) & 0x1);
-        int dst_sign = ((*(uint64_t *)(dst_od->value) >> 63) & 0x1);
+void jmp_i_handler(od_t *src_od, od_t *dst_od)
+{
+    cpu_pc.rip = src_od->imm;
+    clear_flags();
+}
 
-        // set condition flags
-        cpu_flags.CF = (val > *(uint64_t *)(dst_od->value)); // unsigned
+void jmp_m_handler(od_t *src_od, od_t *dst_od)
+{
+    cpu_pc.rip = effective_address(src_od);
+    clear_flags();
+}
 
-        cpu_flags.ZF = (val == 0);
-        cpu_flags.SF = val_sign;
+/*--------------------------------------*/
+/*      arithmetic                      */
+/*--------------------------------------*/
 
-        cpu_flags.OF = (src_sign == 1 && dst_sign == 0 && val_sign == 1) || (src_sign == 0 && dst_sign == 1 && val_sign == 0);
+void add_r_r_handler(od_t *src_od, od_t *dst_od)
+{
+    uint64_t *dst = register_of(dst_od);
+    *dst = add_and_set_flags(*register_of(src_od), *dst);
+    increase_pc();
+}
 
-        // update registers
-        *(uint64_t *)(dst_od->value) = val;
-        // signed and unsigned value follow the same addition. e.g.
-        // 5 = 0000000000000101, 3 = 0000000000000011, -3 = 1111111111111101, 5 + (-3) = 0000000000000010
-        increase_pc();
-        return;
-    }
+void add_i_r_handler(od_t *src_od, od_t *dst_od)
+{
+    uint64_t *dst = register_of(dst_od);
+    *dst = add_and_set_flags(src_od->imm, *dst);
+    increase_pc();
 }
 
-void cmp_handler(od_t *src_od, od_t *dst_od)
+void add_m_r_handler(od_t *src_od, od_t *dst_od)
 {
-    if (src_od->type == OD_IMM && dst_od->type == OD_MEM)
-    {
-        // src: register (value: int64_t bit map)
-        // dst: register (value: int64_t bit map)
-        // (dst_od->value) = (dst_od->value) - (src_od->value) = (dst_od->value) + (-(src_od->value))
-        uint64_t dst_pa = va2pa(dst_od->value);
-        uint64_t dval = cpu_read64bits_dram(dst_pa);
-        uint64_t val = dval + (~(src_od->value) + 1);
+    uint64_t *dst = register_of(dst_od);
+    *dst = add_and_set_flags(read_memory(src_od), *dst);
+    increase_pc();
+}
+
+void add_r_m_handler(od_t *src_od, od_t *dst_od)
+{
+    uint64_t dst_va = effective_address(dst_od);
+    uint64_t val = add_and_set_flags(*register_of(src_od), load64(dst_va));
+    store64(dst_va, val);
+    increase_pc();
+}
 
-        int val_sign = ((val >> 63) & 0x1);
-        int src_sign = (((src_od->value) >> 63) & 0x1);
-        int dst_sign = ((dval >> 63) & 0x1);
+void add_i_m_handler(od_t *src_od, od_t *dst_od)
+{
+    uint64_t dst_va = effective_address(dst_od);
+    uint64_t val = add_and_set_flags(src_od->imm, load64(dst_va));
+    store64(dst_va, val);
+    increase_pc();
+}
 
-        // set condition flags
-        cpu_flags.CF = (val > dval); // unsigned
+void sub_r_r_handler(od_t *src_od, od_t *dst_od)
+{
+    uint64_t *dst = register_of(dst_od);
+    *dst = sub_and_set_flags(*register_of(src_od), *dst);
+    increase_pc();
+}
 
-        cpu_flags.ZF = (val == 0);
-        cpu_flags.SF = val_sign;
+void sub_i_r_handler(od_t *src_od, od_t *dst_od)
+{
+    uint64_t *dst = register_of(dst_od);
+    *dst = sub_and_set_flags(src_od->imm, *dst);
+    increase_pc();
+}
 
-        cpu_flags.OF = (src_sign == 1 && dst_sign == 0 && val_sign == 1) || (src_sign == 0 && dst_sign == 1 && val_sign == 0);
+void sub_m_r_handler(od_t *src_od, od_t *dst_od)
+{
+    uint64_t *dst = register_of(dst_od);
+    *dst = sub_and_set_flags(read_memory(src_od), *dst);
+    increase_pc();
+}
 
-        // signed and unsigned value follow the same addition. e.g.
-        // 5 = 0000000000000101, 3 = 0000000000000011, -3 = 1111111111111101, 5 + (-3) = 0000000000000010
-        increase_pc();
-        return;
+void sub_r_m_handler(od_t *src_od, od_t *dst_od)
+{
+    uint64_t dst_va = effective_address(dst_od);
+    uint64_t val = sub_and_set_flags(*register_of(src_od), load64(dst_va));
+    store64(dst_va, val);
+    increase_pc();
+}
+
+void sub_i_m_handler(od_t *src_od, od_t *dst_od)
+{
+    uint64_t dst_va = effective_address(dst_od);
+    uint64_t val = sub_and_set_flags(src_od->imm, load64(dst_va));
+    store64(dst_va, val);
+    increase_pc();
+}
+
+// cmp: compute dst - src for the flags only
+void cmp_r_r_handler(od_t *src_od, od_t *dst_od)
+{
+    sub_and_set_flags(*register_of(src_od), *register_of(dst_od));
+    increase_pc();
+}
+
+void cmp_i_r_handler(od_t *src_od, od_t *dst_od)
+{
+    sub_and_set_flags(src_od->imm, *register_of(dst_od));
+    increase_pc();
+}
+
+void cmp_m_r_handler(od_t *src_od, od_t *dst_od)
+{
+    sub_and_set_flags(read_memory(src_od), *register_of(dst_od));
+    increase_pc();
+}
+
+void cmp_r_m_handler(od_t *src_od, od_t *dst_od)
+{
+    sub_and_set_flags(*register_of(src_od), read_memory(dst_od));
+    increase_pc();
+}
+
+void cmp_i_m_handler(od_t *src_od, od_t *dst_od)
+{
+    sub_and_set_flags(src_od->imm, read_memory(dst_od));
+    increase_pc();
+}
+
+void lea_m_r_handler(od_t *src_od, od_t *dst_od)
+{
+    // src: virtual address - The effective address computed from instruction
+    // dst: register - The register to load the effective address
+    *register_of(dst_od) = effective_address(src_od);
+    increase_pc();
+    clear_flags();
+}
+
+/*--------------------------------------*/
+/*      others                          */
+/*--------------------------------------*/
+
+void int_i_handler(od_t *src_od, od_t *dst_od)
+{
+    // src: interrupt vector
+
+    // Be careful here. Think why we need to increase RIP before interrupt?
+    // This `int` instruction is executed by process 1,
+    // but interrupt will cause OS's scheduling to process 2.
+    // So this `int_handler` will not return.
+    // When the execution of process 1 resumed, the system call is finished.
+    // We want to execute the next instruction, so RIP pushed to trap frame
+    // must be the next instruction.
+    increase_pc();
+    clear_flags();
+
+    // `int` is retired before the interrupt, since we never come back
+    instruction_retired += 1;
+
+    // This function will not return.
+    interrupt_stack_switching(src_od->imm);
+}
+
+void nop_handler(od_t *src_od, od_t *dst_od)
+{
+    increase_pc();
+}
+
+// the operator and operand forms not supported by the CPU
+void illegal_handler(od_t *src_od, od_t *dst_od)
+{
+    printf("\033[31;1mIllegal instruction at %lx\033[0m\n", cpu_pc.rip);
+    // no #UD handler in the IDT: fail the emulator
+    exit(1);
+}
+
+/*--------------------------------------*/
+/*      superinstructions               */
+/*--------------------------------------*/
+
+// The fused pairs are found by the peephole pass of translate.c.
+// `inst` is the first instruction of the pair, `inst + 1` is the second.
+// Each pair does the address translation once for the page it touches,
+// and updates RIP once. The memory access comes first, so a page fault
+// leaves nothing changed, the same as the first instruction faults.
+
+// the number of times each kind of fused pair is executed
+uint64_t fusion_hit[NUM_FUSION];
+
+// the target of jne: immediate number or effective address
+static inline uint64_t jump_target(od_t *od)
+{
+    if (od->type == OD_IMM)
+    {
+        return od->imm;
     }
+    return effective_address(od);
 }
 
-void jne_handler(od_t *src_od, od_t *dst_od)
+// push %rbp; mov %rsp,%rbp
+int push_mov_fused(inst_t *inst)
 {
-    // src_od is actually a instruction memory address
-    // but we are interpreting it as an immediate number
-    if (cpu_flags.ZF == 0)
+    store64(cpu_reg.rsp - 8, *register_of(&(inst[0].src)));
+    cpu_reg.rsp = cpu_reg.rsp - 8;
+    *register_of(&(inst[1].dst)) = *register_of(&(inst[1].src));
+    cpu_pc.rip = cpu_pc.rip + 2 * INSTRUCTION_SIZE;
+    clear_flags();
+    return 1;
+}
+
+// cmpq $imm,mem; jne target
+// the flags of cmp are consumed by jne at once, so they are never recorded
+int cmp_jne_fused(inst_t *inst)
+{
+    uint64_t val = read_memory(&(inst[0].dst)) - inst[0].src.imm;
+    if (val != 0)
     {
-        // last instruction value != 0
-        cpu_pc.rip = (src_od->value);
+        cpu_pc.rip = jump_target(&(inst[1].src));
     }
     else
     {
-        // last instruction value == 0
-        increase_pc();
+        cpu_pc.rip = cpu_pc.rip + 2 * INSTRUCTION_SIZE;
     }
-    cpu_flags.__flags_value = 0;
+    clear_flags();
+    return 1;
 }
 
-void jmp_handler(od_t *src_od, od_t *dst_od)
+// leaveq; retq
+// the saved rbp and the return address are both read by one translation,
+// it is not fused when they are in different pages
+int leave_ret_fused(inst_t *inst)
 {
-    cpu_pc.rip = (src_od->value);
-    cpu_flags.__flags_value = 0;
+    uint64_t rbp = cpu_reg.rbp;
+    if ((rbp / PAGE_SIZE) != ((rbp + 8) / PAGE_SIZE))
+    {
+        return 0;
+    }
+
+    uint64_t rbp_pa = va2pa(rbp);
+    uint64_t old_rbp = cpu_read64bits_dram(rbp_pa);
+    uint64_t ret_addr = cpu_read64bits_dram(rbp_pa + 8);
+    cpu_reg.rsp = rbp + 16;
+    cpu_reg.rbp = old_rbp;
+    cpu_pc.rip = ret_addr;
+    clear_flags();
+    return 1;
+}
+
+// mov mem,%rax; add %rdx,%rax
+int mov_add_fused(inst_t *inst)
+{
+    *register_of(&(inst[0].dst)) = read_memory(&(inst[0].src));
+    uint64_t *dst = register_of(&(inst[1].dst));
+    *dst = add_and_set_flags(*register_of(&(inst[1].src)), *dst);
+    cpu_pc.rip = cpu_pc.rip + 2 * INSTRUCTION_SIZE;
+    return 1;
 }
 
-void lea_handler(od_t *src_od, od_t *dst_od)
+// from translate.c
+block_t *translate_block(uint64_t vaddr);
+block_t *block_successor(block_t *b, uint64_t vaddr);
+
+// the last executed block, chaining to the next block
+#define last_block (active_core->last_block)
+// changed when any block of the core is removed
+#define block_epoch (active_core->block_epoch)
+
+#ifdef USE_PROFILE
+// The cost since the last count is charged to what just finished:
+// the dispatch when a block starts, the handler when it retires.
+
+static inline uint64_t profile_slot(block_t *b)
+{
+    return (b->paddr / INSTRUCTION_SIZE) % PROFILE_NUM_SLOT;
+}
+
+static inline void profile_block(block_t *b)
 {
-    if (src_od->type == OD_MEM && dst_od->type == OD_REG)
+    uint64_t now = profile_clock();
+    profile_kind_count[PROFILE_DISPATCH] += 1;
+    profile_kind_cycles[PROFILE_DISPATCH] += now - profile_clock_last;
+    profile_clock_last = now;
+
+    uint64_t s = profile_slot(b);
+    profile_block_count[s] += 1;
+    profile_block_rip[s] = cpu_pc.rip;
+}
+
+// the instructions [i, i + k) of the block retired by the kind of handler
+static inline void profile_retire(block_t *b, uint64_t i, uint64_t k, int kind)
+{
+    uint64_t now = profile_clock();
+    uint64_t s = profile_slot(b);
+    profile_kind_count[kind] += k;
+    profile_kind_cycles[kind] += now - profile_clock_last;
+    profile_block_cycles[s] += now - profile_clock_last;
+    profile_clock_last = now;
+
+    for (uint64_t j = i; j < i + k; ++ j)
     {
-        // src: virtual address - The effective address computed from instruction
-        // dst: register - The register to load the effective address
-        *(uint64_t *)(dst_od->value) = src_od->value;
-        increase_pc();
-        cpu_flags.__flags_value = 0;
-        return;
+        uint64_t t = (s + j) % PROFILE_NUM_SLOT;
+        profile_inst_count[t] += 1;
+        profile_inst_rip[t] = profile_block_rip[s] + j * INSTRUCTION_SIZE;
     }
 }
 
-void int_handler(od_t *src_od, od_t *dst_od)
+// the cost of interrupt is counted after its longjmp
+static inline void profile_interrupt()
 {
-    if (src_od->type == OD_IMM)
+    int kind = PROFILE_PAGEFAULT;
+    if (profile_interrupt_vector == 0x80)
     {
-        // src: interrupt vector
-
-        // Be careful here. Think why we need to increase RIP before interrupt?
-        // This `int` instruction is executed by process 1,
-        // but interrupt will cause OS's scheduling to process 2.
-        // So this `int_handler` will not return.
-        // When the execution of process 1 resumed, the system call is finished.
-        // We want to execute the next instruction, so RIP pushed to trap frame
-        // must be the next instruction.
-        increase_pc();
-        cpu_flags.__flags_value = 0;
-
-        // This function will not return.
-        interrupt_stack_switching(src_od->value);
+        kind = PROFILE_SYSCALL;
+    }
+    else if (profile_interrupt_vector == 0x81)
+    {
+        kind = PROFILE_TIMER;
     }
+
+    uint64_t now = profile_clock();
+    profile_kind_count[kind] += 1;
+    profile_kind_cycles[kind] += now - profile_clock_last;
+    profile_clock_last = now;
 }
 
-void nop_handler(od_t *src_od, od_t *dst_od)
+#define PROFILE_BLOCK(b)                profile_block(b)
+#define PROFILE_RETIRE(b, i, k, kind)   profile_retire(b, i, k, kind)
+#else
+#define PROFILE_BLOCK(b)
+#define PROFILE_RETIRE(b, i, k, kind)
+#endif
+
+#ifdef USE_JIT
+// from jit.c
+void *jit_block_code(block_t *b);
+
+// the host code is running, it may be left by the longjmp of page fault
+#define jit_running (active_core->jit_running)
+
+// run the host code of hot block, return the number of retired instructions
+// The host code runs only when the whole block is in this run and before
+// the next event. It may stop early, then the rest of the block is interpreted.
+static uint64_t run_block_jit(block_t *b, uint64_t n)
 {
-    increase_pc();
+    if (n < b->num_inst)
+    {
+        return 0;
+    }
+
+    uint64_t (*code)() = jit_block_code(b);
+    if (code == NULL)
+    {
+        return 0;
+    }
+
+    jit_running = 1;
+    uint64_t k = code();
+    jit_running = 0;
+    PROFILE_RETIRE(b, 0, k, PROFILE_JIT);
+
+    global_time += k;
+    instruction_retired += k;
+    return k;
 }
+#endif
 
-// from inst.c
-void parse_instruction(char *inst_str, inst_t *inst);
+#ifdef USE_THREADED_DISPATCH
+// Direct-threaded dispatch by GCC labels as values.
+// Each instruction in the block carries the label of its handler body,
+// and each body jumps to the next body directly. The handlers are called
+// directly here, not by the function pointer, so they can be inlined.
+// It runs the instructions [start, n) of the block, the same as the loop
+// in `cpu_run`, and ends early when the block epoch is not `epoch`.
+static void run_block_threaded(block_t *b, uint64_t start, uint64_t n, uint64_t epoch)
+{
+    static struct
+    {
+        op_t handler;
+        void *label;
+    } label_table[] = 
+    {
+        {&mov_r_r_handler,      &&L_mov_r_r   },
+        {&mov_r_m_handler,      &&L_mov_r_m   },
+        {&mov_m_r_handler,      &&L_mov_m_r   },
+        {&mov_i_r_handler,      &&L_mov_i_r   },
+        {&mov_i_m_handler,      &&L_mov_i_m   },
+        {&push_r_handler,       &&L_push_r    },
+        {&push_i_handler,       &&L_push_i    },
+        {&pop_r_handler,        &&L_pop_r     },
+        {&leave_handler,        &&L_leave     },
+        {&call_i_handler,       &&L_call_i    },
+        {&call_m_handler,       &&L_call_m    },
+        {&ret_handler,          &&L_ret       },
+        {&jne_i_handler,        &&L_jne_i     },
+        {&jne_m_handler,        &&L_jne_m     },
+        {&jmp_i_handler,        &&L_jmp_i     },
+        {&jmp_m_handler,        &&L_jmp_m     },
+        {&add_r_r_handler,      &&L_add_r_r   },
+        {&add_i_r_handler,      &&L_add_i_r   },
+        {&add_m_r_handler,      &&L_add_m_r   },
+        {&add_r_m_handler,      &&L_add_r_m   },
+        {&add_i_m_handler,      &&L_add_i_m   },
+        {&sub_r_r_handler,      &&L_sub_r_r   },
+        {&sub_i_r_handler,      &&L_sub_i_r   },
+        {&sub_m_r_handler,      &&L_sub_m_r   },
+        {&sub_r_m_handler,      &&L_sub_r_m   },
+        {&sub_i_m_handler,      &&L_sub_i_m   },
+        {&cmp_r_r_handler,      &&L_cmp_r_r   },
+        {&cmp_i_r_handler,      &&L_cmp_i_r   },
+        {&cmp_m_r_handler,      &&L_cmp_m_r   },
+        {&cmp_r_m_handler,      &&L_cmp_r_m   },
+        {&cmp_i_m_handler,      &&L_cmp_i_m   },
+        {&lea_m_r_handler,      &&L_lea_m_r   },
+        {&int_i_handler,        &&L_int_i     },
+        {&nop_handler,          &&L_nop       },
+        {&illegal_handler,      &&L_illegal   },
+    };
+
+    if (b->inst[0].label == NULL)
+    {
+        // the first execution of the block: resolve the labels
+        for (int j = 0; j < b->num_inst; ++ j)
+        {
+            inst_t *t = &(b->inst[j]);
+            if (t->fused != NULL)
+            {
+                t->label = &&L_fused;
+                continue;
+            }
+            t->label = &&L_indirect;
+            for (int k = 0; k < sizeof(label_table) / sizeof(label_table[0]); ++ k)
+            {
+                if (t->op == label_table[k].handler)
+                {
+                    t->label = label_table[k].label;
+                    break;
+                }
+            }
+        }
+    }
 
-// time, the craft of god
-static uint64_t global_time = 0;
-static uint64_t timer_period = 5;
+    if (start >= n || block_epoch != epoch)
+    {
+        return;
+    }
 
-// instruction cycle is implemented in CPU
-// the only exposed interface outside CPU
-void instruction_cycle()
+    uint64_t i = start;
+    inst_t *inst = &(b->inst[i]);
+    global_time += 1;
+    goto *(inst->label);
+
+// retire the instruction, then jump to the body of next instruction
+#define NEXT()                                      \
+    PROFILE_RETIRE(b, i, 1, inst->opcode);          \
+    NEXT_COUNTED()
+
+#define NEXT_COUNTED()                              \
+    instruction_retired += 1;                       \
+    i += 1;                                         \
+    if (i >= n || block_epoch != epoch)             \
+    {                                               \
+        return;                                     \
+    }                                               \
+    global_time += 1;                               \
+    inst = &(b->inst[i]);                           \
+    goto *(inst->label)
+
+L_mov_r_r:
+    mov_r_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_mov_r_m:
+    mov_r_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_mov_m_r:
+    mov_m_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_mov_i_r:
+    mov_i_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_mov_i_m:
+    mov_i_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_push_r:
+    push_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_push_i:
+    push_i_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_pop_r:
+    pop_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_leave:
+    leave_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_call_i:
+    call_i_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_call_m:
+    call_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_ret:
+    ret_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_jne_i:
+    jne_i_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_jne_m:
+    jne_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_jmp_i:
+    jmp_i_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_jmp_m:
+    jmp_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_add_r_r:
+    add_r_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_add_i_r:
+    add_i_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_add_m_r:
+    add_m_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_add_r_m:
+    add_r_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_add_i_m:
+    add_i_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_sub_r_r:
+    sub_r_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_sub_i_r:
+    sub_i_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_sub_m_r:
+    sub_m_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_sub_r_m:
+    sub_r_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_sub_i_m:
+    sub_i_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_cmp_r_r:
+    cmp_r_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_cmp_i_r:
+    cmp_i_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_cmp_m_r:
+    cmp_m_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_cmp_r_m:
+    cmp_r_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_cmp_i_m:
+    cmp_i_m_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_lea_m_r:
+    lea_m_r_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_int_i:
+    int_i_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_nop:
+    nop_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_illegal:
+    illegal_handler(&(inst->src), &(inst->dst));
+    NEXT();
+L_indirect:
+    // handlers without a label
+    inst->op(&(inst->src), &(inst->dst));
+    NEXT();
+L_fused:
+    // the first of a fused pair, the same as the loop in `cpu_run`
+    if (i + 1 < n &&
+        inst->fused(inst) == 1)
+    {
+        fusion_hit[inst->fusion] += 1;
+        PROFILE_RETIRE(b, i, 2, PROFILE_FUSED);
+        global_time += 1;
+        instruction_retired += 1;
+        i += 1;
+        NEXT_COUNTED();
+    }
+    inst->op(&(inst->src), &(inst->dst));
+    NEXT();
+
+#undef NEXT
+#undef NEXT_COUNTED
+}
+#endif
+
+// CPU's run loop: execute at most `max_instructions` instructions
+// return the number of retired instructions
+uint64_t cpu_run(uint64_t max_instructions)
 {
+    instruction_retired = 0;
+#ifdef USE_PROFILE
+    profile_start();
+#endif
+
     // this is the entry point of the re-execution of
     // interrupt return instruction.
     // When a new process is scheduled, the first instruction/
     // return instruction should start here, jumping out of the
     // call stack of old process.
     // This is especially useful for page fault handling.
-    setjmp(USER_INSTRUCTION_ON_IRET);
-
-    global_time += 1;
-
-    // FETCH: get the instruction string by program counter
-    char inst_str[MAX_INSTRUCTION_CHAR + 10];
-    uint64_t pc_pa = va2pa(cpu_pc.rip);
-    cpu_readinst_dram(pc_pa, inst_str);
+    // The target is armed only once for the whole run: 
+    // an interrupt longjmps back here and the run goes on.
+    if (setjmp(USER_INSTRUCTION_ON_IRET) != 0)
+    {
+        // the block was broken by interrupt or page fault
+        // RIP may be in another address space now
+        last_block = NULL;
+#ifdef USE_JIT
+        if (jit_running == 1)
+        {
+            // page fault in host code: the faulting instruction is counted
+            // in time, but not retired, the same as the interpreter
+            global_time += active_core->jit_progress + 1;
+            instruction_retired += active_core->jit_progress;
+            jit_running = 0;
+        }
+#endif
+#ifdef USE_PROFILE
+        profile_interrupt();
+#endif
+    }
 
+    // a deferred interrupt ends the run, see interrupt.c
+    while (instruction_retired < max_instructions &&
+        active_core->interrupt_deferred == 0)
+    {
+        // the events due now, e.g. posted in the past
+        uint64_t deadline = event_deadline();
+        if (deadline <= global_time)
+        {
+            event_dispatch();
+            deadline = event_deadline();
+        }
+
+        // FETCH & DECODE: the chained successor of the last block
+        // the block is fetched, decoded and linked only once
+        block_t *b = NULL;
+        if (last_block == NULL)
+        {
+            b = translate_block(cpu_pc.rip);
+        }
+        else
+        {
+            b = block_successor(last_block, cpu_pc.rip);
+        }
+        last_block = b;
+        PROFILE_BLOCK(b);
+
+        uint64_t n = b->num_inst;
+        if (n > max_instructions - instruction_retired)
+        {
+            // the run ends inside the block
+            n = max_instructions - instruction_retired;
+            last_block = NULL;
+        }
+        if (n > deadline - global_time)
+        {
+            // straight-line execution until the next event
+            n = deadline - global_time;
+            last_block = NULL;
+        }
+
+        // EXECUTE: run the hot block by host code,
+        // and the rest of it in a tight loop
+        // a store into the code of the block removes it: the rest of
+        // `b->inst[]` is stale, so the block ends after the store
+        uint64_t epoch = block_epoch;
+        uint64_t start = 0;
+#ifdef USE_JIT
+        start = run_block_jit(b, n);
+#endif
+#ifdef USE_THREADED_DISPATCH
+        run_block_threaded(b, start, n, epoch);
+#else
+        for (uint64_t i = start; i < n && block_epoch == epoch; ++ i)
+        {
+            global_time += 1;
+
+            inst_t *inst = &(b->inst[i]);
 #ifdef DEBUG_INSTRUCTION_CYCLE
-    printf("%8lx    %s\n", cpu_pc.rip, inst_str);
+            printf("%8lx    opcode %d\n", cpu_pc.rip, inst->opcode);
+#endif
+            // the fused pair runs only when both instructions are in this run
+            // and no event is between them
+            if (inst->fused != NULL &&
+                i + 1 < n &&
+                inst->fused(inst) == 1)
+            {
+                fusion_hit[inst->fusion] += 1;
+                global_time += 1;
+                instruction_retired += 2;
+                PROFILE_RETIRE(b, i, 2, PROFILE_FUSED);
+                i += 1;
+            }
+            else
+            {
+                inst->op(&(inst->src), &(inst->dst));
+                instruction_retired += 1;
+                PROFILE_RETIRE(b, i, 1, inst->opcode);
+            }
+        }
 #endif
+        if (block_epoch != epoch)
+        {
+            // fetch and decode again from the next instruction
+            last_block = NULL;
+        }
+
+        // e.g. timer interrupt from APIC, may not return
+        if (global_time >= deadline)
+        {
+            event_dispatch();
+        }
+    }
 
-    // DECODE: decode the run-time instruction operands
-    inst_t inst;
-    parse_instruction(inst_str, &inst);
+    // the architectural flags are visible after the run
+    cpu_flags_materialize();
+    return instruction_retired;
+}
 
-    // EXECUTE: get the function pointer or handler by the operator
-    // update CPU and memory according the instruction
-    inst.op(&(inst.src), &(inst.dst));
-    
-    // check timer interrupt from APIC
-    if ((global_time % timer_period) == 0)
+// print the number of times each fused pair is executed
+void print_fusion_hit()
+{
+    const char *fusion_name[NUM_FUSION] = 
+    {
+        "none",
+        "push; mov",
+        "cmp; jne",
+        "leave; ret",
+        "mov; add",
+    };
+
+    for (int i = 1; i < NUM_FUSION; ++ i)
     {
-        interrupt_stack_switching(0x81);
+        printf("%-12s %lu\n", fusion_name[i], fusion_hit[i]);
     }
 }
 
+// instruction cycle is implemented in CPU
+// execute one instruction
+void instruction_cycle()
+{
+    cpu_run(1);
+}
+
 
 
 
@@ -0,0 +1,846 @@
+/* BCST - Introduction to Computer Systems
+ * Author:      yangminz@outlook.com
+ * Github:      https://github.com/yangminz/bcst_csapp
+ * Bilibili:    https://space.bilibili.com/4564101
+ * Zhihu:       https://www.zhihu.com/people/zhao-yang-min
+ * This project (code repository and videos) is exclusively owned by yangminz
+ * and shall not be used for commercial and profitting purpose
+ * without yangminz's permission.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include "header/cpu.h"
+#include "header/memory.h"
+#include "header/common.h"
+#include "header/instruction.h"
+#include "header/address.h"
+#include "header/machine.h"
+
+/*======================================*/
+/*      just-in-time compilation        */
+/*======================================*/
+
+// A hot block is compiled to host x86-64 machine code.
+// The host code works on `cpu_reg`, `cpu_flags` and `cpu_pc` in place,
+// so the interpreter can go on from any instruction the host code stops at.
+//
+// The host code is called as `uint64_t code()`, and returns the number of
+// instructions it has executed. It stops before the instruction it cannot
+// compile (e.g. `int`), and the run loop interprets the rest of the block.
+//
+// Memory operands are translated by the JIT TLB inline. When it misses,
+// `jit_translate` is called, which calls `va2pa`. If `va2pa` raises page
+// fault, the host code is left by the longjmp of interrupt, `jit_progress`
+// tells the run loop how many instructions are retired before the fault.
+//
+// Register usage of the host code:
+//      rbx - &cpu_flags
+//      r12 - physical address or pushed value kept across the calls
+//      r13 - &cpu_pc, RIP is the first instruction of block inside the code
+//      r11 - address of the global variables and functions
+
+// from inst.c
+extern uint64_t zero_register;
+
+// the number of instructions retired by the running host code
+// written by the host code before it calls `va2pa`:
+// `active_core->jit_progress`
+
+#define JIT_BUFFER_SIZE (1 << 20)
+#define JIT_MAX_BLOCK_CODE (8192)
+
+// the page translations used by the host code
+// tagged by the virtual page number and the address space
+#define JIT_TLB_SIZE (256)
+
+typedef struct
+{
+    uint64_t vpn;
+    uint64_t cr3;
+    uint64_t ppage;     // physical address of the page
+    uint64_t unused;    // 32 bytes to be indexed by shift
+} jit_tlb_entry_t;
+
+// The host code has the addresses of the registers and of the JIT TLB,
+// so each core has its own code buffer.
+struct JIT_STATE
+{
+    // the block is compiled when it is executed for this number of times
+    uint64_t threshold;
+
+    // host code of all blocks, flushed when used up
+    uint8_t *buffer;
+    uint64_t top;
+
+    // increased when the buffer is flushed
+    // the code of a block is valid only in the same epoch
+    uint64_t epoch;
+
+    jit_tlb_entry_t tlb[JIT_TLB_SIZE];
+};
+
+static void flush_tlb(struct JIT_STATE *s)
+{
+    for (int i = 0; i < JIT_TLB_SIZE; ++ i)
+    {
+        // no virtual page number is all ones
+        s->tlb[i].vpn = 0xffffffffffffffff;
+    }
+}
+
+static inline struct JIT_STATE *jit_state()
+{
+    if (active_core->jit == NULL)
+    {
+        active_core->jit = machine_calloc(sizeof(struct JIT_STATE));
+        active_core->jit->threshold = 16;
+        flush_tlb(active_core->jit);
+    }
+    return active_core->jit;
+}
+#define jit_threshold   (jit_state()->threshold)
+#define jit_buffer      (jit_state()->buffer)
+#define jit_top         (jit_state()->top)
+#define jit_tlb         (jit_state()->tlb)
+
+// called by `machine_free`
+void jit_free(core_t *c)
+{
+    if (c->jit == NULL)
+    {
+        return;
+    }
+    if (c->jit->buffer != NULL)
+    {
+        munmap(c->jit->buffer, JIT_BUFFER_SIZE);
+    }
+    // the state is in the arena of the machine
+    c->jit = NULL;
+}
+
+void jit_set_threshold(uint64_t count)
+{
+    jit_threshold = count;
+}
+
+// remove all cached translations of all cores
+// called when a page table entry is unmapped
+void jit_tlb_flush()
+{
+    for (int i = 0; i < machine->num_cores; ++ i)
+    {
+        if (machine->cores[i].jit != NULL)
+        {
+            flush_tlb(machine->cores[i].jit);
+        }
+    }
+}
+
+// the slow path of the host code
+uint64_t jit_translate(uint64_t vaddr)
+{
+    uint64_t paddr = va2pa(vaddr);
+
+    jit_tlb_entry_t *e = &jit_tlb[(vaddr >> PHYSICAL_PAGE_OFFSET_LENGTH) % JIT_TLB_SIZE];
+    e->vpn = vaddr >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    e->cr3 = cpu_controls.cr3;
+    e->ppage = (paddr >> PHYSICAL_PAGE_OFFSET_LENGTH) << PHYSICAL_PAGE_OFFSET_LENGTH;
+    return paddr;
+}
+
+#if defined(__x86_64__)
+
+/*--------------------------------------*/
+/*      x86-64 encoding                 */
+/*--------------------------------------*/
+
+#define HOST_RAX (0)
+#define HOST_RCX (1)
+#define HOST_RDX (2)
+#define HOST_RBX (3)
+#define HOST_RSI (6)
+#define HOST_RDI (7)
+#define HOST_R11 (11)
+#define HOST_R12 (12)
+#define HOST_R13 (13)
+
+#define HOST_CC_E (0x4)
+#define HOST_CC_NE (0x5)
+
+// the next byte to be emitted
+static __thread uint8_t *emit_ptr = NULL;
+
+static void emit8(uint8_t b)
+{
+    *emit_ptr = b;
+    emit_ptr += 1;
+}
+
+static void emit32(uint32_t v)
+{
+    for (int i = 0; i < 4; ++ i)
+    {
+        emit8((v >> (i * 8)) & 0xff);
+    }
+}
+
+static void emit64(uint64_t v)
+{
+    for (int i = 0; i < 8; ++ i)
+    {
+        emit8((v >> (i * 8)) & 0xff);
+    }
+}
+
+static void emit_rex(int w, int reg, int rm)
+{
+    uint8_t rex = 0x40 | (w << 3) | (((reg >> 3) & 0x1) << 2) | ((rm >> 3) & 0x1);
+    if (rex != 0x40)
+    {
+        emit8(rex);
+    }
+}
+
+// opcode reg, [base + disp32]
+static void emit_mem(int w, uint8_t opcode, int reg, int base, int32_t disp)
+{
+    // rsp and r12 as base need SIB byte
+    assert((base & 0x7) != 4);
+    emit_rex(w, reg, base);
+    emit8(opcode);
+    emit8(0x80 | ((reg & 0x7) << 3) | (base & 0x7));
+    emit32((uint32_t)disp);
+}
+
+// opcode rm, reg
+static void emit_reg(int w, uint8_t opcode, int reg, int rm)
+{
+    emit_rex(w, reg, rm);
+    emit8(opcode);
+    emit8(0xc0 | ((reg & 0x7) << 3) | (rm & 0x7));
+}
+
+// movabs reg, imm64
+static void emit_mov_imm64(int reg, uint64_t imm)
+{
+    emit_rex(1, 0, reg);
+    emit8(0xb8 + (reg & 0x7));
+    emit64(imm);
+}
+
+// mov reg, [addr]
+static void emit_load_abs(int reg, uint64_t addr)
+{
+    emit_mov_imm64(HOST_R11, addr);
+    emit_mem(1, 0x8b, reg, HOST_R11, 0);
+}
+
+// mov [addr], reg
+static void emit_store_abs(uint64_t addr, int reg)
+{
+    emit_mov_imm64(HOST_R11, addr);
+    emit_mem(1, 0x89, reg, HOST_R11, 0);
+}
+
+// call the C function
+static void emit_call(void *func)
+{
+    emit_mov_imm64(HOST_R11, (uint64_t)func);
+    // call r11
+    emit_reg(0, 0xff, 2, HOST_R11);
+}
+
+// jcc rel32 or jmp rel32, return the position of rel32 to be patched
+static uint8_t *emit_jump(int cc)
+{
+    if (cc < 0)
+    {
+        emit8(0xe9);
+    }
+    else
+    {
+        emit8(0x0f);
+        emit8(0x80 | cc);
+    }
+    uint8_t *rel = emit_ptr;
+    emit32(0);
+    return rel;
+}
+
+// let the jump go to the current position
+static void patch_jump(uint8_t *rel)
+{
+    int32_t offset = (int32_t)(emit_ptr - (rel + 4));
+    memcpy(rel, &offset, sizeof(offset));
+}
+
+// add qword [r13], imm32: move RIP forward
+static void emit_add_rip(uint64_t offset)
+{
+    emit_mem(1, 0x81, 0, HOST_R13, 0);
+    emit32((uint32_t)offset);
+}
+
+static void emit_sub_rip(uint64_t offset)
+{
+    emit_mem(1, 0x81, 5, HOST_R13, 0);
+    emit32((uint32_t)offset);
+}
+
+/*--------------------------------------*/
+/*      semantics                       */
+/*--------------------------------------*/
+
+// rdi = effective address of the memory operand
+static void emit_effective_address(od_t *od)
+{
+    emit_mov_imm64(HOST_RDI, od->imm);
+    if (od->reg1 != (uint64_t)&zero_register)
+    {
+        // add rdi, [reg1]
+        emit_mov_imm64(HOST_R11, od->reg1);
+        emit_mem(1, 0x03, HOST_RDI, HOST_R11, 0);
+    }
+    if (od->reg2 != (uint64_t)&zero_register)
+    {
+        emit_load_abs(HOST_RCX, od->reg2);
+        for (uint64_t s = od->scal; s > 1; s = s >> 1)
+        {
+            // add rcx, rcx
+            emit_reg(1, 0x01, HOST_RCX, HOST_RCX);
+        }
+        // add rdi, rcx
+        emit_reg(1, 0x01, HOST_RCX, HOST_RDI);
+    }
+}
+
+// rax = physical address of rdi
+// `index` is the instruction in block, for RIP and progress of page fault
+static void emit_translate(int index)
+{
+    // rcx = vpn, rax = &jit_tlb[vpn % JIT_TLB_SIZE]
+    emit_reg(1, 0x89, HOST_RDI, HOST_RCX);
+    emit_reg(1, 0xc1, 5, HOST_RCX);
+    emit8(PHYSICAL_PAGE_OFFSET_LENGTH);
+    emit_reg(1, 0x89, HOST_RCX, HOST_RDX);
+    emit_reg(1, 0x81, 4, HOST_RDX);
+    emit32(JIT_TLB_SIZE - 1);
+    emit_reg(1, 0xc1, 4, HOST_RDX);
+    emit8(5);
+    emit_mov_imm64(HOST_RAX, (uint64_t)&jit_tlb[0]);
+    emit_reg(1, 0x01, HOST_RDX, HOST_RAX);
+
+    // fast path: hit in the same address space
+    emit_mem(1, 0x3b, HOST_RCX, HOST_RAX, offsetof(jit_tlb_entry_t, vpn));
+    uint8_t *miss_vpn = emit_jump(HOST_CC_NE);
+    emit_load_abs(HOST_RDX, (uint64_t)&cpu_controls.cr3);
+    emit_mem(1, 0x3b, HOST_RDX, HOST_RAX, offsetof(jit_tlb_entry_t, cr3));
+    uint8_t *miss_cr3 = emit_jump(HOST_CC_NE);
+    emit_mem(1, 0x8b, HOST_RAX, HOST_RAX, offsetof(jit_tlb_entry_t, ppage));
+    emit_reg(1, 0x81, 4, HOST_RDI);
+    emit32(PAGE_SIZE - 1);
+    emit_reg(1, 0x01, HOST_RDI, HOST_RAX);
+    uint8_t *done = emit_jump(-1);
+
+    // slow path: RIP and progress are exact in case of page fault
+    patch_jump(miss_vpn);
+    patch_jump(miss_cr3);
+    emit_add_rip(index * INSTRUCTION_SIZE);
+    emit_mov_imm64(HOST_R11, (uint64_t)&(active_core->jit_progress));
+    emit_mem(1, 0xc7, 0, HOST_R11, 0);
+    emit32(index);
+    emit_call(&jit_translate);
+    emit_sub_rip(index * INSTRUCTION_SIZE);
+
+    patch_jump(done);
+}
+
+// rax = the 8 bytes at physical address rax
+static void emit_read_dram()
+{
+#if defined(USE_SRAM_CACHE) || defined(USE_PARALLEL)
+    // parallel run: the buffered stores of the core are read
+    emit_reg(1, 0x89, HOST_RAX, HOST_RDI);
+    emit_call(&cpu_read64bits_dram);
+#else
+    // the same as `cpu_read64bits_dram` reading DRAM directly
+    emit_mov_imm64(HOST_R11, (uint64_t)&pm[0]);
+    emit_reg(1, 0x01, HOST_R11, HOST_RAX);
+    emit_mem(1, 0x8b, HOST_RAX, HOST_RAX, 0);
+#endif
+}
+
+// write rsi to physical address rdi
+// always by `cpu_write64bits_dram`, so writing code page invalidates blocks
+static void emit_write_dram()
+{
+    emit_call(&cpu_write64bits_dram);
+}
+
+// rax = memory operand
+static void emit_read_memory(od_t *od, int index)
+{
+    emit_effective_address(od);
+    emit_translate(index);
+    emit_read_dram();
+}
+
+// the same as `clear_flags` of isa.c
+static void emit_clear_flags()
+{
+    emit_mem(1, 0xc7, 0, HOST_RBX, offsetof(cpu_flags_t, __flags_value));
+    emit32(0);
+    emit_mem(0, 0xc7, 0, HOST_RBX, offsetof(cpu_flags_t, lazy_op));
+    emit32(FLAGS_OP_NONE);
+}
+
+// rax = rdx + rsi or rdx - rsi, recorded for the lazy flags
+static void emit_arithmetic(flags_op_t op)
+{
+    emit_reg(1, 0x89, HOST_RDX, HOST_RAX);
+    emit_reg(1, op == FLAGS_OP_ADD ? 0x01 : 0x29, HOST_RSI, HOST_RAX);
+
+    emit_mem(0, 0xc7, 0, HOST_RBX, offsetof(cpu_flags_t, lazy_op));
+    emit32(op);
+    emit_mem(1, 0x89, HOST_RSI, HOST_RBX, offsetof(cpu_flags_t, lazy_src));
+    emit_mem(1, 0x89, HOST_RDX, HOST_RBX, offsetof(cpu_flags_t, lazy_dst));
+    emit_mem(1, 0x89, HOST_RAX, HOST_RBX, offsetof(cpu_flags_t, lazy_val));
+}
+
+// push r12: rsp = rsp - 8, then r12 is written to [rsp]
+// the value is loaded before rsp is changed, so `push %rsp` pushes the old rsp
+static void emit_push_stack(int index)
+{
+    emit_load_abs(HOST_RDI, (uint64_t)&cpu_reg.rsp);
+    emit_reg(1, 0x83, 5, HOST_RDI);
+    emit8(8);
+    emit_translate(index);
+    emit_reg(1, 0x89, HOST_RAX, HOST_RDI);
+    emit_load_abs(HOST_RAX, (uint64_t)&cpu_reg.rsp);
+    emit_reg(1, 0x83, 5, HOST_RAX);
+    emit8(8);
+    emit_store_abs((uint64_t)&cpu_reg.rsp, HOST_RAX);
+    emit_reg(1, 0x89, HOST_R12, HOST_RSI);
+    emit_write_dram();
+}
+
+// r12 = [rsp], then rsp = rsp + 8
+static void emit_pop_stack(int index)
+{
+    emit_load_abs(HOST_RDI, (uint64_t)&cpu_reg.rsp);
+    emit_translate(index);
+    emit_read_dram();
+    emit_reg(1, 0x89, HOST_RAX, HOST_R12);
+    emit_load_abs(HOST_RAX, (uint64_t)&cpu_reg.rsp);
+    emit_reg(1, 0x83, 0, HOST_RAX);
+    emit8(8);
+    emit_store_abs((uint64_t)&cpu_reg.rsp, HOST_RAX);
+}
+
+static void emit_prologue()
+{
+    // push rbx; push r12; push r13
+    // the stack is 16-byte aligned for the calls
+    emit8(0x53);
+    emit8(0x41);
+    emit8(0x54);
+    emit8(0x41);
+    emit8(0x55);
+    emit_mov_imm64(HOST_RBX, (uint64_t)&cpu_flags);
+    emit_mov_imm64(HOST_R13, (uint64_t)&cpu_pc);
+}
+
+// return the number of executed instructions
+static void emit_return(int num_inst)
+{
+    // mov eax, imm32
+    emit8(0xb8);
+    emit32(num_inst);
+    // pop r13; pop r12; pop rbx; ret
+    emit8(0x41);
+    emit8(0x5d);
+    emit8(0x41);
+    emit8(0x5c);
+    emit8(0x5b);
+    emit8(0xc3);
+}
+
+// the instruction writes memory, which may be the code of the block
+static int is_store(inst_t *inst)
+{
+    switch (inst->opcode)
+    {
+        case INST_PUSH:
+            return 1;
+        case INST_MOV:
+        case INST_ADD:
+        case INST_SUB:
+            return inst->dst.type == OD_MEM;
+        default:
+            return 0;
+    }
+}
+
+// a store into the page of the block removes it, `jit_code` is NULL then:
+// stop after the instruction, the rest of the host code is stale
+static void emit_check_removed(block_t *b, int index)
+{
+    emit_mov_imm64(HOST_R11, (uint64_t)&(b->jit_code));
+    emit_mem(1, 0x83, 7, HOST_R11, 0);
+    emit8(0);
+    uint8_t *valid = emit_jump(HOST_CC_NE);
+    emit_add_rip((index + 1) * INSTRUCTION_SIZE);
+    emit_return(index + 1);
+    patch_jump(valid);
+}
+
+typedef enum
+{
+    JIT_INST_UNSUPPORTED,   // left to the interpreter
+    JIT_INST_SEQUENTIAL,    // RIP goes to the next instruction
+    JIT_INST_BRANCH,        // RIP is written, the block ends
+} jit_inst_t;
+
+// emit the host code of one instruction
+// `lazy_flags`: the flags are recorded by add/sub/cmp of this block
+static jit_inst_t emit_instruction(inst_t *inst, int index, int *lazy_flags)
+{
+    od_t *src = &(inst->src);
+    od_t *dst = &(inst->dst);
+
+    switch (inst->opcode)
+    {
+        case INST_MOV:
+            if (src->type == OD_REG && dst->type == OD_REG)
+            {
+                emit_load_abs(HOST_RAX, src->reg1);
+                emit_store_abs(dst->reg1, HOST_RAX);
+            }
+            else if (src->type == OD_IMM && dst->type == OD_REG)
+            {
+                emit_mov_imm64(HOST_RAX, src->imm);
+                emit_store_abs(dst->reg1, HOST_RAX);
+            }
+            else if (src->type == OD_MEM && dst->type == OD_REG)
+            {
+                emit_read_memory(src, index);
+                emit_store_abs(dst->reg1, HOST_RAX);
+            }
+            else if ((src->type == OD_REG || src->type == OD_IMM) && dst->type == OD_MEM)
+            {
+                emit_effective_address(dst);
+                emit_translate(index);
+                emit_reg(1, 0x89, HOST_RAX, HOST_RDI);
+                if (src->type == OD_REG)
+                {
+                    emit_load_abs(HOST_RSI, src->reg1);
+                }
+                else
+                {
+                    emit_mov_imm64(HOST_RSI, src->imm);
+                }
+                emit_write_dram();
+            }
+            else
+            {
+                return JIT_INST_UNSUPPORTED;
+            }
+            emit_clear_flags();
+            *lazy_flags = 0;
+            return JIT_INST_SEQUENTIAL;
+        case INST_PUSH:
+            if (src->type != OD_REG && src->type != OD_IMM)
+            {
+                return JIT_INST_UNSUPPORTED;
+            }
+            if (src->type == OD_REG)
+            {
+                emit_load_abs(HOST_R12, src->reg1);
+            }
+            else
+            {
+                emit_mov_imm64(HOST_R12, src->imm);
+            }
+            emit_push_stack(index);
+            emit_clear_flags();
+            *lazy_flags = 0;
+            return JIT_INST_SEQUENTIAL;
+        case INST_POP:
+            if (src->type != OD_REG)
+            {
+                return JIT_INST_UNSUPPORTED;
+            }
+            emit_pop_stack(index);
+            emit_store_abs(src->reg1, HOST_R12);
+            emit_clear_flags();
+            *lazy_flags = 0;
+            return JIT_INST_SEQUENTIAL;
+        case INST_LEAVE:
+            // movq %rbp, %rsp
+            // popq %rbp
+            emit_load_abs(HOST_RDI, (uint64_t)&cpu_reg.rbp);
+            emit_translate(index);
+            emit_read_dram();
+            emit_reg(1, 0x89, HOST_RAX, HOST_R12);
+            emit_load_abs(HOST_RAX, (uint64_t)&cpu_reg.rbp);
+            emit_reg(1, 0x83, 0, HOST_RAX);
+            emit8(8);
+            emit_store_abs((uint64_t)&cpu_reg.rsp, HOST_RAX);
+            emit_store_abs((uint64_t)&cpu_reg.rbp, HOST_R12);
+            emit_clear_flags();
+            *lazy_flags = 0;
+            return JIT_INST_SEQUENTIAL;
+        case INST_CALL:
+            if (src->type != OD_IMM)
+            {
+                return JIT_INST_UNSUPPORTED;
+            }
+            // the return address
+            emit_mem(1, 0x8b, HOST_R12, HOST_R13, 0);
+            emit_reg(1, 0x81, 0, HOST_R12);
+            emit32((index + 1) * INSTRUCTION_SIZE);
+            emit_push_stack(index);
+            emit_mov_imm64(HOST_RAX, src->imm);
+            emit_mem(1, 0x89, HOST_RAX, HOST_R13, 0);
+            emit_clear_flags();
+            return JIT_INST_BRANCH;
+        case INST_RET:
+            emit_pop_stack(index);
+            emit_mem(1, 0x89, HOST_R12, HOST_R13, 0);
+            emit_clear_flags();
+            return JIT_INST_BRANCH;
+        case INST_JMP:
+            if (src->type != OD_IMM)
+            {
+                return JIT_INST_UNSUPPORTED;
+            }
+            emit_mov_imm64(HOST_RAX, src->imm);
+            emit_mem(1, 0x89, HOST_RAX, HOST_R13, 0);
+            emit_clear_flags();
+            return JIT_INST_BRANCH;
+        case INST_JNE:
+            if (src->type != OD_IMM)
+            {
+                return JIT_INST_UNSUPPORTED;
+            }
+            else
+            {
+                // the same as `read_ZF` of isa.c
+                uint8_t *use_zf = NULL;
+                uint8_t *test_done = NULL;
+                if (*lazy_flags == 0)
+                {
+                    emit_mem(0, 0x83, 7, HOST_RBX, offsetof(cpu_flags_t, lazy_op));
+                    emit8(FLAGS_OP_NONE);
+                    use_zf = emit_jump(HOST_CC_E);
+                }
+                emit_mem(1, 0x83, 7, HOST_RBX, offsetof(cpu_flags_t, lazy_val));
+                emit8(0);
+                if (*lazy_flags == 0)
+                {
+                    test_done = emit_jump(-1);
+                    patch_jump(use_zf);
+                    // cmp word [rbx + ZF], 1: not equal when ZF is 0
+                    emit8(0x66);
+                    emit_mem(0, 0x83, 7, HOST_RBX, offsetof(cpu_flags_t, ZF));
+                    emit8(1);
+                    patch_jump(test_done);
+                }
+                uint8_t *taken = emit_jump(HOST_CC_NE);
+                emit_add_rip((index + 1) * INSTRUCTION_SIZE);
+                uint8_t *done = emit_jump(-1);
+                patch_jump(taken);
+                emit_mov_imm64(HOST_RAX, src->imm);
+                emit_mem(1, 0x89, HOST_RAX, HOST_R13, 0);
+                patch_jump(done);
+                emit_clear_flags();
+            }
+            return JIT_INST_BRANCH;
+        case INST_ADD:
+        case INST_SUB:
+        case INST_CMP:
+            {
+                flags_op_t op = inst->opcode == INST_ADD ? FLAGS_OP_ADD : FLAGS_OP_SUB;
+
+                // rdx = dst, rsi = src
+                if (dst->type == OD_REG && (src->type == OD_REG || src->type == OD_IMM || src->type == OD_MEM))
+                {
+                    if (src->type == OD_MEM)
+                    {
+                        emit_read_memory(src, index);
+                        emit_reg(1, 0x89, HOST_RAX, HOST_RSI);
+                    }
+                    else if (src->type == OD_REG)
+                    {
+                        emit_load_abs(HOST_RSI, src->reg1);
+                    }
+                    else
+                    {
+                        emit_mov_imm64(HOST_RSI, src->imm);
+                    }
+                    emit_load_abs(HOST_RDX, dst->reg1);
+                    emit_arithmetic(op);
+                    if (inst->opcode != INST_CMP)
+                    {
+                        emit_store_abs(dst->reg1, HOST_RAX);
+                    }
+                }
+                else if (dst->type == OD_MEM && (src->type == OD_REG || src->type == OD_IMM))
+                {
+                    emit_effective_address(dst);
+                    emit_translate(index);
+                    emit_reg(1, 0x89, HOST_RAX, HOST_R12);
+                    emit_read_dram();
+                    emit_reg(1, 0x89, HOST_RAX, HOST_RDX);
+                    if (src->type == OD_REG)
+                    {
+                        emit_load_abs(HOST_RSI, src->reg1);
+                    }
+                    else
+                    {
+                        emit_mov_imm64(HOST_RSI, src->imm);
+                    }
+                    emit_arithmetic(op);
+                    if (inst->opcode != INST_CMP)
+                    {
+                        emit_reg(1, 0x89, HOST_R12, HOST_RDI);
+                        emit_reg(1, 0x89, HOST_RAX, HOST_RSI);
+                        emit_write_dram();
+                    }
+                }
+                else
+                {
+                    return JIT_INST_UNSUPPORTED;
+                }
+                *lazy_flags = 1;
+            }
+            return JIT_INST_SEQUENTIAL;
+        case INST_LEA:
+            if (src->type != OD_MEM || dst->type != OD_REG)
+            {
+                return JIT_INST_UNSUPPORTED;
+            }
+            emit_effective_address(src);
+            emit_store_abs(dst->reg1, HOST_RDI);
+            emit_clear_flags();
+            *lazy_flags = 0;
+            return JIT_INST_SEQUENTIAL;
+        case INST_NOP:
+            return JIT_INST_SEQUENTIAL;
+        default:
+            // int: interrupt is raised by the interpreter
+            return JIT_INST_UNSUPPORTED;
+    }
+}
+
+// compile the block to host code, return NULL if nothing is compiled
+static void *jit_compile_block(block_t *b)
+{
+    if (jit_buffer == NULL)
+    {
+        jit_buffer = mmap(NULL, JIT_BUFFER_SIZE,
+            PROT_READ | PROT_WRITE | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (jit_buffer == MAP_FAILED)
+        {
+            printf("\033[31;1mJIT: failed to map the code buffer\033[0m\n");
+            exit(0);
+        }
+        jit_tlb_flush();
+    }
+
+    if (jit_top + JIT_MAX_BLOCK_CODE > JIT_BUFFER_SIZE)
+    {
+        // all the compiled code is discarded
+        jit_top = 0;
+        jit_state()->epoch += 1;
+    }
+
+    uint8_t *code = &jit_buffer[jit_top];
+    emit_ptr = code;
+    emit_prologue();
+
+    int num_inst = 0;
+    int lazy_flags = 0;
+    jit_inst_t last = JIT_INST_SEQUENTIAL;
+    while (num_inst < b->num_inst)
+    {
+        last = emit_instruction(&(b->inst[num_inst]), num_inst, &lazy_flags);
+        if (last == JIT_INST_UNSUPPORTED)
+        {
+            break;
+        }
+        num_inst += 1;
+        if (last == JIT_INST_BRANCH)
+        {
+            break;
+        }
+        if (is_store(&(b->inst[num_inst - 1])) == 1)
+        {
+            emit_check_removed(b, num_inst - 1);
+        }
+    }
+
+    if (num_inst == 0)
+    {
+        return NULL;
+    }
+
+    if (last != JIT_INST_BRANCH)
+    {
+        emit_add_rip(num_inst * INSTRUCTION_SIZE);
+    }
+    emit_return(num_inst);
+    assert(emit_ptr - code <= JIT_MAX_BLOCK_CODE);
+
+    // the next block starts from 16-byte aligned address
+    jit_top = ((emit_ptr - jit_buffer) + 0xf) & ~(uint64_t)0xf;
+
+    b->jit_code = code;
+    b->jit_epoch = jit_state()->epoch;
+    return code;
+}
+
+#else
+
+static void *jit_compile_block(block_t *b)
+{
+    // no host code generator for this machine
+    return NULL;
+}
+
+#endif
+
+// get the host code of block
+// the block is counted, and compiled when it becomes hot
+void *jit_block_code(block_t *b)
+{
+    if (b->jit_code != NULL)
+    {
+        if (b->jit_epoch == jit_state()->epoch)
+        {
+            return b->jit_code;
+        }
+        // the code buffer was flushed, count again
+        b->jit_code = NULL;
+        b->exec_count = 0;
+    }
+
+    if (b->exec_count < jit_threshold)
+    {
+        b->exec_count += 1;
+        return NULL;
+    }
+    if (b->exec_count > jit_threshold)
+    {
+        // compiled before but nothing can be compiled
+        return NULL;
+    }
+    b->exec_count += 1;
+    return jit_compile_block(b);
+}
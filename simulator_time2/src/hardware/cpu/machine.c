@@ -0,0 +1,430 @@
+/* BCST - Introduction to Computer Systems
+ * Author:      yangminz@outlook.com
+ * Github:      https://github.com/yangminz/bcst_csapp
+ * Bilibili:    https://space.bilibili.com/4564101
+ * Zhihu:       https://www.zhihu.com/people/zhao-yang-min
+ * This project (code repository and videos) is exclusively owned by yangminz
+ * and shall not be used for commercial and profitting purpose
+ * without yangminz's permission.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "header/machine.h"
+
+// from jit.c
+void jit_free(core_t *c);
+
+// from dram.c
+void dram_buffer_begin();
+void dram_buffer_commit(core_t *c);
+void dram_buffer_free(core_t *c);
+
+// from event.c
+void event_relocate(core_t *c, int64_t offset);
+
+#ifdef USE_PARALLEL
+// from interrupt.c
+void interrupt_deferred_enter();
+#endif
+
+// the machine of the programs not knowing `machine_t`
+static machine_t default_machine = { .num_cores = 1 };
+
+__thread machine_t *machine = &default_machine;
+__thread core_t *active_core = &default_machine.cores[0];
+
+/*======================================*/
+/*      arena of the machine            */
+/*======================================*/
+
+// The arena is reserved, not committed: the host gives the pages
+// on first touch. The machines are placed at fixed distances in a high
+// range, so a snapshot is likely to find its address free in a new process.
+#define ARENA_SIZE          (0x10000000)
+#define ARENA_HINT          (0x100000000000)
+#define ARENA_ALIGNMENT     (64)
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE (0x100000)
+#endif
+
+static uint64_t arena_count = 0;
+
+void *machine_aligned_alloc(uint64_t alignment, uint64_t size)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    machine_t *m = machine;
+    if (m->arena_size == 0)
+    {
+        void *p = NULL;
+        if (posix_memalign(&p, alignment < sizeof(void *) ? sizeof(void *) : alignment, size) != 0)
+        {
+            printf("\033[31;1mFailed to allocate %lu bytes\033[0m\n", size);
+            exit(0);
+        }
+        memset(p, 0, size);
+        return p;
+    }
+
+    // the cores of a parallel run allocate at the same time
+    uint64_t top, addr;
+    do
+    {
+        top = __atomic_load_n(&(m->arena_top), __ATOMIC_RELAXED);
+        addr = (top + alignment - 1) & ~(alignment - 1);
+    }
+    while (__sync_bool_compare_and_swap(&(m->arena_top), top, addr + size) == 0);
+
+    if (addr + size > (uint64_t)m + m->arena_size)
+    {
+        printf("\033[31;1mMachine arena is full\033[0m\n");
+        exit(0);
+    }
+    return (void *)addr;
+}
+
+void *machine_malloc(uint64_t size)
+{
+    return machine_aligned_alloc(ARENA_ALIGNMENT, size);
+}
+
+void *machine_calloc(uint64_t size)
+{
+    // the arena is zero on mapping
+    return machine_aligned_alloc(ARENA_ALIGNMENT, size);
+}
+
+machine_t *machine_construct(int num_cores)
+{
+    assert(1 <= num_cores && num_cores <= MAX_NUM_CORE);
+
+    uint64_t hint = ARENA_HINT + __sync_fetch_and_add(&arena_count, 1) * ARENA_SIZE;
+    void *base = mmap((void *)hint, ARENA_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(base != MAP_FAILED);
+
+    machine_t *m = base;
+    m->arena_size = ARENA_SIZE;
+    m->arena_top = (uint64_t)m + sizeof(machine_t);
+    m->num_cores = num_cores;
+    for (int i = 0; i < num_cores; ++ i)
+    {
+        m->cores[i].id = i;
+    }
+    return m;
+}
+
+void machine_free(machine_t *m)
+{
+    assert(m != NULL);
+    assert(m != &default_machine);
+    assert(m != machine);
+
+    // only the host resources outside the arena
+    for (int i = 0; i < m->num_cores; ++ i)
+    {
+        core_t *c = &(m->cores[i]);
+        jit_free(c);
+        dram_buffer_free(c);
+    }
+    munmap(m, m->arena_size);
+}
+
+/*======================================*/
+/*      checkpoint and restore          */
+/*======================================*/
+
+// The file is the header in the first page, then the used part of the arena,
+// so the arena can be mapped from the file at page offset.
+#define SNAPSHOT_MAGIC      (0x5453434250414e53)
+#define SNAPSHOT_OFFSET     (4096)
+
+typedef struct
+{
+    uint64_t    magic;
+    uint64_t    machine_size;
+    uint64_t    base;
+    uint64_t    used;
+    // address of a function, to relocate the host code pointers
+    uint64_t    anchor;
+} snapshot_header_t;
+
+int machine_checkpoint(const char *path)
+{
+    machine_t *m = machine;
+    if (m->arena_size == 0)
+    {
+        // the default machine is scattered on the host heap
+        return -1;
+    }
+
+    snapshot_header_t h =
+    {
+        .magic = SNAPSHOT_MAGIC,
+        .machine_size = sizeof(machine_t),
+        .base = (uint64_t)m,
+        .used = m->arena_top - (uint64_t)m,
+        .anchor = (uint64_t)&machine_construct,
+    };
+
+    FILE *fw = fopen(path, "wb");
+    if (fw == NULL)
+    {
+        return -1;
+    }
+    uint8_t page[SNAPSHOT_OFFSET];
+    memset(page, 0, SNAPSHOT_OFFSET);
+    memcpy(page, &h, sizeof(snapshot_header_t));
+    int ok = fwrite(page, SNAPSHOT_OFFSET, 1, fw) == 1 &&
+        fwrite(m, h.used, 1, fw) == 1;
+    ok = fclose(fw) == 0 && ok;
+    return ok ? 0 : -1;
+}
+
+machine_t *machine_restore(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    snapshot_header_t h;
+    if (read(fd, &h, sizeof(snapshot_header_t)) != sizeof(snapshot_header_t) ||
+        h.magic != SNAPSHOT_MAGIC ||
+        h.machine_size != sizeof(machine_t))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // the arena at its old address, then the saved part from the file
+    // the pages are shared with the file until written
+    void *base = mmap((void *)h.base, ARENA_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (base != (void *)h.base)
+    {
+        if (base != MAP_FAILED)
+        {
+            munmap(base, ARENA_SIZE);
+        }
+        close(fd);
+        return NULL;
+    }
+    if (mmap(base, h.used, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_FIXED, fd, SNAPSHOT_OFFSET) == MAP_FAILED)
+    {
+        munmap(base, ARENA_SIZE);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    machine_t *m = base;
+    int64_t offset = (uint64_t)&machine_construct - h.anchor;
+    for (int i = 0; i < m->num_cores; ++ i)
+    {
+        core_t *c = &(m->cores[i]);
+        // the host resources of the old process are gone,
+        // the caches are built again on use
+        c->decode = NULL;
+        c->block = NULL;
+        c->jit = NULL;
+        c->store = NULL;
+        c->softmmu = NULL;
+        c->last_block = NULL;
+        c->jit_running = 0;
+        c->jit_progress = 0;
+        event_relocate(c, offset);
+    }
+    return m;
+}
+
+machine_t *machine_switch(machine_t *m)
+{
+    assert(m != NULL);
+    machine_t *old = machine;
+    machine = m;
+    active_core = &(m->cores[0]);
+    return old;
+}
+
+void core_switch(int id)
+{
+    assert(0 <= id && id < machine->num_cores);
+    active_core = &(machine->cores[id]);
+}
+
+// Deterministic round-robin interleaving: core 0, 1, ..., N-1, 0, ...
+// each runs one quantum. A core sees the DRAM writes of the others
+// only at the boundaries of quantum.
+uint64_t machine_run(uint64_t quantum, uint64_t max_instructions)
+{
+    assert(quantum > 0);
+
+    core_t *self = active_core;
+    uint64_t retired[MAX_NUM_CORE] = {0};
+    uint64_t total = 0;
+
+    int running = 1;
+    while (running == 1)
+    {
+        running = 0;
+        for (int i = 0; i < machine->num_cores; ++ i)
+        {
+            if (retired[i] >= max_instructions)
+            {
+                continue;
+            }
+
+            uint64_t n = max_instructions - retired[i];
+            if (n > quantum)
+            {
+                n = quantum;
+            }
+
+            active_core = &(machine->cores[i]);
+            uint64_t k = cpu_run(n);
+            retired[i] += k;
+            total += k;
+            running = 1;
+        }
+    }
+
+    active_core = self;
+    return total;
+}
+
+#ifdef USE_PARALLEL
+// Parallel run: bound and weave
+//      bound - each core runs one quantum on its own host thread,
+//              its stores are buffered (dram.c), and an interrupt
+//              stops the core (interrupt.c)
+//      weave - at the barrier, core 0 writes the buffers to DRAM
+//              in the order of core id, then enters the kernel for
+//              the stopped cores in the same order
+// The result is the same for any timing of the host threads.
+
+typedef struct
+{
+    machine_t           *m;
+    uint64_t            quantum;
+    uint64_t            max_instructions;
+    uint64_t            retired[MAX_NUM_CORE];
+    // decided by core 0 at the barrier
+    int                 running;
+    pthread_barrier_t   barrier;
+} parallel_run_t;
+
+typedef struct
+{
+    parallel_run_t      *run;
+    int                 id;
+} parallel_core_t;
+
+// no core is running: the kernel may touch the state of any core
+static void parallel_weave(parallel_run_t *r)
+{
+    core_t *self = active_core;
+    for (int i = 0; i < r->m->num_cores; ++ i)
+    {
+        dram_buffer_commit(&(r->m->cores[i]));
+    }
+    for (int i = 0; i < r->m->num_cores; ++ i)
+    {
+        active_core = &(r->m->cores[i]);
+        interrupt_deferred_enter();
+    }
+    active_core = self;
+
+    r->running = 0;
+    for (int i = 0; i < r->m->num_cores; ++ i)
+    {
+        if (r->retired[i] < r->max_instructions)
+        {
+            r->running = 1;
+        }
+    }
+}
+
+static void *parallel_core_thread(void *arg)
+{
+    parallel_core_t *p = arg;
+    parallel_run_t *r = p->run;
+
+    machine = r->m;
+    active_core = &(r->m->cores[p->id]);
+
+    while (r->running == 1)
+    {
+        // a core stopped by interrupt needs more quanta,
+        // the finished cores still wait at the barriers
+        uint64_t n = r->max_instructions - r->retired[p->id];
+        if (n > r->quantum)
+        {
+            n = r->quantum;
+        }
+
+        dram_buffer_begin();
+        if (n > 0)
+        {
+            r->retired[p->id] += cpu_run(n);
+        }
+
+        // all cores are bound
+        pthread_barrier_wait(&(r->barrier));
+        if (p->id == 0)
+        {
+            parallel_weave(r);
+        }
+        // all stores are weaved, and the kernel is left
+        pthread_barrier_wait(&(r->barrier));
+    }
+    return NULL;
+}
+
+uint64_t machine_run_parallel(uint64_t quantum, uint64_t max_instructions)
+{
+    assert(quantum > 0);
+
+    machine_t *m = machine;
+    int n = m->num_cores;
+
+    parallel_run_t r = {
+        .m = m,
+        .quantum = quantum,
+        .max_instructions = max_instructions,
+        .running = 1,
+    };
+    pthread_barrier_init(&(r.barrier), NULL, n);
+
+    pthread_t threads[MAX_NUM_CORE];
+    parallel_core_t cores[MAX_NUM_CORE];
+    for (int i = 0; i < n; ++ i)
+    {
+        cores[i] = (parallel_core_t){
+            .run = &r,
+            .id = i,
+        };
+        pthread_create(&threads[i], NULL, &parallel_core_thread, &cores[i]);
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < n; ++ i)
+    {
+        pthread_join(threads[i], NULL);
+        total += r.retired[i];
+    }
+
+    pthread_barrier_destroy(&(r.barrier));
+    return total;
+}
+#endif
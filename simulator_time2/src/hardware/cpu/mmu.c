@@ -7,39 +7,431 @@
 #include "../../header/common.h"
 #include "../../header/address.h"
 #include "header/interrupt.h"
+#include "header/machine.h"
+
+// from isa.c
+void softmmu_flush();
+void softmmu_flush_core();
 
 
 // -------------------------------------------- //
 // TLB cache struct
 // -------------------------------------------- //
-#define NUM_TLB_CACHE_LINE_PER_SET (8)
+
+// Each core has a split L1 (instruction and data) backed by a unified L2.
+// The fetch looks up the iTLB, the handlers look up the dTLB,
+// and a miss in L1 looks up L2 before the page walk. The translation
+// from L2 or from the page table fills the L1 that missed.
+// A line maps a page of 4 KB, 2 MB or 1 GB. The large pages are tagged
+// and indexed by their own page number, so a lookup probes the set of
+// each page size cached in the level.
+
+#define MAX_NUM_TLB_WAY (64)
+#define NUM_PAGE_SIZE (3)
+
+static const int page_shift[NUM_PAGE_SIZE] = {PAGE_SHIFT_4K, PAGE_SHIFT_2M, PAGE_SHIFT_1G};
 
 typedef struct {
     int valid;
-    uint64_t tag;
-    uint64_t ppn;
+    int shift;      // page size of the line
+    uint64_t asid;  // address space of the line
+    uint64_t tag;   // the whole page number of the page size
+    uint64_t ppn;   // the first 4 KB frame of the page
+    uint64_t time;  // last access, for LRU
 } tlb_cacheline_t;
 
-typedef struct{
-    tlb_cacheline_t lines[NUM_TLB_CACHE_LINE_PER_SET];
-} tlb_cacheset_t;
+typedef struct
+{
+    int num_sets;
+    int num_ways;
+    int latency;    // cycles of one lookup
+    tlb_policy_t policy;
+} tlb_geometry_t;
+
+// the geometry of each level of the TLBs of the cores
+// owned by each machine
+struct TLB_STATE
+{
+    tlb_geometry_t level[NUM_TLB_LEVEL];
+    // changed by each `tlb_configure`, from 1
+    uint64_t version;
+};
 
-typedef struct{
-    tlb_cacheset_t sets[(1 << TLB_CACHE_INDEX_LENGTH)];
+static inline struct TLB_STATE *tlb_config()
+{
+    if (machine->tlb == NULL)
+    {
+        machine->tlb = machine_calloc(sizeof(struct TLB_STATE));
+        machine->tlb->level[TLB_L1I] = (tlb_geometry_t){16, 8, 1, TLB_PLRU};
+        machine->tlb->level[TLB_L1D] = (tlb_geometry_t){16, 4, 1, TLB_PLRU};
+        machine->tlb->level[TLB_L2] = (tlb_geometry_t){128, 8, 7, TLB_PLRU};
+        machine->tlb->version = 1;
+    }
+    return machine->tlb;
+}
+
+// one level
+typedef struct
+{
+    // allocated for the geometry, set i is lines[i * num_ways ...]
+    tlb_geometry_t geometry;
+    tlb_cacheline_t *lines;
+    // the tree of pseudo-LRU of each set: bit k is node k, the root is 1
+    uint64_t *plru;
+    uint64_t clock;
+    // bit k: lines of page_shift[k] may be valid
+    int sizes;
+
+    // of each address space, counted in SIM_DETAIL
+    tlb_stat_t stat[MAX_NUM_ASID];
 } tlb_cache_t;
 
-static tlb_cache_t mmu_tlb;
+// -------------------------------------------- //
+// paging-structure caches
+// -------------------------------------------- //
+
+// The upper levels of the page walk are cached by the prefix of the VPN:
+//      PML4E cache     vpn1                -> PUD
+//      PDPTE cache     vpn1, vpn2          -> PMD
+//      PDE cache       vpn1, vpn2, vpn3    -> PT
+// so the walk starts from the table of the longest prefix cached.
+// The entries are tagged by the ASID and invalidated with the TLB.
+
+#define NUM_PWC_LEVEL (3)
+#define MAX_NUM_PWC_ENTRY (32)
+
+static const int pwc_size[NUM_PWC_LEVEL] = {4, 16, 32};
+
+typedef struct
+{
+    int valid;
+    uint64_t asid;
+    uint64_t prefix;
+    uint64_t table;     // the table of the next level
+    uint64_t time;      // last access, for LRU
+} pwc_entry_t;
+
+// the TLBs of each core
+struct MMU_STATE
+{
+    tlb_cache_t level[NUM_TLB_LEVEL];
+    // the version of the configuration the lines are allocated for
+    uint64_t version;
+
+    // pwc[k] skips k + 1 levels
+    pwc_entry_t pwc[NUM_PWC_LEVEL][MAX_NUM_PWC_ENTRY];
+    uint64_t pwc_clock;
+    // the walks by the levels skipped, counted in SIM_DETAIL
+    uint64_t walk_skipped[NUM_PWC_LEVEL + 1];
+};
+
+static void allocate_lines(tlb_cache_t *t, tlb_geometry_t *g)
+{
+    t->geometry = *g;
+    // the lines of the old geometry stay in the arena
+    t->lines = machine_calloc(sizeof(tlb_cacheline_t) * g->num_sets * g->num_ways);
+    t->plru = machine_calloc(sizeof(uint64_t) * g->num_sets);
+}
+
+static inline struct MMU_STATE *mmu_state()
+{
+    if (active_core->mmu == NULL)
+    {
+        active_core->mmu = machine_calloc(sizeof(struct MMU_STATE));
+    }
+    struct MMU_STATE *s = active_core->mmu;
+    struct TLB_STATE *c = tlb_config();
+    if (s->version != c->version)
+    {
+        for (int i = 0; i < NUM_TLB_LEVEL; ++ i)
+        {
+            allocate_lines(&(s->level[i]), &(c->level[i]));
+        }
+        s->version = c->version;
+    }
+    return s;
+}
+
+static void flush_lines(tlb_cache_t *t)
+{
+    if (t->lines != NULL)
+    {
+        memset(t->lines, 0, sizeof(tlb_cacheline_t) * t->geometry.num_sets * t->geometry.num_ways);
+        memset(t->plru, 0, sizeof(uint64_t) * t->geometry.num_sets);
+    }
+    t->sizes = 0;
+}
+
+// invalidate the TLB of each core of current machine
+void tlb_flush()
+{
+    for (int i = 0; i < machine->num_cores; ++ i)
+    {
+        struct MMU_STATE *s = machine->cores[i].mmu;
+        for (int j = 0; s != NULL && j < NUM_TLB_LEVEL; ++ j)
+        {
+            flush_lines(&(s->level[j]));
+        }
+        if (s != NULL)
+        {
+            memset(s->pwc, 0, sizeof(s->pwc));
+        }
+    }
+    softmmu_flush();
+}
+
+static int is_power_of_2(int x)
+{
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+void tlb_configure(tlb_level_t level, int num_sets, int num_ways, int latency, tlb_policy_t policy)
+{
+    assert(0 <= level && level < NUM_TLB_LEVEL);
+    assert(is_power_of_2(num_sets));
+    assert(0 < num_ways && num_ways <= MAX_NUM_TLB_WAY);
+    // the leaves of the tree are the ways
+    assert(policy != TLB_PLRU || is_power_of_2(num_ways));
+
+    struct TLB_STATE *c = tlb_config();
+    c->level[level] = (tlb_geometry_t){num_sets, num_ways, latency, policy};
+    c->version += 1;
+
+    // the lines are allocated again for the geometry on the next access
+    tlb_flush();
+}
+
+tlb_stat_t tlb_stat(tlb_level_t level, uint64_t asid)
+{
+    assert(0 <= level && level < NUM_TLB_LEVEL);
+    assert(asid < MAX_NUM_ASID);
+    tlb_stat_t sum = {0};
+    for (int i = 0; i < machine->num_cores; ++ i)
+    {
+        struct MMU_STATE *s = machine->cores[i].mmu;
+        if (s != NULL)
+        {
+            tlb_stat_t *t = &(s->level[level].stat[asid]);
+            sum.hit += t->hit;
+            sum.miss += t->miss;
+            sum.eviction += t->eviction;
+            sum.cycle += t->cycle;
+        }
+    }
+    return sum;
+}
+
+static inline int size_of_shift(int shift)
+{
+    return (shift - PAGE_SHIFT_4K) / VIRTUAL_PAGE_NUMBER_LENGTH;
+}
 
+// the lines of the set of the virtual page
+static inline tlb_cacheline_t *tlb_set(tlb_cache_t *t, uint64_t tag, int *index)
+{
+    *index = tag & (t->geometry.num_sets - 1);
+    return &(t->lines[*index * t->geometry.num_ways]);
+}
 
+// the VPN prefix of the upper `k + 1` levels
+static inline uint64_t pwc_prefix(uint64_t vaddr, int k)
+{
+    address_t a = {.address_value = vaddr};
+    return (uint64_t)a.vaddr_value >> (VIRTUAL_PAGE_OFFSET_LENGTH +
+        (NUM_PWC_LEVEL - k) * VIRTUAL_PAGE_NUMBER_LENGTH);
+}
 
+// invalidate the entries of the address space,
+// only those of the upper levels of `vaddr` if it is not -1
+static void pwc_invalidate(struct MMU_STATE *s, uint64_t asid, uint64_t vaddr)
+{
+    for (int k = 0; k < NUM_PWC_LEVEL; ++ k)
+    {
+        for (int i = 0; i < pwc_size[k]; ++ i)
+        {
+            pwc_entry_t *e = &(s->pwc[k][i]);
+            if (e->valid == 1 && e->asid == asid &&
+                (vaddr == 0xffffffffffffffff || e->prefix == pwc_prefix(vaddr, k)))
+            {
+                e->valid = 0;
+            }
+        }
+    }
+}
+
+// the table to continue the walk from, return the levels skipped
+static int pwc_lookup(struct MMU_STATE *s, uint64_t vaddr, pte123_t **table)
+{
+    for (int k = NUM_PWC_LEVEL - 1; k >= 0; -- k)
+    {
+        uint64_t prefix = pwc_prefix(vaddr, k);
+        for (int i = 0; i < pwc_size[k]; ++ i)
+        {
+            pwc_entry_t *e = &(s->pwc[k][i]);
+            if (e->valid == 1 && e->asid == cpu_controls.asid && e->prefix == prefix)
+            {
+                s->pwc_clock += 1;
+                e->time = s->pwc_clock;
+                *table = (pte123_t *)e->table;
+                return k + 1;
+            }
+        }
+    }
+    return 0;
+}
 
+// `table` is reached after `level` levels of the walk
+static void pwc_fill(struct MMU_STATE *s, uint64_t vaddr, int level, pte123_t *table)
+{
+    int k = level - 1;
+    pwc_entry_t *victim = &(s->pwc[k][0]);
+    for (int i = 0; i < pwc_size[k]; ++ i)
+    {
+        pwc_entry_t *e = &(s->pwc[k][i]);
+        if (e->valid == 0)
+        {
+            victim = e;
+            break;
+        }
+        if (e->time < victim->time)
+        {
+            victim = e;
+        }
+    }
+    s->pwc_clock += 1;
+    victim->valid = 1;
+    victim->asid = cpu_controls.asid;
+    victim->prefix = pwc_prefix(vaddr, k);
+    victim->table = (uint64_t)table;
+    victim->time = s->pwc_clock;
+}
 
-static uint64_t page_walk(uint64_t vaddr_value);
+uint64_t page_walk_count(int skipped)
+{
+    assert(0 <= skipped && skipped <= NUM_PWC_LEVEL);
+    uint64_t sum = 0;
+    for (int i = 0; i < machine->num_cores; ++ i)
+    {
+        struct MMU_STATE *s = machine->cores[i].mmu;
+        if (s != NULL)
+        {
+            sum += s->walk_skipped[skipped];
+        }
+    }
+    return sum;
+}
+
+static void flush_asid(tlb_cache_t *t, uint64_t asid)
+{
+    if (t->lines == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < t->geometry.num_sets * t->geometry.num_ways; ++ i)
+    {
+        tlb_cacheline_t *line = &(t->lines[i]);
+        if (line->valid == 1 && line->asid == asid)
+        {
+            line->valid = 0;
+        }
+    }
+}
+
+// invalidate the lines of one address space, e.g. the process exits
+void tlb_flush_asid(uint64_t asid)
+{
+    for (int i = 0; i < machine->num_cores; ++ i)
+    {
+        struct MMU_STATE *s = machine->cores[i].mmu;
+        for (int j = 0; s != NULL && j < NUM_TLB_LEVEL; ++ j)
+        {
+            flush_asid(&(s->level[j]), asid);
+        }
+        if (s != NULL)
+        {
+            pwc_invalidate(s, asid, 0xffffffffffffffff);
+        }
+    }
+    softmmu_flush();
+}
+
+// the lines of each page size covering `vaddr`
+static void invalidate_page(tlb_cache_t *t, uint64_t vaddr, uint64_t asid)
+{
+    if (t->lines == NULL)
+    {
+        return;
+    }
+    for (int k = 0; k < NUM_PAGE_SIZE; ++ k)
+    {
+        if (((t->sizes >> k) & 1) == 0)
+        {
+            continue;
+        }
+        uint64_t tag = vaddr >> page_shift[k];
+        int index;
+        tlb_cacheline_t *set = tlb_set(t, tag, &index);
+        for (int i = 0; i < t->geometry.num_ways; ++ i)
+        {
+            tlb_cacheline_t *line = &(set[i]);
+            if (line->valid == 1 && line->shift == page_shift[k] &&
+                line->tag == tag && line->asid == asid)
+            {
+                line->valid = 0;
+            }
+        }
+    }
+}
+
+// invalidate the line of one page, e.g. the page is unmapped
+// the page table is shared by the cores, so is the shootdown
+void tlb_invlpg(uint64_t vaddr, uint64_t asid)
+{
+    for (int i = 0; i < machine->num_cores; ++ i)
+    {
+        struct MMU_STATE *s = machine->cores[i].mmu;
+        for (int j = 0; s != NULL && j < NUM_TLB_LEVEL; ++ j)
+        {
+            invalidate_page(&(s->level[j]), vaddr, asid);
+        }
+        if (s != NULL)
+        {
+            pwc_invalidate(s, asid, vaddr);
+        }
+    }
+    // the software TLB has neither the address space nor the page size
+    softmmu_flush();
+}
+
+// switch the address space of current core without flushing the TLB
+void mmu_write_cr3(uint64_t pgd, uint64_t asid)
+{
+    assert(asid < MAX_NUM_ASID);
+    if (pgd != cpu_controls.cr3)
+    {
+        // the software TLB is of one page table
+        softmmu_flush_core();
+    }
+    cpu_controls.cr3 = pgd;
+    cpu_controls.asid = asid;
+    if (asid == 0)
+    {
+        // untagged, the lines may be of another page table
+        struct MMU_STATE *s = mmu_state();
+        for (int j = 0; j < NUM_TLB_LEVEL; ++ j)
+        {
+            flush_asid(&(s->level[j]), 0);
+        }
+        pwc_invalidate(s, 0, 0xffffffffffffffff);
+    }
+}
+
+static uint64_t page_walk(uint64_t vaddr_value, int *shift);
 static void page_fault_handler(pte4_t *pte, address_t vaddr);
 
 
-static int read_tlb(uint64_t vaddr_value, uint64_t *paddr_value_ptr, int *free_tlb_line_index);
-static int write_tlb(uint64_t vaddr_value, uint64_t paddr_value, int free_tlb_line_index);
+static int read_tlb(tlb_cache_t *t, uint64_t vaddr_value, uint64_t *paddr_value_ptr, int *free_tlb_line_index);
+static int write_tlb(tlb_cache_t *t, uint64_t vaddr_value, uint64_t paddr_value, int shift, int free_tlb_line_index);
 
 
 int swap_in(uint64_t daddr, uint64_t ppn);
@@ -47,7 +439,8 @@ int swap_out(uint64_t daddr, uint64_t ppn);
 
 
 
-uint64_t va2pa(uint64_t vaddr){
+// translate by the L1 TLB `l1`, then L2, then the page table
+static uint64_t translate(uint64_t vaddr, tlb_level_t l1){
 
 #ifdef USE_NAVIE_VA2PA
     return vaddr % PHYSICAL_MEMORY_SPACE;
@@ -59,33 +452,47 @@ uint64_t va2pa(uint64_t vaddr){
     uint64_t paddr = 0;
 
 #if defined(USE_TLB_HARDWARE) && defined(USE_PAGETABLE_VA2PA)
-    int free_tlb_line_index = -1;
-    int tlb_hit = read_tlb(vaddr, &paddr, &free_tlb_line_index);
+    // fast-forward: page walk only, the TLB is flushed
+    int use_tlb = sim_detailed();
+    int free_l1 = -1;
+    int free_l2 = -1;
+    struct MMU_STATE *s = NULL;
+    if (use_tlb)
+    {
+        s = mmu_state();
+        SIM_COUNT(SIM_TLB_ACCESS);
+        if (read_tlb(&(s->level[l1]), vaddr, &paddr, &free_l1) != 0)
+        {
+            // L1 hit
+            return paddr;
+        }
+        int hit_shift = read_tlb(&(s->level[TLB_L2]), vaddr, &paddr, &free_l2);
+        if (hit_shift != 0)
+        {
+            // L2 hit
+            write_tlb(&(s->level[l1]), vaddr, paddr, hit_shift, free_l1);
+            return paddr;
+        }
 
-    // TODO: add flag to read tlb failed
-    if (tlb_hit){
-        // TLB read hit
-        return paddr;
+        // TLB read miss
+        SIM_COUNT(SIM_TLB_MISS);
     }
-
-    // TLB read miss
 #endif
 
 
 #ifdef USE_PAGETABLE_VA2PA
     // assume that page_walk is consuming much time
-    paddr = page_walk(vaddr);
+    int shift = PAGE_SHIFT_4K;
+    paddr = page_walk(vaddr, &shift);
 #endif
 
 
 #if defined(USE_TLB_HARDWARE) && defined(USE_PAGETABLE_VA2PA)
     // refresh TLB
     // TODO: check if this paddr from page table is a legal address
-    if (paddr != 0){
-        // TLB write
-        if (write_tlb(vaddr, paddr, free_tlb_line_index) == 1){
-            return paddr;
-        }
+    if (use_tlb && paddr != 0){
+        write_tlb(&(s->level[TLB_L2]), vaddr, paddr, shift, free_l2);
+        write_tlb(&(s->level[l1]), vaddr, paddr, shift, free_l1);
     }
 #endif
     // use page table as va2pa
@@ -93,6 +500,18 @@ uint64_t va2pa(uint64_t vaddr){
 
 }
 
+// the data accesses of the handlers
+uint64_t va2pa(uint64_t vaddr)
+{
+    return translate(vaddr, TLB_L1D);
+}
+
+// the instruction fetch
+uint64_t va2pa_fetch(uint64_t vaddr)
+{
+    return translate(vaddr, TLB_L1I);
+}
+
 
 
 
@@ -104,8 +523,8 @@ uint64_t va2pa(uint64_t vaddr){
 
 
 // input - virtual address
-// output - physical address
- static uint64_t page_walk(uint64_t vaddr_value)
+// output - physical address, and the size of the page mapping it
+ static uint64_t page_walk(uint64_t vaddr_value, int *shift)
 {
     // parse address
     address_t vaddr = {
@@ -129,6 +548,19 @@ uint64_t va2pa(uint64_t vaddr){
 
     int level = 0;
     pte123_t *tab = pgd;
+#ifdef USE_TLB_HARDWARE
+    // start from the longest prefix cached
+    struct MMU_STATE *s = NULL;
+    if (sim_detailed())
+    {
+        s = mmu_state();
+        level = pwc_lookup(s, vaddr_value, &tab);
+        if (machine->sim_mode == SIM_DETAIL)
+        {
+            s->walk_skipped[level] += 1;
+        }
+    }
+#endif
     while (level < 3)
     {
         int vpn = vpns[level];
@@ -139,14 +571,29 @@ uint64_t va2pa(uint64_t vaddr){
             goto RAISE_PAGE_FAULT;
         }
 
+        if (level > 0 && tab[vpn].smallpage == 1)
+        {
+            // PUD maps 1 GB, PMD maps 2 MB: the walk stops here
+            *shift = PAGE_SHIFT_4K + (3 - level) * VIRTUAL_PAGE_NUMBER_LENGTH;
+            uint64_t offset = vaddr.vaddr_value & (((uint64_t)1 << *shift) - 1);
+            return (uint64_t)tab[vpn].paddr + offset;
+        }
+
         // move to next level
         tab = (pte123_t *)((uint64_t)tab[vpn].paddr);
         level += 1;
+#ifdef USE_TLB_HARDWARE
+        if (s != NULL)
+        {
+            pwc_fill(s, vaddr_value, level, tab);
+        }
+#endif
     }
 
     pte4_t *pte = &((pte4_t *)tab)[vaddr.vpn4];
     if (pte->present == 1)
     {
+        *shift = PAGE_SHIFT_4K;
         // find page table entry
         address_t paddr = {
             .ppn = pte->ppn,
@@ -409,69 +856,187 @@ RAISE_PAGE_FAULT:
 // }
 
 
-static int read_tlb(uint64_t vaddr_value, uint64_t *paddr_value_ptr, int *free_tlb_line_index){
-    address_t vaddr = {
-        .address_value = vaddr_value
-    };
+// -------------------------------------------- //
+// replacement policy
+// -------------------------------------------- //
 
-    tlb_cacheset_t *set = &mmu_tlb.sets[vaddr.tlbi];
-    *free_tlb_line_index = -1;
+static int log2_ways(int num_ways)
+{
+    return __builtin_ctz(num_ways);
+}
 
+// the nodes on the path to the way point away from it
+static void plru_touch(uint64_t *tree, int num_ways, int way)
+{
+    int depth = log2_ways(num_ways);
+    int node = 1;
+    for (int d = depth - 1; d >= 0; -- d)
+    {
+        int right = (way >> d) & 1;
+        if (right == 1)
+        {
+            *tree &= ~((uint64_t)1 << node);
+        }
+        else
+        {
+            *tree |= ((uint64_t)1 << node);
+        }
+        node = 2 * node + right;
+    }
+}
 
-    for (int i = 0; i < NUM_TLB_CACHE_LINE_PER_SET; ++ i){
+// follow the nodes to the pseudo least recently used way
+static int plru_victim(uint64_t tree, int num_ways)
+{
+    int node = 1;
+    while (node < num_ways)
+    {
+        node = 2 * node + ((tree >> node) & 1);
+    }
+    return node - num_ways;
+}
+
+static void touch_line(tlb_cache_t *t, int index, int way)
+{
+    t->clock += 1;
+    t->lines[index * t->geometry.num_ways + way].time = t->clock;
+    if (t->geometry.policy == TLB_PLRU)
+    {
+        plru_touch(&(t->plru[index]), t->geometry.num_ways, way);
+    }
+}
+
+static int select_victim(tlb_cache_t *t, int index, tlb_cacheline_t *set)
+{
+    switch (t->geometry.policy)
+    {
+        case TLB_RANDOM:
+            return random() % t->geometry.num_ways;
+        case TLB_LRU:
+        {
+            int victim = 0;
+            for (int i = 1; i < t->geometry.num_ways; ++ i)
+            {
+                if (set[i].time < set[victim].time)
+                {
+                    victim = i;
+                }
+            }
+            return victim;
+        }
+        case TLB_PLRU:
+            return plru_victim(t->plru[index], t->geometry.num_ways);
+        default:
+            assert(0);
+            return 0;
+    }
+}
+
+// the way of the line of the page size hit in the set, -1 if missed
+static int probe_set(tlb_cache_t *t, tlb_cacheline_t *set, int shift, uint64_t tag, int *free_way)
+{
+    for (int i = 0; i < t->geometry.num_ways; ++ i){
         
-        tlb_cacheline_t *line = &set->lines[i];
+        tlb_cacheline_t *line = &set[i];
 
         if (line->valid == 0){
-            *free_tlb_line_index = i;
+            *free_way = i;
         }
 
-        if (line->tag == vaddr.tlbt &&
+        if (line->tag == tag &&
+            line->shift == shift &&
+            line->asid == cpu_controls.asid &&
             line->valid == 1){
-            // TLB read hit
-            *paddr_value_ptr = line->ppn;
-            return 1;
+            return i;
         }
     }
-
-    // TLB read miss
-    *paddr_value_ptr = NULL;
-    return 0;
+    return -1;
 }
 
+// return the page shift of the line hit, 0 if missed
+// the free way is of the set of 4 KB pages
+static int read_tlb(tlb_cache_t *t, uint64_t vaddr_value, uint64_t *paddr_value_ptr, int *free_tlb_line_index){
+    tlb_stat_t *stat = &(t->stat[cpu_controls.asid]);
+    int counted = machine->sim_mode == SIM_DETAIL;
+    *free_tlb_line_index = -1;
 
-static int write_tlb(uint64_t vaddr_value, uint64_t paddr_value, int free_tlb_line_index){
-    address_t vaddr = {
-        .address_value = vaddr_value
-    };
-
-    address_t paddr = {
-        .address_value = paddr_value
-    };
+    if (counted)
+    {
+        // the sets of the page sizes are probed in parallel
+        stat->cycle += t->geometry.latency;
+    }
 
-    tlb_cacheset_t *set = &mmu_tlb.sets[vaddr.tlbi];
+    for (int k = 0; k < NUM_PAGE_SIZE; ++ k){
+        if (k > 0 && ((t->sizes >> k) & 1) == 0){
+            continue;
+        }
 
-    if (0 <= free_tlb_line_index && free_tlb_line_index < NUM_TLB_CACHE_LINE_PER_SET)
-    {
-        tlb_cacheline_t *line = &set->lines[free_tlb_line_index];
+        int shift = page_shift[k];
+        uint64_t tag = vaddr_value >> shift;
+        int index;
+        tlb_cacheline_t *set = tlb_set(t, tag, &index);
+        int free_way = -1;
+        int way = probe_set(t, set, shift, tag, &free_way);
+        if (k == 0){
+            *free_tlb_line_index = free_way;
+        }
 
-        line->valid = 1;
-        line->ppn = paddr.ppn;
-        line->tag = vaddr.tlbt;
+        if (way >= 0){
+            // TLB read hit
+            touch_line(t, index, way);
+            stat->hit += counted;
 
-        return 1;
+            // the page of the line and the offset of the address
+            uint64_t offset = vaddr_value & (((uint64_t)1 << shift) - 1);
+            *paddr_value_ptr = (set[way].ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + offset;
+            return shift;
+        }
     }
 
-    // no free TLB cache line, select one RANDOM victim
-    int random_victim_index = random() % NUM_TLB_CACHE_LINE_PER_SET;
+    // TLB read miss
+    stat->miss += counted;
+    *paddr_value_ptr = 0;
+    return 0;
+}
+
+
+static int write_tlb(tlb_cache_t *t, uint64_t vaddr_value, uint64_t paddr_value, int shift, int free_tlb_line_index){
+    uint64_t tag = vaddr_value >> shift;
+    int index;
+    tlb_cacheline_t *set = tlb_set(t, tag, &index);
 
-    tlb_cacheline_t *line = &set->lines[random_victim_index];
+    int way = free_tlb_line_index;
+    if (shift != PAGE_SHIFT_4K)
+    {
+        // the free way is of another set
+        way = -1;
+        for (int i = 0; i < t->geometry.num_ways; ++ i)
+        {
+            if (set[i].valid == 0)
+            {
+                way = i;
+                break;
+            }
+        }
+    }
+    if (way < 0 || way >= t->geometry.num_ways)
+    {
+        // no free TLB cache line, select one victim by the policy
+        way = select_victim(t, index, set);
+        if (machine->sim_mode == SIM_DETAIL)
+        {
+            t->stat[set[way].asid].eviction += 1;
+        }
+    }
 
+    tlb_cacheline_t *line = &set[way];
     line->valid = 1;
-    line->ppn = paddr.ppn;
-    line->tag = vaddr.tlbt;
+    line->shift = shift;
+    line->asid = cpu_controls.asid;
+    line->ppn = (paddr_value >> shift) << (shift - PHYSICAL_PAGE_OFFSET_LENGTH);
+    line->tag = tag;
+    touch_line(t, index, way);
+    t->sizes |= 1 << size_of_shift(shift);
 
     return 1;
 }
-
-
@@ -0,0 +1,218 @@
+/* BCST - Introduction to Computer Systems
+ * Author:      yangminz@outlook.com
+ * Github:      https://github.com/yangminz/bcst_csapp
+ * Bilibili:    https://space.bilibili.com/4564101
+ * Zhihu:       https://www.zhihu.com/people/zhao-yang-min
+ * This project (code repository and videos) is exclusively owned by yangminz
+ * and shall not be used for commercial and profitting purpose
+ * without yangminz's permission.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "header/cpu.h"
+#include "header/memory.h"
+#include "header/common.h"
+#include "header/machine.h"
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+/*======================================*/
+/*      guest execution profiler        */
+/*======================================*/
+
+// The run loop counts the retired instructions and the host cycles
+// into the flat arrays below, declared in cpu.h (-DUSE_PROFILE).
+// The instruction is counted by the slot of its physical address,
+// and the cost by the kind of its handler, so the hot path only
+// adds to the arrays. Everything else is done by the report at exit.
+
+#define PROFILE_NUM_REPORT (16)
+
+uint64_t profile_inst_count[PROFILE_NUM_SLOT];
+uint64_t profile_inst_rip[PROFILE_NUM_SLOT];
+uint64_t profile_block_count[PROFILE_NUM_SLOT];
+uint64_t profile_block_cycles[PROFILE_NUM_SLOT];
+uint64_t profile_block_rip[PROFILE_NUM_SLOT];
+uint64_t profile_kind_count[NUM_PROFILE_KIND];
+uint64_t profile_kind_cycles[NUM_PROFILE_KIND];
+uint64_t profile_clock_last;
+uint64_t profile_interrupt_vector;
+
+static int profile_started = 0;
+
+// for the conversion from host cycles to nanoseconds
+static uint64_t start_clock = 0;
+static uint64_t start_ns = 0;
+
+static const char *kind_name[NUM_PROFILE_KIND] =
+{
+    "mov",
+    "push",
+    "pop",
+    "leave",
+    "call",
+    "ret",
+    "add",
+    "sub",
+    "cmp",
+    "jne",
+    "jmp",
+    "lea",
+    "int",
+    "nop",
+    "dispatch",
+    "fused",
+    "jit",
+    "page fault",
+    "syscall",
+    "timer",
+};
+
+static uint64_t host_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t profile_clock()
+{
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return host_ns();
+#endif
+}
+
+void profile_start()
+{
+    if (profile_started == 0)
+    {
+        profile_started = 1;
+        start_clock = profile_clock();
+        start_ns = host_ns();
+        atexit(&profile_report);
+    }
+    // the time between runs is not counted
+    profile_clock_last = profile_clock();
+}
+
+// the slots sorted by the counter, the largest first
+static const uint64_t *sort_key = NULL;
+
+static int compare_slot(const void *a, const void *b)
+{
+    uint64_t x = sort_key[*(const int *)a];
+    uint64_t y = sort_key[*(const int *)b];
+    if (x == y)
+    {
+        return 0;
+    }
+    return x < y ? 1 : -1;
+}
+
+static int sort_slots(const uint64_t *key, int num, int *slots)
+{
+    int count = 0;
+    for (int i = 0; i < num; ++ i)
+    {
+        if (key[i] != 0)
+        {
+            slots[count] = i;
+            count += 1;
+        }
+    }
+    sort_key = key;
+    qsort(slots, count, sizeof(int), &compare_slot);
+    return count;
+}
+
+void profile_report()
+{
+    if (profile_started == 0)
+    {
+        return;
+    }
+
+    // cycles to nanoseconds
+    uint64_t cycles = profile_clock() - start_clock;
+    double ns_per_cycle = 1.0;
+    if (cycles != 0)
+    {
+        ns_per_cycle = (double)(host_ns() - start_ns) / (double)cycles;
+    }
+
+    uint64_t retired = 0;
+    for (int i = 0; i < PROFILE_NUM_SLOT; ++ i)
+    {
+        retired += profile_inst_count[i];
+    }
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_PROFILE_KIND; ++ i)
+    {
+        total += profile_kind_cycles[i];
+    }
+    if (retired == 0 || total == 0)
+    {
+        return;
+    }
+
+    static int slots[PROFILE_NUM_SLOT];
+
+    printf("\n======== profile: %lu instructions, %.0f us ========\n",
+        retired, total * ns_per_cycle / 1000.0);
+
+    // hot PCs
+    int count = sort_slots(profile_inst_count, PROFILE_NUM_SLOT, slots);
+    printf("\nhot PC\n%-18s %-8s %-10s %12s %8s\n",
+        "rip", "paddr", "opcode", "retired", "%");
+    for (int i = 0; i < count && i < PROFILE_NUM_REPORT; ++ i)
+    {
+        int s = slots[i];
+        uint64_t paddr = (uint64_t)s * INSTRUCTION_SIZE;
+        // byte 0 of the binary encoding
+        uint8_t opcode = pm[paddr];
+        printf("%-18lx %-8lx %-10s %12lu %7.2f%%\n",
+            profile_inst_rip[s], paddr,
+            opcode < NUM_INSTRTYPE ? kind_name[opcode] : "?",
+            profile_inst_count[s],
+            100.0 * profile_inst_count[s] / retired);
+    }
+
+    // hot blocks, by the host time
+    count = sort_slots(profile_block_cycles, PROFILE_NUM_SLOT, slots);
+    printf("\nhot block\n%-18s %-8s %12s %12s %10s %8s\n",
+        "rip", "paddr", "entered", "ns", "ns/enter", "%");
+    for (int i = 0; i < count && i < PROFILE_NUM_REPORT; ++ i)
+    {
+        int s = slots[i];
+        double ns = profile_block_cycles[s] * ns_per_cycle;
+        uint64_t entered = profile_block_count[s];
+        printf("%-18lx %-8lx %12lu %12.0f %10.1f %7.2f%%\n",
+            profile_block_rip[s], (uint64_t)s * INSTRUCTION_SIZE,
+            entered, ns,
+            entered == 0 ? 0.0 : ns / entered,
+            100.0 * profile_block_cycles[s] / total);
+    }
+
+    // cost of each kind of handler
+    int kinds[NUM_PROFILE_KIND];
+    count = sort_slots(profile_kind_cycles, NUM_PROFILE_KIND, kinds);
+    printf("\ncost\n%-12s %12s %12s %10s %8s\n",
+        "kind", "count", "ns", "ns/each", "%");
+    for (int i = 0; i < count; ++ i)
+    {
+        int k = kinds[i];
+        double ns = profile_kind_cycles[k] * ns_per_cycle;
+        printf("%-12s %12lu %12.0f %10.1f %7.2f%%\n",
+            kind_name[k], profile_kind_count[k], ns,
+            profile_kind_count[k] == 0 ? 0.0 : ns / profile_kind_count[k],
+            100.0 * profile_kind_cycles[k] / total);
+    }
+}
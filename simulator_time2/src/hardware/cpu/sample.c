@@ -0,0 +1,241 @@
+/* BCST - Introduction to Computer Systems
+ * Author:      yangminz@outlook.com
+ * Github:      https://github.com/yangminz/bcst_csapp
+ * Bilibili:    https://space.bilibili.com/4564101
+ * Zhihu:       https://www.zhihu.com/people/zhao-yang-min
+ * This project (code repository and videos) is exclusively owned by yangminz
+ * and shall not be used for commercial and profitting purpose
+ * without yangminz's permission.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header/cpu.h"
+#include "header/memory.h"
+#include "header/machine.h"
+
+/*======================================*/
+/*      sampled simulation              */
+/*======================================*/
+
+// SMARTS: the statistics of a long run are estimated by short windows
+// of detailed simulation taken systematically, e.g. 1000 instructions
+// every 1000000. Each period of `period` instructions is
+//
+//      | SIM_FAST ........................ | SIM_WARMUP | SIM_DETAIL |
+//                                                  warmup      window
+//
+// The windows are independent samples, so the mean of the windows
+// has a confidence interval by the central limit theorem.
+// The phases are switched by the events of current core.
+
+// from sram.c
+void sram_cache_flush();
+
+struct SAMPLE_STATE
+{
+    uint64_t period;
+    uint64_t warmup;
+    uint64_t window;
+
+    // time of the core when sampling starts
+    uint64_t start_time;
+    // the counters of all cores when current window starts
+    uint64_t window_time;
+    uint64_t window_count[NUM_SIM_COUNTER];
+
+    // of each metric over the windows
+    uint64_t num_window;
+    double sum[NUM_SAMPLE_METRIC];
+    double sum_square[NUM_SAMPLE_METRIC];
+};
+
+static inline struct SAMPLE_STATE *sample_state()
+{
+    if (machine->sample == NULL)
+    {
+        machine->sample = machine_calloc(sizeof(struct SAMPLE_STATE));
+    }
+    return machine->sample;
+}
+
+void sim_set_mode(sim_mode_t mode)
+{
+    if (mode == SIM_FAST && machine->sim_mode != SIM_FAST)
+    {
+        // DRAM and page table become the only copy
+#ifdef USE_SRAM_CACHE
+        sram_cache_flush();
+#endif
+        tlb_flush();
+    }
+    machine->sim_mode = mode;
+}
+
+static void sum_counters(uint64_t *count)
+{
+    memset(count, 0, sizeof(uint64_t) * NUM_SIM_COUNTER);
+    for (int i = 0; i < machine->num_cores; ++ i)
+    {
+        for (int j = 0; j < NUM_SIM_COUNTER; ++ j)
+        {
+            count[j] += machine->cores[i].sim_count[j];
+        }
+    }
+}
+
+static double ratio(uint64_t x, uint64_t y)
+{
+    return y == 0 ? 0.0 : (double)x / (double)y;
+}
+
+static void window_end(struct SAMPLE_STATE *s)
+{
+    uint64_t count[NUM_SIM_COUNTER];
+    sum_counters(count);
+    for (int j = 0; j < NUM_SIM_COUNTER; ++ j)
+    {
+        count[j] -= s->window_count[j];
+    }
+    uint64_t inst = global_time - s->window_time;
+
+    double metric[NUM_SAMPLE_METRIC] =
+    {
+        [SAMPLE_CACHE_MISS_RATE]    = ratio(count[SIM_CACHE_MISS], count[SIM_CACHE_ACCESS]),
+        [SAMPLE_CACHE_MPKI]         = 1000.0 * ratio(count[SIM_CACHE_MISS], inst),
+        [SAMPLE_TLB_MISS_RATE]      = ratio(count[SIM_TLB_MISS], count[SIM_TLB_ACCESS]),
+        [SAMPLE_TLB_MPKI]           = 1000.0 * ratio(count[SIM_TLB_MISS], inst),
+    };
+    for (int k = 0; k < NUM_SAMPLE_METRIC; ++ k)
+    {
+        s->sum[k] += metric[k];
+        s->sum_square[k] += metric[k] * metric[k];
+    }
+    s->num_window += 1;
+}
+
+// data is the phase to enter
+static void sample_event(uint64_t data)
+{
+    struct SAMPLE_STATE *s = sample_state();
+    switch ((sim_mode_t)data)
+    {
+        case SIM_WARMUP:
+            sim_set_mode(SIM_WARMUP);
+            event_post(global_time + s->warmup, &sample_event, SIM_DETAIL);
+            return;
+        case SIM_DETAIL:
+            sim_set_mode(SIM_DETAIL);
+            s->window_time = global_time;
+            sum_counters(s->window_count);
+            event_post(global_time + s->window, &sample_event, SIM_FAST);
+            return;
+        case SIM_FAST:
+            window_end(s);
+            sim_set_mode(SIM_FAST);
+            event_post(global_time + s->period - s->warmup - s->window, &sample_event, SIM_WARMUP);
+            return;
+        default:
+            assert(0);
+    }
+}
+
+void sample_start(uint64_t period, uint64_t warmup, uint64_t window)
+{
+    assert(window > 0);
+    assert(warmup + window <= period);
+
+    sample_stop();
+
+    struct SAMPLE_STATE *s = sample_state();
+    memset(s, 0, sizeof(struct SAMPLE_STATE));
+    s->period = period;
+    s->warmup = warmup;
+    s->window = window;
+    s->start_time = global_time;
+
+    sim_set_mode(SIM_FAST);
+    event_post(global_time + period - warmup - window, &sample_event, SIM_WARMUP);
+}
+
+void sample_stop()
+{
+    event_cancel(&sample_event);
+    sim_set_mode(SIM_DETAIL);
+}
+
+uint64_t sample_num_window()
+{
+    return sample_state()->num_window;
+}
+
+// Newton's method, enough for the confidence interval
+static double square_root(double x)
+{
+    if (x <= 0.0)
+    {
+        return 0.0;
+    }
+    double r = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 64; ++ i)
+    {
+        r = 0.5 * (r + x / r);
+    }
+    return r;
+}
+
+double sample_mean(sample_metric_t metric, double *ci95)
+{
+    assert(0 <= metric && metric < NUM_SAMPLE_METRIC);
+
+    struct SAMPLE_STATE *s = sample_state();
+    uint64_t n = s->num_window;
+    double mean = 0.0;
+    double half = 0.0;
+    if (n > 0)
+    {
+        mean = s->sum[metric] / n;
+    }
+    if (n > 1)
+    {
+        // sample variance of the windows
+        double var = (s->sum_square[metric] - n * mean * mean) / (n - 1);
+        half = 1.96 * square_root(var / n);
+    }
+    if (ci95 != NULL)
+    {
+        *ci95 = half;
+    }
+    return mean;
+}
+
+void sample_report()
+{
+    const char *name[NUM_SAMPLE_METRIC] =
+    {
+        "cache miss rate",
+        "cache MPKI",
+        "TLB miss rate",
+        "TLB MPKI",
+    };
+
+    struct SAMPLE_STATE *s = sample_state();
+    uint64_t inst = global_time - s->start_time;
+    printf("\n======== sampling: %lu windows of %lu in %lu instructions ========\n",
+        s->num_window, s->window, inst);
+    for (int k = 0; k < NUM_SAMPLE_METRIC; ++ k)
+    {
+        double ci = 0.0;
+        double mean = sample_mean(k, &ci);
+        printf("%-16s %12.4f +- %-12.4f\n", name[k], mean, ci);
+    }
+
+    // extrapolated to the whole run
+    double ci = 0.0;
+    double mpki = sample_mean(SAMPLE_CACHE_MPKI, &ci);
+    printf("cache misses     %12.0f +- %-12.0f\n", mpki * inst / 1000.0, ci * inst / 1000.0);
+    mpki = sample_mean(SAMPLE_TLB_MPKI, &ci);
+    printf("TLB misses       %12.0f +- %-12.0f\n", mpki * inst / 1000.0, ci * inst / 1000.0);
+}
@@ -1,5 +1,6 @@
 #include "../../header/address.h"
 #include "../../header/memory.h"
+#include "../../header/machine.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <assert.h>
@@ -42,7 +43,51 @@ typedef struct
     sram_cacheset_t sets[(1 << SRAM_CACHE_INDEX_LENGTH)];
 } sram_cache_t;
 
-static sram_cache_t cache;
+// the cache of each machine, shared by the cores
+struct SRAM_STATE
+{
+    sram_cache_t cache;
+};
+
+static inline sram_cache_t *sram_cache()
+{
+    if (machine->sram == NULL)
+    {
+        machine->sram = machine_calloc(sizeof(struct SRAM_STATE));
+    }
+    return &(machine->sram->cache);
+}
+
+// the physical address of the cached block
+static uint64_t line_paddr(sram_cacheline_t *line, uint64_t ci)
+{
+    address_t paddr = {
+        .co = 0,
+        .ci = ci,
+        .ct = line->tag,
+    };
+    return paddr.paddr_value;
+}
+
+// write back all dirty lines and invalidate the cache,
+// so DRAM can be accessed directly
+void sram_cache_flush()
+{
+    for (int i = 0; i < (1 << SRAM_CACHE_INDEX_LENGTH); ++ i)
+    {
+        sram_cacheset_t *set = &(sram_cache()->sets[i]);
+        for (int j = 0; j < NUM_CACHE_LINE_PER_SET; ++ j)
+        {
+            sram_cacheline_t *line = &(set->lines[j]);
+            if (line->state == CACHE_LINE_DIRTY)
+            {
+                bus_write_cacheline(line_paddr(line, i), line->block);
+            }
+            line->state = CACHE_LINE_INVALID;
+            line->time = 0;
+        }
+    }
+}
 
 
 
@@ -54,7 +99,7 @@ uint8_t sram_cache_read(uint64_t paddr_value){
     };
 
 
-    sram_cacheset_t *set = &cache.sets[paddr.ci];
+    sram_cacheset_t *set = &(sram_cache()->sets[paddr.ci]);
 
     sram_cacheline_t *victim = NULL;
     sram_cacheline_t *invalid = NULL;
@@ -92,6 +137,7 @@ uint8_t sram_cache_read(uint64_t paddr_value){
     }
 
     // cache miss: load from memory
+    SIM_COUNT(SIM_CACHE_MISS);
 
 
     //try to find one free cache line
@@ -113,7 +159,7 @@ uint8_t sram_cache_read(uint64_t paddr_value){
     // no free cache line, use LRU policy
     if (victim->state == CACHE_LINE_DIRTY){
         // write back the dirty line to dram
-        bus_write_cacheline(paddr.paddr_value, victim->block);
+        bus_write_cacheline(line_paddr(victim, paddr.ci), victim->block);
 
         // update state
         victim->state = CACHE_LINE_INVALID;
@@ -145,7 +191,7 @@ void sram_cache_write(uint64_t paddr_value, uint8_t data){
         .paddr_value = paddr_value,
     };
 
-    sram_cacheset_t *set = &(cache.sets[paddr.ci]);
+    sram_cacheset_t *set = &(sram_cache()->sets[paddr.ci]);
     sram_cacheline_t *victim = NULL;
     sram_cacheline_t *invalid = NULL; // for write-allocate
     int max_time = -1;
@@ -187,6 +233,7 @@ void sram_cache_write(uint64_t paddr_value, uint8_t data){
     }
 
     // cache miss: load from memory
+    SIM_COUNT(SIM_CACHE_MISS);
 
     //write-allocate
 
@@ -212,7 +259,7 @@ void sram_cache_write(uint64_t paddr_value, uint8_t data){
     // no free cache line, use LRU policy
     if (victim->state == CACHE_LINE_DIRTY){
         // write back the dirty line to dram
-        bus_write_cacheline(paddr.paddr_value, victim->block);
+        bus_write_cacheline(line_paddr(victim, paddr.ci), victim->block);
 
         // update state
         victim->state = CACHE_LINE_INVALID;
@@ -246,7 +293,7 @@ void print_cache()
     {
         printf("set %x: [ ", i);
 
-        sram_cacheset_t set = cache.sets[i];
+        sram_cacheset_t set = sram_cache()->sets[i];
 
         for (int j = 0; j < NUM_CACHE_LINE_PER_SET; ++ j)
         {
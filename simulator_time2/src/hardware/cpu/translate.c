@@ -0,0 +1,261 @@
+/* BCST - Introduction to Computer Systems
+ * Author:      yangminz@outlook.com
+ * Github:      https://github.com/yangminz/bcst_csapp
+ * Bilibili:    https://space.bilibili.com/4564101
+ * Zhihu:       https://www.zhihu.com/people/zhao-yang-min
+ * This project (code repository and videos) is exclusively owned by yangminz
+ * and shall not be used for commercial and profitting purpose
+ * without yangminz's permission.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header/cpu.h"
+#include "header/memory.h"
+#include "header/common.h"
+#include "header/instruction.h"
+#include "header/address.h"
+#include "header/machine.h"
+
+/*======================================*/
+/*      basic block translation         */
+/*======================================*/
+
+// A basic block is a straight-line run of instructions.
+// Only the last instruction can change RIP other than the sequential way:
+//      jmp, jne, call, ret, int
+// The block is translated once from the decoded instructions,
+// then the CPU executes the whole block in a tight loop.
+// Blocks are chained by their successor virtual addresses,
+// so hot loops do not go back to the fetch & decode path.
+
+// from inst.c
+inst_t *decode_instruction(uint64_t pc_paddr);
+
+// from isa.c
+void push_r_handler(od_t *src_od, od_t *dst_od);
+void mov_r_r_handler(od_t *src_od, od_t *dst_od);
+void cmp_i_m_handler(od_t *src_od, od_t *dst_od);
+void jne_i_handler(od_t *src_od, od_t *dst_od);
+void jne_m_handler(od_t *src_od, od_t *dst_od);
+void leave_handler(od_t *src_od, od_t *dst_od);
+void ret_handler(od_t *src_od, od_t *dst_od);
+void mov_m_r_handler(od_t *src_od, od_t *dst_od);
+void add_r_r_handler(od_t *src_od, od_t *dst_od);
+int push_mov_fused(inst_t *inst);
+int cmp_jne_fused(inst_t *inst);
+int leave_ret_fused(inst_t *inst);
+int mov_add_fused(inst_t *inst);
+
+// blocks are allocated from the pool, the pool is flushed when used up
+#define MAX_NUM_BLOCK (256)
+
+struct BLOCK_STATE
+{
+    block_t pool[MAX_NUM_BLOCK];
+    int pool_top;
+
+    // the block starting from each physical address of instruction
+    block_t *table[PHYSICAL_MEMORY_SPACE / INSTRUCTION_SIZE];
+
+    // the number of blocks in each physical page
+    int count[MAX_NUM_PHYSICAL_PAGE];
+};
+
+// the blocks of each core
+static inline struct BLOCK_STATE *block_state()
+{
+    if (active_core->block == NULL)
+    {
+        active_core->block = machine_calloc(sizeof(struct BLOCK_STATE));
+    }
+    return active_core->block;
+}
+#define block_pool      (block_state()->pool)
+#define block_pool_top  (block_state()->pool_top)
+#define block_table     (block_state()->table)
+#define block_count     (block_state()->count)
+// increased when any block is removed
+// a chain is broken when its epoch is not the current one
+#define chain_epoch     (active_core->block_epoch)
+
+static int is_block_end(inst_op_t opcode)
+{
+    switch (opcode)
+    {
+        case INST_JMP:
+        case INST_JNE:
+        case INST_CALL:
+        case INST_RET:
+        case INST_INT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void block_cache_flush()
+{
+    memset(block_table, 0, sizeof(block_table));
+    memset(block_count, 0, sizeof(block_count));
+    block_pool_top = 0;
+    chain_epoch += 1;
+}
+
+// the pairs of handlers to be fused into superinstructions
+static struct
+{
+    op_t        first;
+    op_t        second;
+    fused_op_t  fused;
+    fusion_t    fusion;
+} fusion_table[] = 
+{
+    {&push_r_handler,   &mov_r_r_handler,   &push_mov_fused,    FUSION_PUSH_MOV     },
+    {&cmp_i_m_handler,  &jne_i_handler,     &cmp_jne_fused,     FUSION_CMP_JNE      },
+    {&cmp_i_m_handler,  &jne_m_handler,     &cmp_jne_fused,     FUSION_CMP_JNE      },
+    {&leave_handler,    &ret_handler,       &leave_ret_fused,   FUSION_LEAVE_RET    },
+    {&mov_m_r_handler,  &add_r_r_handler,   &mov_add_fused,     FUSION_MOV_ADD      },
+};
+
+// peephole pass: mark the first instruction of each fused pair
+// the second instruction is kept, so the pair can still be executed
+// one by one, e.g. when an event is due between them
+static void fuse_block(block_t *b)
+{
+    for (int i = 0; i + 1 < b->num_inst; ++ i)
+    {
+        inst_t *inst = &(b->inst[i]);
+        for (int k = 0; k < sizeof(fusion_table) / sizeof(fusion_table[0]); ++ k)
+        {
+            if (inst[0].op == fusion_table[k].first &&
+                inst[1].op == fusion_table[k].second)
+            {
+                inst->fused = fusion_table[k].fused;
+                inst->fusion = fusion_table[k].fusion;
+                break;
+            }
+        }
+    }
+}
+
+// translate the block starting from physical address
+static block_t *translate_physical(uint64_t pc_paddr)
+{
+    if (block_pool_top >= MAX_NUM_BLOCK)
+    {
+        block_cache_flush();
+    }
+
+    block_t *b = &block_pool[block_pool_top];
+    block_pool_top += 1;
+
+    b->paddr = pc_paddr;
+    b->num_inst = 0;
+    for (int i = 0; i < NUM_BLOCK_SUCCESSOR; ++ i)
+    {
+        b->successor[i].block = NULL;
+    }
+    b->victim = 0;
+    b->exec_count = 0;
+    b->jit_code = NULL;
+
+    // the block never crosses the page boundary,
+    // the next virtual page may be mapped to any physical page
+    uint64_t paddr = pc_paddr;
+    uint64_t page_end = ((pc_paddr >> PHYSICAL_PAGE_OFFSET_LENGTH) + 1) << PHYSICAL_PAGE_OFFSET_LENGTH;
+    while (b->num_inst < MAX_BLOCK_INSTRUCTION && paddr < page_end)
+    {
+        inst_t *inst = decode_instruction(paddr);
+        b->inst[b->num_inst] = *inst;
+        b->num_inst += 1;
+        paddr += INSTRUCTION_SIZE;
+
+        if (is_block_end(inst->opcode) == 1)
+        {
+            break;
+        }
+    }
+
+    fuse_block(b);
+
+    block_table[pc_paddr / INSTRUCTION_SIZE] = b;
+    block_count[pc_paddr >> PHYSICAL_PAGE_OFFSET_LENGTH] += 1;
+    return b;
+}
+
+// get the block starting from the virtual address
+// address translation happens here, so page fault may be triggered
+block_t *translate_block(uint64_t vaddr)
+{
+    uint64_t pc_paddr = va2pa_fetch(vaddr);
+    assert(pc_paddr % INSTRUCTION_SIZE == 0);
+    assert(pc_paddr < PHYSICAL_MEMORY_SPACE);
+
+    block_t *b = block_table[pc_paddr / INSTRUCTION_SIZE];
+    if (b != NULL)
+    {
+        return b;
+    }
+    return translate_physical(pc_paddr);
+}
+
+// get the next block of `b` after it is executed
+// the chained successor is used when the address space is not changed
+block_t *block_successor(block_t *b, uint64_t vaddr)
+{
+    for (int i = 0; i < NUM_BLOCK_SUCCESSOR; ++ i)
+    {
+        block_chain_t *c = &(b->successor[i]);
+        if (c->block != NULL &&
+            c->vaddr == vaddr &&
+            c->cr3 == cpu_controls.cr3 &&
+            c->epoch == chain_epoch)
+        {
+            return c->block;
+        }
+    }
+
+    // not chained: translate and chain it
+    uint64_t epoch = chain_epoch;
+    block_t *next = translate_block(vaddr);
+
+    // the pool may be flushed by translation, then `b` is not valid
+    if (epoch == chain_epoch)
+    {
+        block_chain_t *c = &(b->successor[b->victim]);
+        c->vaddr = vaddr;
+        c->cr3 = cpu_controls.cr3;
+        c->epoch = chain_epoch;
+        c->block = next;
+        b->victim = (b->victim + 1) % NUM_BLOCK_SUCCESSOR;
+    }
+    return next;
+}
+
+// remove all blocks in the physical page
+// called when the code in the page is written
+void block_cache_invalidate(uint64_t ppn)
+{
+    if (ppn >= MAX_NUM_PHYSICAL_PAGE || block_count[ppn] == 0)
+    {
+        return;
+    }
+
+    int start = (ppn << PHYSICAL_PAGE_OFFSET_LENGTH) / INSTRUCTION_SIZE;
+    for (int i = 0; i < PAGE_SIZE / INSTRUCTION_SIZE; ++ i)
+    {
+        if (block_table[start + i] != NULL)
+        {
+            // the host code compiled from the old code is not used again
+            block_table[start + i]->jit_code = NULL;
+        }
+        block_table[start + i] = NULL;
+    }
+    block_count[ppn] = 0;
+
+    // the chains to the removed blocks are broken
+    chain_epoch += 1;
+}
@@ -1,16 +1,159 @@
 // DRAM : Dynamic Random Access Memory
 #include <string.h>
 #include <assert.h>
+#include <stdlib.h>
 #include "../../header/cpu.h"
 #include "../../header/memory.h"
 #include "../../header/common.h"
 #include "../../header/address.h"
+#include "../../header/machine.h"
 
 uint8_t sram_cache_read(uint64_t paddr);
 void sram_cache_write(uint64_t paddr, uint8_t data);
 
+// decoded instructions of the written physical page are not valid anymore
+void decoded_cache_invalidate(uint64_t paddr);
+
+// from inst.c
+void assemble_instruction(const char *inst_str, uint8_t *code);
+
 // #define SRAM_CACHE_SETTING 0  //  开关cashe功能，cache功能以后写
 
+#if defined(USE_PARALLEL) && defined(USE_SRAM_CACHE)
+#error "the shared SRAM cache is not supported by the parallel run"
+#endif
+
+/*  Stores of the parallel run (-DUSE_PARALLEL)
+ *
+ *  The cores run on host threads within a quantum. The stores of a core
+ *  are buffered, and the core reads its own stores over the DRAM.
+ *  At the barrier, the buffers are written to DRAM core by core, in the
+ *  order of core id. So the result does not depend on the host threads.
+ */
+
+// 64-byte lines with buffered stores
+#define STORE_LINE_LENGTH (6)
+#define NUM_STORE_LINE (PHYSICAL_MEMORY_SPACE >> STORE_LINE_LENGTH)
+
+typedef struct
+{
+    uint64_t paddr;
+    uint64_t data;
+} store_t;
+
+struct STORE_STATE
+{
+    int enabled;
+    store_t *stores;
+    uint64_t count;
+    uint64_t size;
+    uint8_t dirty[NUM_STORE_LINE];
+};
+
+static inline int store_buffered()
+{
+#ifdef USE_PARALLEL
+    return active_core->store != NULL && active_core->store->enabled == 1;
+#else
+    return 0;
+#endif
+}
+
+static void store_append(uint64_t paddr, uint64_t data)
+{
+    struct STORE_STATE *s = active_core->store;
+    if (s->count == s->size)
+    {
+        s->size = s->size == 0 ? 64 : s->size * 2;
+        s->stores = realloc(s->stores, s->size * sizeof(store_t));
+        assert(s->stores != NULL);
+    }
+    s->stores[s->count].paddr = paddr;
+    s->stores[s->count].data = data;
+    s->count += 1;
+
+    s->dirty[paddr >> STORE_LINE_LENGTH] = 1;
+    s->dirty[(paddr + 7) >> STORE_LINE_LENGTH] = 1;
+}
+
+// the buffered bytes in [paddr, paddr + 8) over the value from DRAM
+static uint64_t store_forward(uint64_t paddr, uint64_t val)
+{
+    struct STORE_STATE *s = active_core->store;
+    if (s->dirty[paddr >> STORE_LINE_LENGTH] == 0 &&
+        s->dirty[(paddr + 7) >> STORE_LINE_LENGTH] == 0)
+    {
+        return val;
+    }
+
+    // the later store overwrites the earlier one
+    for (uint64_t i = 0; i < s->count; ++ i)
+    {
+        store_t *t = &(s->stores[i]);
+        for (int b = 0; b < 8; ++ b)
+        {
+            uint64_t addr = t->paddr + b;
+            if (paddr <= addr && addr < paddr + 8)
+            {
+                int k = (addr - paddr) * 8;
+                val &= ~((uint64_t)0xff << k);
+                val |= ((t->data >> (b * 8)) & 0xff) << k;
+            }
+        }
+    }
+    return val;
+}
+
+// the stores of active core are buffered: in the quantum of parallel run
+int dram_buffered()
+{
+    return store_buffered();
+}
+
+// the stores of active core are buffered from now on
+void dram_buffer_begin()
+{
+    if (active_core->store == NULL)
+    {
+        active_core->store = machine_calloc(sizeof(struct STORE_STATE));
+    }
+    active_core->store->enabled = 1;
+}
+
+// write the buffered stores of the core to DRAM, in the order of stores
+void dram_buffer_commit(core_t *c)
+{
+    struct STORE_STATE *s = c->store;
+    if (s == NULL)
+    {
+        return;
+    }
+
+    // on behalf of the core, e.g. the decoded code of all cores is invalidated
+    core_t *self = active_core;
+    active_core = c;
+    s->enabled = 0;
+    for (uint64_t i = 0; i < s->count; ++ i)
+    {
+        cpu_write64bits_dram(s->stores[i].paddr, s->stores[i].data);
+    }
+    s->count = 0;
+    memset(s->dirty, 0, sizeof(s->dirty));
+    active_core = self;
+}
+
+// called by `machine_free`
+void dram_buffer_free(core_t *c)
+{
+    if (c->store == NULL)
+    {
+        return;
+    }
+    free(c->store->stores);
+    // the state is in the arena of the machine
+    c->store = NULL;
+}
+
 
 /*
     Be careful with the x86 little endian integer encoding
@@ -27,12 +170,16 @@ uint64_t cpu_read64bits_dram(uint64_t paddr){
     //try to load uint64_t from SRAM cache
     // little-endian
     
-    
-    for (int i = 0; i < 8; ++i){
-        val += (sram_cache_read(paddr + i) << (i * 8));
+    if (sim_detailed())
+    {
+        SIM_COUNT(SIM_CACHE_ACCESS);
+        for (int i = 0; i < 8; ++i){
+            val += ((uint64_t)sram_cache_read(paddr + i) << (i * 8));
+        }
+        return val;
     }
-    
-#else
+    // fast-forward: the cache is flushed, DRAM is up to date
+#endif
         
     // read from DRAM directly
     // little-endian
@@ -45,7 +192,11 @@ uint64_t cpu_read64bits_dram(uint64_t paddr){
     val += (((uint64_t)pm[paddr + 5]) << 40);
     val += (((uint64_t)pm[paddr + 6]) << 48);
     val += (((uint64_t)pm[paddr + 7]) << 56);
-#endif
+
+    if (store_buffered() == 1)
+    {
+        val = store_forward(paddr, val);
+    }
     
     return val;
 
@@ -55,17 +206,31 @@ uint64_t cpu_read64bits_dram(uint64_t paddr){
 
 void cpu_write64bits_dram(uint64_t paddr, uint64_t data){
 
+    if (store_buffered() == 1)
+    {
+        // written to DRAM at the barrier
+        store_append(paddr, data);
+        return;
+    }
+
+    // self-modifying code: the 8 bytes may cross the page boundary
+    decoded_cache_invalidate(paddr);
+    decoded_cache_invalidate(paddr + 7);
+
 #ifdef USE_SRAM_CACHE
         
     // try to write uint64_t to SRAM cache
     // little-endian
-    for (int i = 0; i < 8; ++i){
-        sram_cache_write(paddr + i, (data >> (i * 8)) & 0xff);
+    if (sim_detailed())
+    {
+        SIM_COUNT(SIM_CACHE_ACCESS);
+        for (int i = 0; i < 8; ++i){
+            sram_cache_write(paddr + i, (data >> (i * 8)) & 0xff);
+        }
+        return;
     }
-    return;
+#endif
 
-    
-#else
     // write to DRAM diretly
     // little-endian
     pm[paddr + 0] = (data >> 0) & 0xff;
@@ -76,15 +241,14 @@ void cpu_write64bits_dram(uint64_t paddr, uint64_t data){
     pm[paddr + 5] = (data >> 40) & 0xff;
     pm[paddr + 6] = (data >> 48) & 0xff;
     pm[paddr + 7] = (data >> 56) & 0xff;
-#endif
     
     
 }
 
-void cpu_readinst_dram(uint64_t paddr, char *buf){
+void cpu_readinst_dram(uint64_t paddr, uint8_t *buf){
 
-    for (int i = 0; i < MAX_INSTRUCTION_CHAR; ++i){
-        buf[i] = (char)pm[paddr + i];
+    for (int i = 0; i < INSTRUCTION_SIZE; ++i){
+        buf[i] = pm[paddr + i];
     }
 
 }
@@ -94,14 +258,14 @@ void cpu_writeinst_dram(uint64_t paddr, const char *str){
     int len = strlen(str);
     assert(len < MAX_INSTRUCTION_CHAR);
 
-    for (int i = 0; i < MAX_INSTRUCTION_CHAR; ++i){
-        
-        if (i < len){
-            pm[paddr + i] = (uint8_t)str[i];
-        }
-        else {
-            pm[paddr + i] = 0;
-        }
+    decoded_cache_invalidate(paddr);
+
+    // the text is assembled to the binary code in memory
+    uint8_t code[INSTRUCTION_SIZE];
+    assemble_instruction(str, code);
+
+    for (int i = 0; i < INSTRUCTION_SIZE; ++i){
+        pm[paddr + i] = code[i];
     }
 
 }
@@ -113,7 +277,7 @@ void cpu_writeinst_dram(uint64_t paddr, const char *str){
 void bus_read_cacheline(uint64_t paddr, uint8_t *block){
 
 
-    uint64_t dram_base = ((paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_TAG_LENGTH);
+    uint64_t dram_base = ((paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_OFFSET_LENGTH);
 
     for (int i = 0; i < (1 << SRAM_CACHE_OFFSET_LENGTH); ++i){
 
@@ -125,7 +289,7 @@ void bus_read_cacheline(uint64_t paddr, uint8_t *block){
 
 void bus_write_cacheline(uint64_t paddr, uint8_t *block){
 
-    uint64_t dram_base = ((paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_TAG_LENGTH);
+    uint64_t dram_base = ((paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_OFFSET_LENGTH);
 
     for (int i = 0; i < (1 << SRAM_CACHE_OFFSET_LENGTH); ++i){
 
@@ -17,9 +17,13 @@
 #include "header/memory.h"
 #include "header/common.h"
 #include "header/address.h"
+#include "header/machine.h"
 
 void set_pagemap_swapaddr(uint64_t ppn, uint64_t swap_address);
 
+// the physical frame gets new content, drop its decoded instructions
+void decoded_cache_invalidate(uint64_t paddr);
+
 // each swap file is swap page
 // each line of this swap page is one uint64
 #define SWAP_PAGE_FILE_LINES (512)
@@ -27,10 +31,15 @@ void set_pagemap_swapaddr(uint64_t ppn, uint64_t swap_address);
 
 // disk address counter
 static char *SWAP_FILE_DIRECTORY = "./files/swap";
-static uint64_t internal_swap_addr = SWAP_ADDRESS_MIN;
+// the counter is of the machine, so restored with it
+#define internal_swap_addr (machine->swap_top)
 
 uint64_t allocate_swappage(uint64_t ppn)
 {
+    if (internal_swap_addr < SWAP_ADDRESS_MIN)
+    {
+        internal_swap_addr = SWAP_ADDRESS_MIN;
+    }
     uint64_t saddr = internal_swap_addr++;
     
     char filename[128];
@@ -43,6 +52,7 @@ uint64_t allocate_swappage(uint64_t ppn)
     fclose(fw);
     uint64_t ppn_ppo = ppn << PHYSICAL_PAGE_OFFSET_LENGTH;
     memset(&pm[ppn_ppo], 0, PAGE_SIZE);
+    decoded_cache_invalidate(ppn_ppo);
     
     // Now the page is like swapped in from swap space. So:
     // saddr is stored on page_map
@@ -82,6 +92,7 @@ int swap_in(uint64_t saddr, uint64_t ppn)
         *((uint64_t *)(&pm[ppn_ppo + i * 8])) = string2uint(str);
     }
     fclose(fr);
+    decoded_cache_invalidate(ppn_ppo);
     return 1;
 }
 
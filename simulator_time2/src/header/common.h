@@ -50,6 +50,8 @@ uint64_t string2uint_range(const char *str, int start, int end);
 
 // commonly shared variables
 #define MAX_INSTRUCTION_CHAR (64)
+// size of the binary encoded instruction in memory
+#define INSTRUCTION_SIZE (16)
 
 /*======================================*/
 /*      wrap of the memory              */
@@ -17,6 +17,22 @@
 #include <stdlib.h>
 #include "header/instruction.h"
 
+// All states of the simulated machine are in `machine_t` (machine.h),
+// one host thread runs one core of the machine pointed by its `machine`.
+// The names below are the fields of the current core.
+struct MACHINE_STRUCT;
+struct CORE_STRUCT;
+extern __thread struct MACHINE_STRUCT *machine;
+extern __thread struct CORE_STRUCT *active_core;
+
+#define cpu_reg                 (active_core->reg)
+#define cpu_flags               (active_core->flags)
+#define cpu_pc                  (active_core->pc)
+#define tr_global_tss           (active_core->tss)
+#define cpu_controls            (active_core->controls)
+#define global_time             (active_core->time)
+#define mmu_vaddr_pagefault     (active_core->vaddr_pagefault)
+
 /*======================================*/
 /*      registers                       */
 /*======================================*/
@@ -193,7 +209,6 @@ typedef struct
         uint8_t  r15b;
     };
 } cpu_reg_t;
-cpu_reg_t cpu_reg;
 
 /*======================================*/
 /*      cpu core                        */
@@ -226,23 +241,42 @@ cpu_reg_t cpu_reg;
     test    test
 */
 
-// the 4 flags be a uint64_t in total
-typedef union
+// the last operation writing the flags
+typedef enum
+{
+    FLAGS_OP_NONE,      // the 4 flags are up to date
+    FLAGS_OP_ADD,       // dst + src
+    FLAGS_OP_SUB,       // dst - src
+} flags_op_t;
+
+typedef struct
 {
-    uint64_t __flags_value;
-    struct
-    {    
-        // carry flag: detect overflow for unsigned operations
-        uint16_t CF;
-        // zero flag: result is zero
-        uint16_t ZF;
-        // sign flag: result is negative: highest bit
-        uint16_t SF;
-        // overflow flag: detect overflow for signed operations
-        uint16_t OF;
-    };        
+    // the 4 flags be a uint64_t in total
+    union
+    {
+        uint64_t __flags_value;
+        struct
+        {    
+            // carry flag: detect overflow for unsigned operations
+            uint16_t CF;
+            // zero flag: result is zero
+            uint16_t ZF;
+            // sign flag: result is negative: highest bit
+            uint16_t SF;
+            // overflow flag: detect overflow for signed operations
+            uint16_t OF;
+        };
+    };
+
+    // lazy evaluation of the flags
+    // arithmetic instructions only record the operation, operands and result,
+    // most of them are overwritten before being read.
+    // the 4 flags are computed by `cpu_flags_materialize` when needed
+    flags_op_t  lazy_op;
+    uint64_t    lazy_src;
+    uint64_t    lazy_dst;
+    uint64_t    lazy_val;
 } cpu_flags_t;
-cpu_flags_t cpu_flags;
 
 // program counter or instruction pointer
 typedef union
@@ -250,7 +284,6 @@ typedef union
     uint64_t rip;
     uint32_t eip;
 } cpu_pc_t;
-cpu_pc_t cpu_pc;
 
 // we only use stack0 of TSS
 // This information is stored in main memory
@@ -264,7 +297,7 @@ typedef struct TSS_S0
 // Intel thinks that each process can have its own TSS.
 // But we can use only one TSS globally.
 // pointing to Task-State Segment (in main memory) of the current process
-tss_s0_t tr_global_tss;
+// `tr_global_tss`
 
 // control registers
 typedef struct
@@ -275,8 +308,8 @@ typedef struct
     uint64_t cr3;   // should be a 40-bit PPN for PGD in DRAM
                     // but we are using 48-bit virutal address on simulator's heap
                     // (by malloc())
+    uint64_t asid;  // PCID of CR3: the address space tag of the TLB lines
 } cpu_cr_t;
-cpu_cr_t cpu_controls;
 
 // move to common.h to be shared by linker
 // #define MAX_INSTRUCTION_CHAR 64
@@ -285,17 +318,146 @@ cpu_cr_t cpu_controls;
 // CPU's instruction cycle: execution of instructions
 void instruction_cycle();
 
+// execute at most max_instructions, return the number of retired ones
+uint64_t cpu_run(uint64_t max_instructions);
+
+// compute CF, ZF, SF, OF from the last arithmetic operation
+void cpu_flags_materialize();
+
+// print the hit counters of superinstructions
+void print_fusion_hit();
+
+// blocks executed `count` times are compiled to host code (-DUSE_JIT)
+void jit_set_threshold(uint64_t count);
+
+/*--------------------------------------*/
+// simulated-time events
+
+// time, the craft of god
+// one cycle for each instruction: `global_time`
+
+typedef void (*event_handler_t)(uint64_t data);
+
+// handle the event when global_time reaches the absolute time
+void event_post(uint64_t time, event_handler_t handler, uint64_t data);
+// remove all pending events of the handler
+void event_cancel(event_handler_t handler);
+// the time of the earliest pending event
+uint64_t event_deadline();
+// handle the events due, the handler may not return (interrupt)
+void event_dispatch();
+
+// local APIC timer: interrupt 0x81 for each period
+void timer_set_period(uint64_t period);
+void timer_start();
+void timer_stop();
+
+/*--------------------------------------*/
+// guest execution profiler (-DUSE_PROFILE)
+
+// one slot for each instruction in physical memory:
+// PHYSICAL_MEMORY_SPACE in memory.h, INSTRUCTION_SIZE in common.h
+#define PROFILE_NUM_SLOT (PHYSICAL_MEMORY_SPACE / INSTRUCTION_SIZE)
+
+// the kinds of cost, the first NUM_INSTRTYPE are the opcodes
+typedef enum
+{
+    PROFILE_DISPATCH = NUM_INSTRTYPE,   // fetch, decode and chain of blocks
+    PROFILE_FUSED,                      // superinstructions
+    PROFILE_JIT,                        // host code of hot blocks
+    PROFILE_PAGEFAULT,                  // interrupt 0x0e
+    PROFILE_SYSCALL,                    // interrupt 0x80
+    PROFILE_TIMER,                      // interrupt 0x81
+} profile_kind_t;
+#define NUM_PROFILE_KIND (NUM_INSTRTYPE + 6)
+
+// the counters are defined in profile.c
+// indexed by the slot of physical address, sized by PROFILE_NUM_SLOT
+extern uint64_t profile_inst_count[];
+extern uint64_t profile_inst_rip[];
+// indexed by the slot of the first instruction of block
+extern uint64_t profile_block_count[];
+extern uint64_t profile_block_cycles[];
+extern uint64_t profile_block_rip[];
+// indexed by `profile_kind_t`, in host CPU cycles
+extern uint64_t profile_kind_count[NUM_PROFILE_KIND];
+extern uint64_t profile_kind_cycles[NUM_PROFILE_KIND];
+
+// host cycles when the last cost is counted
+extern uint64_t profile_clock_last;
+// the vector of the last interrupt, whose cost is counted after longjmp
+extern uint64_t profile_interrupt_vector;
+
+// the clock of host CPU
+uint64_t profile_clock();
+// called when each `cpu_run` starts, the report is printed at exit
+void profile_start();
+// print the hot PCs, the hot blocks and the cost of each kind
+void profile_report();
+
 /*--------------------------------------*/
 // place the functions here because they requires the core_t type
 
 /*--------------------------------------*/
 // mmu functions
 
-uint64_t mmu_vaddr_pagefault;
+// the faulting virtual address: `mmu_vaddr_pagefault`
 
 // translate the virtual address to physical address in MMU
 // each MMU is owned by each core
 uint64_t va2pa(uint64_t vaddr);
+// the same for the instruction fetch, by the instruction TLB
+uint64_t va2pa_fetch(uint64_t vaddr);
+
+// the TLB lines are tagged by the ASID (PCID) of the address space,
+// so writing CR3 keeps the lines of the other processes.
+// ASID 0 is untagged: its lines are flushed by each CR3 write.
+#define MAX_NUM_ASID (4096)
+void mmu_write_cr3(uint64_t pgd, uint64_t asid);
+
+// invalidate the TLB lines of all cores
+void tlb_invlpg(uint64_t vaddr, uint64_t asid);
+void tlb_flush_asid(uint64_t asid);
+void tlb_flush();
+
+// the line replaced in a full set
+typedef enum
+{
+    TLB_RANDOM,
+    TLB_LRU,
+    TLB_PLRU,       // tree pseudo-LRU, the ways must be a power of 2
+} tlb_policy_t;
+
+// split L1 for the fetch and the data, backed by a unified L2
+typedef enum
+{
+    TLB_L1I,
+    TLB_L1D,
+    TLB_L2,
+    NUM_TLB_LEVEL,
+} tlb_level_t;
+
+// the level of each core has `num_sets` sets (a power of 2) of `num_ways`
+// lines, and costs `latency` cycles each lookup. By default, pseudo-LRU:
+//      L1I     16 x 8,     1 cycle
+//      L1D     16 x 4,     1 cycle
+//      L2      128 x 8,    7 cycles
+// The TLBs are flushed.
+void tlb_configure(tlb_level_t level, int num_sets, int num_ways, int latency, tlb_policy_t policy);
+
+// of each address space on all cores, counted in SIM_DETAIL
+typedef struct
+{
+    uint64_t hit;
+    uint64_t miss;
+    uint64_t eviction;  // the lines of the address space replaced
+    uint64_t cycle;     // latency of the lookups
+} tlb_stat_t;
+tlb_stat_t tlb_stat(tlb_level_t level, uint64_t asid);
+
+// the page walks that skipped `skipped` upper levels (0 - 3) by the
+// paging-structure caches, of all cores, counted in SIM_DETAIL
+uint64_t page_walk_count(int skipped);
 
 // end of include guard
 #endif
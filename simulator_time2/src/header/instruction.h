@@ -7,6 +7,25 @@
 /*      instruction set architecture    */
 /*======================================*/
 
+// operator number, also the opcode in binary encoding
+typedef enum INST_OPERATOR
+{
+    INST_MOV,       // 0
+    INST_PUSH,      // 1
+    INST_POP,       // 2
+    INST_LEAVE,     // 3
+    INST_CALL,      // 4
+    INST_RET,       // 5
+    INST_ADD,       // 6
+    INST_SUB,       // 7
+    INST_CMP,       // 8
+    INST_JNE,       // 9
+    INST_JMP,       // 10
+    INST_LEA,       // 11
+    INST_INT,       // 12
+    INST_NOP,       // 13
+} inst_op_t;
+
 typedef enum OPERAND_TYPE
 {
     OD_EMPTY,                  // 0
@@ -14,30 +33,113 @@ typedef enum OPERAND_TYPE
     OD_REG,                    // 2
     OD_MEM,                    // 3
 } od_type_t;
+#define NUM_OPERAND_TYPE (4)
 
+// the operand only keeps what is written in the instruction text
+// register values are read by the handlers at run-time,
+// so that one decoded instruction can be executed again and again
 typedef struct OPERAND_STRUCT
 {
     od_type_t   type;   // OD_IMM, OD_REG, OD_MEM
-    uint64_t    value;  // the value
+    uint64_t    imm;    // immediate number or displacement of effective address
+    uint64_t    scal;   // scale number to register 2
+    uint64_t    reg1;   // main register (address of the register)
+    uint64_t    reg2;   // register 2 (address of the register)
 } od_t;
 
 // handler table storing the handlers to different instruction types
 typedef void (*op_t)(od_t *, od_t *);
 
+// superinstruction: two adjacent instructions executed by one handler
+typedef enum FUSION_KIND
+{
+    FUSION_NONE,        // 0
+    FUSION_PUSH_MOV,    // 1: push %rbp; mov %rsp,%rbp
+    FUSION_CMP_JNE,     // 2: cmpq $imm,mem; jne target
+    FUSION_LEAVE_RET,   // 3: leaveq; retq
+    FUSION_MOV_ADD,     // 4: mov mem,%rax; add %rdx,%rax
+} fusion_t;
+#define NUM_FUSION (5)
+
+struct INST_STRUCT;
+
+// handler of the fused pair, the argument is the first of the two
+// return 0 if the pair can not be fused at run-time, nothing executed
+typedef int (*fused_op_t)(struct INST_STRUCT *);
+
 // local variables are allocated in stack in run-time
 // we don't consider local STATIC variables
 // ref: Computer Systems: A Programmer's Perspective 3rd
 // Chapter 7 Linking: 7.5 Symbols and Symbol Tables
 typedef struct INST_STRUCT
 {
-    op_t    op;         // enum of operators. e.g. mov, call, etc.
-    od_t    src;        // operand src of instruction
-    od_t    dst;        // operand dst of instruction
+    inst_op_t   opcode;     // enum of operators. e.g. mov, call, etc.
+    op_t        op;         // handler of the operator
+    void        *label;     // handler body of the threaded dispatch
+    fused_op_t  fused;      // handler of this and the next instruction, or NULL
+    fusion_t    fusion;     // kind of the fused pair
+    od_t        src;        // operand src of instruction
+    od_t        dst;        // operand dst of instruction
 } inst_t;
-// sizeof(inst_t) = 0x40
+
+// the number of times each kind of fused pair is executed
+// defined in isa.c
+extern uint64_t fusion_hit[NUM_FUSION];
+
+/*  Binary encoding of instruction in memory: 16 bytes, little-endian
+ *
+ *  byte    0       opcode `inst_op_t`
+ *  byte    1       [3:0] src type, [7:4] dst type
+ *  byte    2       [1:0] log2(src scale), [3:2] log2(dst scale)
+ *                  [4] immediate is split, [5] immediate belongs to dst
+ *  byte    3, 4    src reg1, src reg2
+ *  byte    5, 6    dst reg1, dst reg2
+ *  byte    7       reserved
+ *  byte    8-15    64-bit immediate of src or dst
+ *                  or split: [8-11] src, [12-15] dst, both 32-bit signed
+ *
+ *  The register number is the index of register table in inst.c,
+ *  0xff is the zero register (no register).
+ *  The assembler `cpu_writeinst_dram` encodes the assembly string,
+ *  and the CPU decodes it in instruction cycle.
+ */
 
 #define MAX_NUM_INSTRUCTION_CYCLE 100
 
+/*======================================*/
+/*      basic block                     */
+/*======================================*/
+
+#define MAX_BLOCK_INSTRUCTION (16)
+#define NUM_BLOCK_SUCCESSOR (2)
+
+struct BLOCK_STRUCT;
+
+// chain to the successor block
+// valid only in the same address space and the same epoch of block cache
+typedef struct
+{
+    uint64_t                vaddr;  // virtual address of successor
+    uint64_t                cr3;    // address space of the chain
+    uint64_t                epoch;  // epoch of block cache when chained
+    struct BLOCK_STRUCT     *block;
+} block_chain_t;
+
+// straight-line run of instructions ending with jmp/jne/call/ret/int
+typedef struct BLOCK_STRUCT
+{
+    uint64_t        paddr;      // physical address of the first instruction
+    int             num_inst;
+    inst_t          inst[MAX_BLOCK_INSTRUCTION];
+    // e.g. taken and not-taken of `jne`
+    block_chain_t   successor[NUM_BLOCK_SUCCESSOR];
+    int             victim;     // the chain to be replaced next
+    // just-in-time compilation of hot block
+    uint64_t        exec_count; // the number of times executed
+    void            *jit_code;  // host code of the block, or NULL
+    uint64_t        jit_epoch;  // epoch of the host code buffer
+} block_t;
+
 #endif
 
 
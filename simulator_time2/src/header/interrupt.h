@@ -17,7 +17,12 @@
 #ifndef INTERRUPT_GUARD
 #define INTERRUPT_GUARD
 
-#define KERNEL_malloc malloc
+// the kernel objects are in the memory of the machine (machine.c),
+// so they are saved by its checkpoint
+void *machine_malloc(uint64_t size);
+void *machine_aligned_alloc(uint64_t alignment, uint64_t size);
+#define KERNEL_malloc machine_malloc
+#define KERNEL_aligned_alloc machine_aligned_alloc
 
 // the struct of trap frame when interrupt on kernel stack
 // executed by hardware CPU
@@ -115,6 +120,6 @@ uint64_t get_kstack_RSP();
  *                          cpu_write64bits_dram    // will not be executed due to non-local jump
  *                          increase_pc             // will not be executed due to non-local jump
  */
-jmp_buf USER_INSTRUCTION_ON_IRET;
+#define USER_INSTRUCTION_ON_IRET (active_core->on_iret)
 
 #endif
\ No newline at end of file
@@ -53,7 +53,8 @@ typedef enum{
     R_X86_64_PLT32,
 } reltype_t;
 
-hashtable_t *link_constant_dict;
+// defined in parseElf.c
+extern hashtable_t *link_constant_dict;
 
 // relocation entry type
 typedef struct{
@@ -106,4 +107,54 @@ void free_elf(elf_t *elf);
 void link_elf(elf_t **src, int num_srcs, elf_t *dst);
 void write_eof(const char *filename, elf_t *eof);
 
+/*======================================*/
+/*      pre-decoded program image       */
+/*======================================*/
+
+// The EOF in binary: .text assembled to the binary encoding of the CPU,
+// .rodata and .data converted to uint64, so the loader parses nothing.
+// The file is
+//      image_header_t
+//      image_section_t[section_count]
+//      image_symbol_t[symbol_count]
+//      bytes of the sections, each aligned to 16 bytes
+
+#define IMAGE_MAGIC (0x474d495453434221)    // "!BCSTIMG"
+#define IMAGE_VERSION (1)
+
+typedef struct
+{
+    uint64_t magic;
+    uint64_t version;
+    // the encoding of the CPU that assembled the image
+    uint64_t inst_size;
+    uint64_t entry;
+    uint64_t section_count;
+    uint64_t symbol_count;
+} image_header_t;
+
+typedef struct
+{
+    char name[MAX_CHAR_SECTION_NAME];
+    uint64_t addr;          // run-time virtual address
+    uint64_t offset;        // in the file
+    uint64_t size;          // in bytes
+} image_section_t;
+
+typedef struct
+{
+    char name[MAX_CHAR_SYMBOL_NAME];
+    st_bind_t bind;
+    st_type_t type;
+    uint64_t addr;          // run-time virtual address
+    uint64_t size;          // in bytes
+} image_symbol_t;
+
+// the entry is `main`, or the start of .text
+void write_image(const char *filename, elf_t *eof);
+
+// copy the sections to the memory of current machine by one mmap of the file,
+// set RIP to the entry and return it
+uint64_t load_image(const char *filename);
+
 #endif
\ No newline at end of file
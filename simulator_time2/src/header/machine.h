@@ -0,0 +1,207 @@
+#ifndef MACHINE_GUARD
+#define MACHINE_GUARD
+
+#include <stdint.h>
+#include <setjmp.h>
+#ifdef USE_PARALLEL
+#include <pthread.h>
+#endif
+#include "header/cpu.h"
+#include "header/memory.h"
+#include "header/instruction.h"
+
+/*======================================*/
+/*      machine context                 */
+/*======================================*/
+
+// One simulated machine: the CPU cores, the physical memory, and the caches
+// of the simulator built on them. Nothing of the machine is global,
+// so a host process can run many machines, one on each host thread.
+//
+// The code refers to the current machine and core of the host thread by
+// the names in cpu.h, memory.h and interrupt.h,
+// e.g. `cpu_reg` is `active_core->reg`, `pm` is `machine->memory`.
+// The state private to a module is allocated by the module on first use.
+//
+// A constructed machine lives in one host memory region (the arena):
+// `machine_t` at the start, then the states of the modules and the
+// objects of the kernel (KERNEL_malloc), e.g. PCBs, page tables.
+// The pointers between them stay valid when the region is saved to
+// a file and mapped back at the same address, see machine_checkpoint.
+
+#define MAX_NUM_CORE (8)
+
+struct MMU_STATE;           // mmu.c: TLB
+struct TLB_STATE;           // mmu.c: geometry and policy of the TLBs
+struct SRAM_STATE;          // sram.c: cache
+struct PAGEMAP_STATE;       // pagefault.c: physical page descriptors
+struct DECODE_STATE;        // inst.c: decoded instructions
+struct BLOCK_STATE;         // translate.c: basic blocks
+struct EVENT_STATE;         // event.c: events and local APIC timer
+struct JIT_STATE;           // jit.c: host code
+struct SOFTMMU_STATE;       // isa.c: host pages of the handlers
+struct STORE_STATE;         // dram.c: buffered stores of parallel run
+struct SAMPLE_STATE;        // sample.c: windows of detailed simulation
+
+// How much of the memory hierarchy is simulated, switched at run time.
+// The caches are only simulated when built with USE_SRAM_CACHE and
+// USE_TLB_HARDWARE, the mode selects if they are used.
+typedef enum
+{
+    // the SRAM cache and TLB are used and their events counted
+    SIM_DETAIL,
+    // the SRAM cache and TLB are used, nothing counted
+    SIM_WARMUP,
+    // DRAM and page table only, the cache and TLB are flushed on entry
+    SIM_FAST,
+} sim_mode_t;
+
+// events counted by each core in SIM_DETAIL
+typedef enum
+{
+    SIM_CACHE_ACCESS,
+    SIM_CACHE_MISS,
+    SIM_TLB_ACCESS,
+    SIM_TLB_MISS,
+    NUM_SIM_COUNTER,
+} sim_counter_t;
+
+// resource accessible to the core itself only
+typedef struct CORE_STRUCT
+{
+    int             id;
+
+    // architectural state
+    cpu_reg_t       reg;
+    cpu_flags_t     flags;
+    cpu_pc_t        pc;
+    cpu_cr_t        controls;
+    tss_s0_t        tss;
+    uint64_t        vaddr_pagefault;
+
+    // run loop of isa.c
+    uint64_t        time;
+    jmp_buf         on_iret;
+    uint64_t        instruction_retired;
+    block_t         *last_block;
+    // translate.c: increased when any block is removed,
+    // the running block ends when it changes
+    uint64_t        block_epoch;
+    int             jit_running;
+    uint64_t        jit_progress;
+
+    // interrupt.c: raised in the quantum of parallel run,
+    // the kernel is entered at the barrier
+    int             interrupt_deferred;
+    uint64_t        deferred_vector;
+
+    // memory hierarchy events of SIM_DETAIL
+    uint64_t        sim_count[NUM_SIM_COUNTER];
+
+    // private to the modules, NULL before the first use
+    // the decoded instructions, blocks and host code have the addresses
+    // of the registers, so they belong to the core
+    struct MMU_STATE        *mmu;
+    struct DECODE_STATE     *decode;
+    struct BLOCK_STATE      *block;
+    struct EVENT_STATE      *event;
+    struct JIT_STATE        *jit;
+    struct STORE_STATE      *store;
+    struct SOFTMMU_STATE    *softmmu;
+} core_t;
+
+typedef struct MACHINE_STRUCT
+{
+    core_t          cores[MAX_NUM_CORE];
+    int             num_cores;
+
+    // shared by all cores
+    uint8_t         memory[PHYSICAL_MEMORY_SPACE];
+
+    // private to the modules, NULL before the first use
+    struct SRAM_STATE       *sram;
+    struct TLB_STATE        *tlb;
+    struct PAGEMAP_STATE    *pagemap;
+    struct SAMPLE_STATE     *sample;
+
+    // shared by all cores, since the SRAM cache is shared
+    sim_mode_t      sim_mode;
+
+    // swap.c: the next free swap page
+    uint64_t        swap_top;
+
+    // the arena of the machine, 0 for the default machine
+    uint64_t        arena_top;
+    uint64_t        arena_size;
+} machine_t;
+
+// a new machine with everything zero, the same as a new host process
+machine_t *machine_construct(int num_cores);
+void machine_free(machine_t *m);
+
+// zero memory in the arena of current machine, never freed alone
+// the default machine allocates from the host heap
+void *machine_calloc(uint64_t size);
+
+// Snapshot of current machine, taken between runs:
+// the whole arena is written to `path`, return 0 on success.
+// The host code and caches derived from guest memory are not saved.
+int machine_checkpoint(const char *path);
+
+// Map the snapshot back at its address, copy-on-write, so the file is
+// never changed and many processes can restore the same file at once.
+// Must be the same binary as the checkpoint, and the address must be
+// unused in this process, e.g. fork() after restore for many experiments.
+// return NULL on failure
+machine_t *machine_restore(const char *path);
+
+// run `m` on the calling host thread from its core 0,
+// return the previous machine
+// each host thread starts with the default machine of 1 core
+machine_t *machine_switch(machine_t *m);
+
+// the following code runs on the core of current machine
+void core_switch(int id);
+
+// run all cores in turn, each for `quantum` instructions
+// until `max_instructions` are retired by each core
+// return the number of instructions retired by all cores
+uint64_t machine_run(uint64_t quantum, uint64_t max_instructions);
+
+// the caches are used in the mode
+#define sim_detailed() (machine->sim_mode != SIM_FAST)
+#define SIM_COUNT(c) \
+    do { if (machine->sim_mode == SIM_DETAIL) active_core->sim_count[(c)] += 1; } while (0)
+
+// sample.c
+void sim_set_mode(sim_mode_t mode);
+
+// SMARTS sampling: every `period` instructions of current core,
+// `warmup` instructions warm the caches, then `window` instructions are
+// measured, the rest is fast-forwarded
+void sample_start(uint64_t period, uint64_t warmup, uint64_t window);
+// back to SIM_DETAIL
+void sample_stop();
+
+// estimated over the windows
+typedef enum
+{
+    SAMPLE_CACHE_MISS_RATE,
+    SAMPLE_CACHE_MPKI,          // misses per 1000 instructions
+    SAMPLE_TLB_MISS_RATE,
+    SAMPLE_TLB_MPKI,
+    NUM_SAMPLE_METRIC,
+} sample_metric_t;
+
+uint64_t sample_num_window();
+// the mean of the windows, and the half width of its 95% confidence interval
+double sample_mean(sample_metric_t metric, double *ci95);
+void sample_report();
+
+#ifdef USE_PARALLEL
+// the same as `machine_run`, but each core runs on its own host thread
+// the stores are seen by the other cores after the quantum
+uint64_t machine_run_parallel(uint64_t quantum, uint64_t max_instructions);
+#endif
+
+#endif
@@ -18,16 +18,29 @@
 // total 16 physical memory
 
 
+// a larger memory can be passed in, e.g. -DPHYSICAL_MEMORY_SPACE=4194304
+// to have frames for 2 MB pages
+#ifndef PHYSICAL_MEMORY_SPACE
 #define PHYSICAL_MEMORY_SPACE (65536)
-#define MAX_NUM_PHYSICAL_PAGE (16)    // 1 + MAX_INDEX_PHYSICAL_PAGE
+#endif
+#define MAX_NUM_PHYSICAL_PAGE (PHYSICAL_MEMORY_SPACE >> 12)    // 1 + MAX_INDEX_PHYSICAL_PAGE
 
 #define PAGE_TABLE_ENTRY_NUM    (512)
 #define PAGE_SIZE    (4096)
 
+// the page mapped by a leaf entry: PT maps 4 KB,
+// PMD with PS bit maps 2 MB, PUD with PS bit maps 1 GB
+#define PAGE_SHIFT_4K   (12)
+#define PAGE_SHIFT_2M   (21)
+#define PAGE_SHIFT_1G   (30)
+
+// the 4 KB frames of a 2 MB page
+#define HUGE_PAGE_FRAMES (1 << (PAGE_SHIFT_2M - PAGE_SHIFT_4K))
+
 // physical memory
 // 16 physical memory pages
 // used only for user process
-uint8_t pm[PHYSICAL_MEMORY_SPACE];
+#define pm (machine->memory)
 
 
 
@@ -46,7 +59,7 @@ typedef union{
         uint64_t cachedisabled      : 1;
         uint64_t reference          : 1;
         uint64_t unused6            : 1;
-        uint64_t smallpage          : 1;
+        uint64_t smallpage          : 1;    // PS bit - 1: PUD/PMD entry maps a large page
         uint64_t global             : 1;
         uint64_t unused9_11         : 3;
         /*
@@ -56,6 +69,7 @@ typedef union{
         for real world, a physical page number is 40 bits
         */
         uint64_t paddr              : 50;   // virtual address (48 bits) on simulator's heap
+                                            // or physical address of the large page if PS
         uint64_t xdisabled          : 1;
     };
 
@@ -121,7 +135,7 @@ typedef union{
 // used by instructions: read or write uint64_t to DRAM
 uint64_t cpu_read64bits_dram(uint64_t paddr);
 void cpu_write64bits_dram(uint64_t paddr, uint64_t data);
-void cpu_readinst_dram(uint64_t paddr, char *buf);
+void cpu_readinst_dram(uint64_t paddr, uint8_t *buf);
 void cpu_writeinst_dram(uint64_t paddr, const char *str);
 
 
@@ -49,6 +49,10 @@ typedef struct PROCESS_CONTROL_BLOCK_STRUCT
             pte123_t *pgd;
         };
 
+        // address space ID written to CR3 with pgd
+        // the tag of the TLB lines, 0 - untagged
+        uint64_t asid;
+
         // TODO: vm area
     } mm;
     
@@ -64,5 +68,6 @@ typedef struct PROCESS_CONTROL_BLOCK_STRUCT
 void syscall_init();
 
 pcb_t *get_current_pcb();
+void os_enqueue(pcb_t *prev, pcb_t *pcb);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,244 @@
+/* BCST - Introduction to Computer Systems
+ * Author:      yangminz@outlook.com
+ * Github:      https://github.com/yangminz/bcst_csapp
+ * Bilibili:    https://space.bilibili.com/4564101
+ * Zhihu:       https://www.zhihu.com/people/zhao-yang-min
+ * This project (code repository and videos) is exclusively owned by yangminz
+ * and shall not be used for commercial and profitting purpose
+ * without yangminz's permission.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../header/linker.h"
+#include "../header/common.h"
+#include "../header/cpu.h"
+#include "../header/memory.h"
+#include "../header/machine.h"
+
+// from inst.c
+void assemble_instruction(const char *inst_str, uint8_t *code);
+void decoded_cache_invalidate(uint64_t paddr);
+
+#define IMAGE_ALIGNMENT (16)
+
+static uint64_t align_up(uint64_t x)
+{
+    return (x + IMAGE_ALIGNMENT - 1) & ~(uint64_t)(IMAGE_ALIGNMENT - 1);
+}
+
+// bytes of one line in the section
+static uint64_t line_size(const char *section)
+{
+    if (strcmp(section, ".text") == 0)
+    {
+        // each line of .text is assembled to one binary instruction
+        return INSTRUCTION_SIZE;
+    }
+    return sizeof(uint64_t);
+}
+
+static sh_entry_t *find_section(elf_t *eof, const char *name)
+{
+    for (int i = 0; i < eof->sht_count; ++ i)
+    {
+        if (strcmp(eof->sht[i].sh_name, name) == 0)
+        {
+            return &(eof->sht[i]);
+        }
+    }
+    return NULL;
+}
+
+/*======================================*/
+/*      writer                          */
+/*======================================*/
+
+void write_image(const char *filename, elf_t *eof)
+{
+    // the loaded sections, .symtab stays on disk
+    int section_count = 0;
+    for (int i = 0; i < eof->sht_count; ++ i)
+    {
+        if (strcmp(eof->sht[i].sh_name, ".symtab") != 0)
+        {
+            section_count += 1;
+        }
+    }
+
+    uint64_t offset = align_up(sizeof(image_header_t) +
+        section_count * sizeof(image_section_t) +
+        eof->symt_count * sizeof(image_symbol_t));
+
+    image_section_t *sections = calloc(section_count, sizeof(image_section_t));
+    image_symbol_t *symbols = calloc(eof->symt_count, sizeof(image_symbol_t));
+    assert(section_count == 0 || sections != NULL);
+    assert(eof->symt_count == 0 || symbols != NULL);
+
+    int k = 0;
+    for (int i = 0; i < eof->sht_count; ++ i)
+    {
+        sh_entry_t *sh = &(eof->sht[i]);
+        if (strcmp(sh->sh_name, ".symtab") == 0)
+        {
+            continue;
+        }
+        strcpy(sections[k].name, sh->sh_name);
+        sections[k].addr = sh->sh_addr;
+        sections[k].offset = offset;
+        sections[k].size = sh->sh_size * line_size(sh->sh_name);
+        offset = align_up(offset + sections[k].size);
+        k += 1;
+    }
+
+    image_header_t header =
+    {
+        .magic = IMAGE_MAGIC,
+        .version = IMAGE_VERSION,
+        .inst_size = INSTRUCTION_SIZE,
+        .entry = 0,
+        .section_count = section_count,
+        .symbol_count = eof->symt_count,
+    };
+    sh_entry_t *text = find_section(eof, ".text");
+    if (text != NULL)
+    {
+        header.entry = text->sh_addr;
+    }
+
+    for (int i = 0; i < eof->symt_count; ++ i)
+    {
+        st_entry_t *st = &(eof->symt[i]);
+        sh_entry_t *sh = find_section(eof, st->st_shndx);
+        uint64_t unit = line_size(st->st_shndx);
+
+        strcpy(symbols[i].name, st->st_name);
+        symbols[i].bind = st->bind;
+        symbols[i].type = st->type;
+        symbols[i].addr = sh == NULL ? 0 : sh->sh_addr + st->st_value * unit;
+        symbols[i].size = st->st_size * unit;
+
+        if (strcmp(st->st_name, "main") == 0 && sh != NULL)
+        {
+            header.entry = symbols[i].addr;
+        }
+    }
+
+    // everything is built in memory and written once
+    uint8_t *buf = calloc(1, offset);
+    assert(buf != NULL);
+    uint8_t *p = buf;
+    memcpy(p, &header, sizeof(image_header_t));
+    p += sizeof(image_header_t);
+    memcpy(p, sections, section_count * sizeof(image_section_t));
+    p += section_count * sizeof(image_section_t);
+    memcpy(p, symbols, eof->symt_count * sizeof(image_symbol_t));
+
+    k = 0;
+    for (int i = 0; i < eof->sht_count; ++ i)
+    {
+        sh_entry_t *sh = &(eof->sht[i]);
+        if (strcmp(sh->sh_name, ".symtab") == 0)
+        {
+            continue;
+        }
+        uint8_t *dst = &buf[sections[k].offset];
+        for (int j = 0; j < sh->sh_size; ++ j)
+        {
+            char *line = eof->buffer[sh->sh_offset + j];
+            if (strcmp(sh->sh_name, ".text") == 0)
+            {
+                // the instruction must be in the instruction set of the CPU
+                assemble_instruction(line, &dst[j * INSTRUCTION_SIZE]);
+            }
+            else
+            {
+                uint64_t data = string2uint(line);
+                memcpy(&dst[j * sizeof(uint64_t)], &data, sizeof(uint64_t));
+            }
+        }
+        k += 1;
+    }
+
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL)
+    {
+        printf("unable to open file %s\n", filename);
+        exit(1);
+    }
+    if (fwrite(buf, offset, 1, fp) != 1)
+    {
+        printf("unable to write file %s\n", filename);
+        exit(1);
+    }
+    fclose(fp);
+
+    free(buf);
+    free(sections);
+    free(symbols);
+}
+
+/*======================================*/
+/*      loader                          */
+/*======================================*/
+
+uint64_t load_image(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("unable to open file %s\n", filename);
+        exit(1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(image_header_t))
+    {
+        printf("%s is not an image of this simulator\n", filename);
+        exit(1);
+    }
+
+    uint8_t *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    assert(image != MAP_FAILED);
+
+    image_header_t *header = (image_header_t *)image;
+    if (header->magic != IMAGE_MAGIC ||
+        header->version != IMAGE_VERSION ||
+        header->inst_size != INSTRUCTION_SIZE)
+    {
+        printf("%s is not an image of this simulator\n", filename);
+        exit(1);
+    }
+
+    image_section_t *sections = (image_section_t *)(header + 1);
+    for (int i = 0; i < header->section_count; ++ i)
+    {
+        image_section_t *s = &sections[i];
+        assert(s->offset + s->size <= st.st_size);
+
+        // the same as `cpu_writeinst_dram`: to DRAM, not by the SRAM cache,
+        // and the decoded instructions of the pages are invalidated
+        for (uint64_t j = 0; j < s->size; j += sizeof(uint64_t))
+        {
+            uint64_t paddr = va2pa(s->addr + j);
+            if (j == 0 || (s->addr + j) % PAGE_SIZE == 0)
+            {
+                decoded_cache_invalidate(paddr);
+            }
+            memcpy(&pm[paddr], &image[s->offset + j], sizeof(uint64_t));
+        }
+    }
+
+    uint64_t entry = header->entry;
+    munmap(image, st.st_size);
+
+    cpu_pc.rip = entry;
+    return entry;
+}
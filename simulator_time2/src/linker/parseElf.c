@@ -7,6 +7,8 @@
 #include "../header/common.h"
 #include "../header/algorithm.h"
 
+hashtable_t *link_constant_dict = NULL;
+
 static void print_sh_entry(sh_entry_t *sh){
 
     printf("%s\tOx%lx\t%lu\t%lu\n",
@@ -357,7 +357,7 @@ static void compute_section_header(elf_t *dst, smap_t *smap_table, int *smap_cou
 
     // compute the run-time address of the sections: compact in memory
     uint64_t text_runtime_addr = 0x00400000;    // 虚拟地址中从0x00400000开始的地址是只读状态，故从这里开始写代码段
-    uint64_t rodata_runtime_addr = text_runtime_addr + count_text * MAX_INSTRUCTION_CHAR * sizeof(char);
+    uint64_t rodata_runtime_addr = text_runtime_addr + count_text * INSTRUCTION_SIZE;
     uint64_t data_runtime_addr = rodata_runtime_addr + count_rodata * sizeof(uint64_t);
     uint64_t symtab_runtime_addr = 0; // For EOF, .symtab is not loaded into run-time memory but still on disk
 
@@ -766,7 +766,8 @@ static uint64_t get_symbol_runtime_address(elf_t *dst, st_entry_t *sym){
     uint64_t rodata_base = base;
     uint64_t data_base = base;
 
-    int inst_size = sizeof(inst_t);
+    // each line of .text is assembled to one binary instruction
+    int inst_size = INSTRUCTION_SIZE;
     int data_size = sizeof(uint64_t);
 
     // must visit in .text, .rodata, .data order
@@ -827,7 +828,7 @@ static void R_X86_64_PC32_handler(elf_t *dst, sh_entry_t *sh,
     assert(strcmp(sh->sh_name, ".text") == 0);
 
     uint64_t sym_address = get_symbol_runtime_address(dst, sym_referenced);
-    uint64_t rip_value = 0x00400000 + (row_referencing + 1) * sizeof(inst_t);
+    uint64_t rip_value = 0x00400000 + (row_referencing + 1) * INSTRUCTION_SIZE;
     char *s = &dst->buffer[sh->sh_offset + row_referencing][col_referencing];
     write_relocation(s, sym_address - rip_value);
     printf("row = %d, col = %d, symbol referered = %s\n", row_referencing, col_referencing, sym_referenced->st_name);
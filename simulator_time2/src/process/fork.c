@@ -62,6 +62,14 @@ static uint64_t fork_naive_copy()
     // update child PID
     child_pcb->pid = get_newpid();
 
+    // the PID is unique, so is the ASID; no tag for the large PIDs
+    child_pcb->mm.asid = child_pcb->pid < MAX_NUM_ASID ? child_pcb->pid : 0;
+    if (child_pcb->mm.asid != 0)
+    {
+        // the PID may be of an exited process, drop its stale lines
+        tlb_flush_asid(child_pcb->mm.asid);
+    }
+
     // TODO: copy the entire page table of parent
 
     // TODO: find physical frames to copy the pages of parent
@@ -73,8 +81,9 @@ static uint64_t fork_naive_copy()
     update_userframe_returnvalue(parent_pcb, child_pcb->pid);
     update_userframe_returnvalue(child_pcb, 0);
  
-    // TODO: add child process PCB to linked list for scheduling
+    // add child process PCB to linked list for scheduling
     // it's better the child process is right after parent
+    os_enqueue(parent_pcb, child_pcb);
     return 0;
 }
 
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "header/cpu.h"
 #include "header/memory.h"
@@ -7,6 +8,7 @@
 #include "header/address.h"
 #include "header/interrupt.h"
 #include "header/process.h"
+#include "header/machine.h"
 
 // search paddr from main memory and disk
 // TODO: raise exception 14 (page fault) here
@@ -17,6 +19,12 @@
 int swap_in(uint64_t saddr, uint64_t ppn);
 int swap_out(uint64_t saddr, uint64_t ppn);
 
+// from jit.c
+void jit_tlb_flush();
+
+// from inst.c
+void decoded_cache_invalidate(uint64_t paddr);
+
 // physical page descriptor
 typedef struct
 {
@@ -29,14 +37,40 @@ typedef struct
     // TODO: if multiple processes are using this page? E.g. Shared library
     pte4_t *pte4;       // the reversed mapping: from PPN to page table entry
     uint64_t saddr;   // binding the revesed mapping with mapping to disk
+
+    // the virtual page and its address space, to invalidate the TLB line
+    // PD_VADDR_UNKNOWN if mapped by `map_pte4` directly
+    uint64_t vaddr;
+    uint64_t asid;
+
+    // the PMD entry if the frame is in a 2 MB page
+    // such frames are pinned: never victims, never swapped
+    pte123_t *huge;
 } pd_t;
 
+#define PD_VADDR_UNKNOWN (0xffffffffffffffff)
+
 // for each pagable (swappable) physical page
 // create one reversed mapping
-static pd_t page_map[MAX_NUM_PHYSICAL_PAGE];
+// owned by each machine
+struct PAGEMAP_STATE
+{
+    pd_t map[MAX_NUM_PHYSICAL_PAGE];
+};
 
-// get the level 4 page table entry
-static pte4_t *get_entry4(pte123_t *pgd, address_t *vaddr)
+static inline struct PAGEMAP_STATE *pagemap_state()
+{
+    if (machine->pagemap == NULL)
+    {
+        machine->pagemap = machine_calloc(sizeof(struct PAGEMAP_STATE));
+    }
+    return machine->pagemap;
+}
+#define page_map (pagemap_state()->map)
+
+// get the entry of the level (1 - 4) of the page table
+// the tables of the upper levels are allocated if not present
+static pte123_t *get_entry(pte123_t *pgd, address_t *vaddr, int entry_level)
 {
     int vpns[4] = {
         vaddr->vpn1,
@@ -50,9 +84,11 @@ static pte4_t *get_entry4(pte123_t *pgd, address_t *vaddr)
 
     int level = 0;
     pte123_t *tab = pgd;
-    while (level < 4)
+    while (level < entry_level - 1)
     {
         int vpn = vpns[level];
+        // a large page is present, it never faults
+        assert(tab[vpn].present == 0 || tab[vpn].smallpage == 0);
         if (tab[vpn].present != 1)
         {
             // allocate a new page for next level
@@ -72,8 +108,13 @@ static pte4_t *get_entry4(pte123_t *pgd, address_t *vaddr)
         level += 1;
     }
 
-    pte4_t *pt = (pte4_t *)tab;
-    return &pt[vaddr->vpn4];
+    return &tab[vpns[level]];
+}
+
+// get the level 4 page table entry
+static pte4_t *get_entry4(pte123_t *pgd, address_t *vaddr)
+{
+    return (pte4_t *)get_entry(pgd, vaddr, 4);
 }
 
 void page_map_init()
@@ -84,6 +125,8 @@ void page_map_init()
         page_map[k].dirty = 0;
         page_map[k].time = 0;
         page_map[k].pte4 = NULL;
+        page_map[k].vaddr = PD_VADDR_UNKNOWN;
+        page_map[k].huge = NULL;
     }
 }
 
@@ -91,7 +134,7 @@ void pagemap_update_time(uint64_t ppn)
 {
     assert(0 <= ppn && ppn < MAX_NUM_PHYSICAL_PAGE);
     assert(page_map[ppn].allocated == 1);
-    assert(page_map[ppn].pte4->present == 1);
+    assert(page_map[ppn].huge != NULL || page_map[ppn].pte4->present == 1);
     for (int i = 0; i < MAX_NUM_PHYSICAL_PAGE; ++ i)
     {
         page_map[i].time += 1;
@@ -103,8 +146,13 @@ void pagemap_dirty(uint64_t ppn)
 {
     assert(0 <= ppn && ppn < MAX_NUM_PHYSICAL_PAGE);
     assert(page_map[ppn].allocated == 1);
-    assert(page_map[ppn].pte4->present == 1);
     page_map[ppn].dirty = 1;
+    if (page_map[ppn].huge != NULL)
+    {
+        // pinned, never written back
+        return;
+    }
+    assert(page_map[ppn].pte4->present == 1);
     page_map[ppn].pte4->dirty = 1;
 }
 
@@ -139,6 +187,7 @@ void map_pte4(pte4_t *pte, uint64_t ppn)
     page_map[ppn].dirty = 0;        // allocated as clean
     page_map[ppn].time = 0;         // most recently used physical page
     page_map[ppn].pte4 = pte;
+    page_map[ppn].vaddr = PD_VADDR_UNKNOWN;
 
     /*  When mapped
         Page table entry: present = 1, ppn
@@ -153,6 +202,7 @@ void unmap_pte4(uint64_t ppn)
     // Get the page table entry from reversed mapping array by ppn
     // Note that in this case the page MUST be allocated
     assert(page_map[ppn].allocated == 1);
+    assert(page_map[ppn].huge == NULL);
     pte4_t *pte = page_map[ppn].pte4;
     assert(pte->present == 1);
 
@@ -163,11 +213,23 @@ void unmap_pte4(uint64_t ppn)
     // Now we need to move the swap address to the page table entry.
     pte->saddr = page_map[ppn].saddr;
 
+    // the TLBs and the host code must not use the old translation
+    if (page_map[ppn].vaddr == PD_VADDR_UNKNOWN)
+    {
+        tlb_flush();
+    }
+    else
+    {
+        tlb_invlpg(page_map[ppn].vaddr, page_map[ppn].asid);
+    }
+    jit_tlb_flush();
+
     // clear the reversed mapping
     page_map[ppn].allocated = 0;
     page_map[ppn].dirty = 0;
     page_map[ppn].time = 0;
     page_map[ppn].pte4 = NULL;
+    page_map[ppn].vaddr = PD_VADDR_UNKNOWN;
 
     /*  When unmapped
         Page table entry: present = 0, swap address
@@ -177,6 +239,67 @@ void unmap_pte4(uint64_t ppn)
     // now page_map[ppn] can be used by other page table entry
 }
 
+// map the faulting page, and remember it for the TLB shootdown
+static void map_fault_page(pte4_t *pte, uint64_t ppn, address_t *vaddr, pcb_t *pcb)
+{
+    map_pte4(pte, ppn);
+    page_map[ppn].vaddr = vaddr->address_value;
+    page_map[ppn].asid = pcb->mm.asid;
+}
+
+// Back the whole 2 MB region of the fault with one large page if
+//  1. no 4 KB page of the region is mapped, i.e. its PMD entry is not present
+//  2. the frames of a 2 MB aligned physical range are all free
+// Then it is mapped by the PMD entry with the PS bit, and one TLB line
+// covers the region. Only anonymous memory faults here, so it is zero.
+static int map_huge_page(pte123_t *pgd, address_t *vaddr, pcb_t *pcb)
+{
+#if MAX_NUM_PHYSICAL_PAGE >= HUGE_PAGE_FRAMES
+    pte123_t *pmd = get_entry(pgd, vaddr, 3);
+    if (pmd->present == 1)
+    {
+        return 0;
+    }
+
+    for (int base = 0; base + HUGE_PAGE_FRAMES <= MAX_NUM_PHYSICAL_PAGE; base += HUGE_PAGE_FRAMES)
+    {
+        int i = 0;
+        while (i < HUGE_PAGE_FRAMES && page_map[base + i].allocated == 0)
+        {
+            i += 1;
+        }
+        if (i < HUGE_PAGE_FRAMES)
+        {
+            continue;
+        }
+
+        // found the frames [base, base + HUGE_PAGE_FRAMES)
+        uint64_t region = vaddr->address_value & ~(((uint64_t)1 << PAGE_SHIFT_2M) - 1);
+        for (i = 0; i < HUGE_PAGE_FRAMES; ++ i)
+        {
+            pd_t *pd = &page_map[base + i];
+            pd->allocated = 1;
+            pd->dirty = 0;
+            pd->time = 0;
+            pd->pte4 = NULL;
+            pd->huge = pmd;
+            pd->vaddr = region + ((uint64_t)i << PAGE_SHIFT_4K);
+            pd->asid = pcb->mm.asid;
+            decoded_cache_invalidate((uint64_t)(base + i) << PAGE_SHIFT_4K);
+        }
+        memset(&pm[(uint64_t)base << PAGE_SHIFT_4K], 0, (uint64_t)1 << PAGE_SHIFT_2M);
+
+        pmd->pte_value = 0;
+        pmd->present = 1;
+        pmd->smallpage = 1;
+        pmd->paddr = (uint64_t)base << PAGE_SHIFT_4K;
+        return 1;
+    }
+#endif
+    // no 2 MB of free frames, or the physical memory is too small
+    return 0;
+}
+
 void fix_pagefault()
 {
     // get page table directory from rsp
@@ -187,6 +310,13 @@ void fix_pagefault()
     // get the faulting address from MMU register
     address_t vaddr = {.address_value = mmu_vaddr_pagefault};
 
+    // 0. try to back the region with one 2 MB page
+    if (map_huge_page(pgd, &vaddr, pcb) == 1)
+    {
+        printf("\033[34;1m\tPageFault: use 2 MB page for %lx\033[0m\n", vaddr.address_value);
+        return;
+    }
+
     // get the level 4 page table entry
     pte4_t *pte = get_entry4(pgd, &vaddr);
     
@@ -197,7 +327,7 @@ void fix_pagefault()
         if (page_map[i].allocated == 0)
         {
             // found i as free ppn
-            map_pte4(pte, i);
+            map_fault_page(pte, i, &vaddr, pcb);
          
             printf("\033[34;1m\tPageFault: use free ppn %d\033[0m\n", i);
             return;
@@ -211,7 +341,7 @@ void fix_pagefault()
     int lru_time = -1;
     for (int i = 0; i < MAX_NUM_PHYSICAL_PAGE; ++ i)
     {
-        if (page_map[i].dirty == 0 && 
+        if (page_map[i].dirty == 0 && page_map[i].huge == NULL &&
             lru_time < page_map[i].time)
         {
             lru_time = page_map[i].time;
@@ -229,7 +359,7 @@ void fix_pagefault()
         // load page from disk to physical memory
         // at the victim's ppn
         swap_in(pte->saddr, lru_ppn);
-        map_pte4(pte, lru_ppn);
+        map_fault_page(pte, lru_ppn, &vaddr, pcb);
 
         printf("\033[34;1m\tPageFault: discard clean ppn %d as victim\033[0m\n", lru_ppn);
         return;
@@ -241,7 +371,7 @@ void fix_pagefault()
     lru_time = -1;
     for (int i = 0; i < MAX_NUM_PHYSICAL_PAGE; ++ i)
     {
-        if (lru_time < page_map[i].time)
+        if (page_map[i].huge == NULL && lru_time < page_map[i].time)
         {
             lru_time = page_map[i].time;
             lru_ppn = i;
@@ -257,7 +387,7 @@ void fix_pagefault()
 
     // load page from disk to physical memory
     swap_in(pte->saddr, lru_ppn);
-    map_pte4(pte, lru_ppn);
+    map_fault_page(pte, lru_ppn, &vaddr, pcb);
 
     printf("\033[34;1m\tPageFault: write back & use ppn %d\033[0m\n", lru_ppn);
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "header/memory.h"
 #include "header/interrupt.h"
 #include "header/process.h"
+#include "header/machine.h"
 
 pcb_t *get_current_pcb()
 {
@@ -17,6 +18,9 @@ pcb_t *get_current_pcb()
 
 static void store_context(pcb_t *proc)
 {
+    // the lazy flags are computed before saved
+    cpu_flags_materialize();
+
     context_t ctx = {
         .regs = cpu_reg,
         .flags = cpu_flags
@@ -33,6 +37,8 @@ static void restore_context(pcb_t *proc)
     memcpy(&cpu_flags, &(proc->context.flags), sizeof(cpu_flags_t));
 }
 
+// called on the core to be switched, all per-core states
+// (registers, TSS, CR3, timer) are of the active core
 void os_schedule()
 {
     // The magic is: RIP is not updated at all
@@ -41,8 +47,10 @@ void os_schedule()
     pcb_t *pcb_old = get_current_pcb();
 
     // pcb_new should be selected by the scheduling algorithm
+    // each core has its own run queue: the ring of its current process
     pcb_t *pcb_new = pcb_old->next;
-    printf("    \033[31;1mOS schedule [%ld] -> [%ld]\033[0m\n", pcb_old->pid, pcb_new->pid);
+    printf("    \033[31;1mOS schedule core %d [%ld] -> [%ld]\033[0m\n",
+        active_core->id, pcb_old->pid, pcb_new->pid);
 
     // context switch
 
@@ -56,6 +64,28 @@ void os_schedule()
     tr_global_tss.ESP0 = get_kstack_RSP() + KERNEL_STACK_SIZE;
 
     // update CR3 -> page table in MMU
-    // will cause the refreshing of MMU TLB cache
-    cpu_controls.cr3 = (uint64_t)(pcb_new->mm.pgd);
-}
\ No newline at end of file
+    // the TLB lines of the old process are kept by the ASID
+    mmu_write_cr3((uint64_t)(pcb_new->mm.pgd), pcb_new->mm.asid);
+
+    // tickless: no timer interrupt is needed to switch to itself
+    if (pcb_new->next == pcb_new)
+    {
+        timer_stop();
+    }
+    else
+    {
+        timer_start();
+    }
+}
+
+// insert the process to the run ring right after `prev`
+// the ring has two processes at least, so the timer is needed
+void os_enqueue(pcb_t *prev, pcb_t *pcb)
+{
+    pcb->prev = prev;
+    pcb->next = prev->next;
+    prev->next->prev = pcb;
+    prev->next = pcb;
+
+    timer_start();
+}
@@ -17,6 +17,8 @@
 #include "header/memory.h"
 #include "header/interrupt.h"
 #include "header/syscall.h"
+#include "header/machine.h"
+#include "header/process.h"
 
 typedef void (*syscall_handler_t)();
 
@@ -68,6 +70,9 @@ static void write_handler()
 
     destory_user_registers();
 
+    // only stdout is supported
+    assert(file_no == 1);
+
     // The following resource are allocated on KERNEL STACK
     // TODO: this works only with NAVIE VA2PA
     for (int i = 0; i < buf_length; ++ i)
@@ -95,8 +100,15 @@ static void exit_handler()
     uint64_t exit_status = cpu_reg.rdi;
     // assembly end
 
+    // the ASID is free to be reused by a new process
+    pcb_t *pcb = get_current_pcb();
+    if (pcb->mm.asid != 0)
+    {
+        tlb_flush_asid(pcb->mm.asid);
+    }
+
     // The following resource are allocated on KERNEL STACK
-    printf("\033[33;1mGood Bye ~~~\n\033[0m");
+    printf("\033[33;1mGood Bye ~~~ (exit status %lu)\n\033[0m", exit_status);
 }
 
 static void wait_handler()
@@ -20,6 +20,7 @@
 #include "header/instruction.h"
 #include "header/interrupt.h"
 #include "header/process.h"
+#include "header/machine.h"
 
 void map_pte4(pte4_t *pte, uint64_t ppn);
 void unmap_pte4(uint64_t ppn);
@@ -36,19 +37,23 @@ static void load_code_physically(int pid, address_t *code_addr)
         // open stack for string buffer
         // "p?\n"
         "movq $0x000a3170, %rbx",   // 0: 0x00400000
-        "pushq %rbx",               // 1: 0x00400040
+        "pushq %rbx",               // 1: 0x00400010
         "movq $1, %rax",            // 2
         "movq $1, %rdi",            // 3
-        "movq %rsp, %rsi",          // 4: 0x00400100
+        "movq %rsp, %rsi",          // 4: 0x00400040
         "movq $13, %rdx",           // 5
-        "int $0x80",                // 6: 0x00400180
-        "jmp 0x00400100"            // 7: jump to 4
+        "int $0x80",                // 6: 0x00400060
+        "jmp 0x00400040"            // 7: jump to 4
     };
     // the correct execution is:
-    // 000, 040, 080, 0c0, [100, 140, 180, 1c0], [100, 140, 180, 1c0], [100, 140, 180, 1c0], ...
+    // 00, 10, 20, 30, [40, 50, 60, 70], [40, 50, 60, 70], [40, 50, 60, 70], ...
     code[0][13] = (uint8_t)pid + '0';
-    uint8_t *start = &pm[(pid - 1) * PAGE_SIZE + code_addr->vpo];
-    memcpy((char *)start, &code, sizeof(char) * 8 * MAX_INSTRUCTION_CHAR);
+    uint64_t start = (pid - 1) * PAGE_SIZE + code_addr->vpo;
+    for (int i = 0; i < 8; ++ i)
+    {
+        // assemble to the binary code in physical page
+        cpu_writeinst_dram(start + i * INSTRUCTION_SIZE, code[i]);
+    }
 }
 
 static void link_page_table(pte123_t *pgd, pte123_t *pud, pte123_t *pmd, pte4_t *pt,
@@ -176,16 +181,8 @@ static void TestContextSwitching()
     syscall_init();
     
     printf("begin\n");
-    int time = 0;
-    while (time < 100)
-    {
-        instruction_cycle();
-#ifdef DEBUG_INSTRUCTION_CYCLE_INFO_REG_STACK
-        print_register();
-        print_stack();
-#endif
-        time ++;
-    }
+    uint64_t retired = cpu_run(100);
+    assert(retired == 100);
 
     printf("\033[32;1m\tPass\033[0m\n");
 }
@@ -10,6 +10,7 @@
 #include "header/instruction.h"
 #include "header/interrupt.h"
 #include "header/process.h"
+#include "header/machine.h"
 
 void map_pte4(pte4_t *pte, uint64_t ppn);
 void unmap_pte4(uint64_t ppn);
@@ -84,30 +85,31 @@ static void TestFork()
         "mov    %eax,%rbx",
         "cmpq   $0x0,%rbx",
         // not returns 0, then parent process
-        "jne    $0x00400380",
+        "jne    $0x004000e0",
         // child LOOP: print child
-        "movq   $0a646c696863, %rbx",   // 0x00400180
+        "movq   $0a646c696863, %rbx",   // 0x00400060
         "pushq  %rbx",
         "movq   $1, %rax",
         "movq   $1, %rdi",
         "movq   %rsp, %rsi",
         "movq   $13, %rdx",
         "int    $0x80",
-        "jmp    $0x00400180",
+        "jmp    $0x00400060",
         // LOOP: parent
         // parent LOOP: print child
-        "movq   $0a746e65726170, %rbx", // 0x00400380
+        "movq   $0a746e65726170, %rbx", // 0x004000e0
         "pushq  %rbx",
         "movq   $1, %rax",
         "movq   $1, %rdi",
         "movq   %rsp, %rsi",
         "movq   $13, %rdx",
         "int    $0x80",
-        "jmp    $0x00400380",
+        "jmp    $0x004000e0",
     };
-    memcpy(
-        (char *)(&pm[0 + code_addr.ppo]),
-        &code, sizeof(char) * 22 * MAX_INSTRUCTION_CHAR);
+    for (int i = 0; i < 22; ++ i)
+    {
+        cpu_writeinst_dram(0 + code_addr.ppo + i * INSTRUCTION_SIZE, code[i]);
+    }
 
     // create kernel stacks for trap into kernel
     uint8_t stack_buf[8192 * 2];
@@ -123,10 +125,7 @@ static void TestFork()
     syscall_init();
 
     // this should trigger page fault
-    for (int i = 0; i < 10; ++i)
-    {
-        instruction_cycle();
-    }
+    cpu_run(10);
 
     printf("\033[32;1m\tPass\033[0m\n");
 }
@@ -1,30 +1,173 @@
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <header/cpu.h>
 #include <header/common.h>
 #include <header/memory.h>
 #include <header/instruction.h>
+#include <header/machine.h>
 
 #define MAX_NUM_INSTRUCTION_CYCLE 100
 
 static void TestAddFunctionCallAndComputation();
 static void TestString2Uint();
 static void TestSumRecursiveCondition();
+static void BenchmarkParseInstruction();
+static void BenchmarkRunLoop();
 
-void print_register();
-void print_stack();
+static void print_register();
+static void print_stack();
 
 void TestParse_operand();
 void TestParse_instruciation();
 
+// from inst.c
+void parse_instruction(const char *inst_str, inst_t *inst);
+void parse_instruction_dfa(const char *inst_str, inst_t *inst);
+
+static void print_register()
+{
+    printf("rax = %16lx\trbx = %16lx\trcx = %16lx\trdx = %16lx\n",
+        cpu_reg.rax, cpu_reg.rbx, cpu_reg.rcx, cpu_reg.rdx);
+    printf("rsi = %16lx\trdi = %16lx\trbp = %16lx\trsp = %16lx\n",
+        cpu_reg.rsi, cpu_reg.rdi, cpu_reg.rbp, cpu_reg.rsp);
+    printf("rip = %16lx\n", cpu_pc.rip);
+    printf("CF = %u\tZF = %u\tSF = %u\tOF = %u\n",
+        cpu_flags.CF, cpu_flags.ZF, cpu_flags.SF, cpu_flags.OF);
+}
 
+static void print_stack()
+{
+    int n = 10;
+    uint64_t *high = (uint64_t*)&pm[va2pa(cpu_reg.rsp)];
+    high = &high[n];
+    uint64_t va = cpu_reg.rsp + n * 8;
+
+    for (int i = 0; i < 2 * n; ++ i)
+    {
+        uint64_t *ptr = (uint64_t *)(high - i);
+        printf("0x%16lx : %16lx", va, (uint64_t)*ptr);
+
+        if (i == n)
+        {
+            printf(" <== rsp");
+        }
+        printf("\n");
+        va -= 8;
+    }
+}
 
 int main(){
 
     TestAddFunctionCallAndComputation();
+    BenchmarkParseInstruction();
+    BenchmarkRunLoop();
     return 0;
 }
 
+// decoded lines per second of the character DFA and the tokenizer
+static void BenchmarkParseInstruction(){
+
+    const char *lines[] = {
+        "push   %rbp",
+        "mov    %rsp,%rbp",
+        "mov    %rdi,-0x18(%rbp)",
+        "mov    -0x20(%rbp),%rax",
+        "add    %rdx,%rax",
+        "lea    0x8(%r12,%r13,4),%r14d",
+        "mov    (,%rax,8),%rbx",
+        "cmpq   $0x1,-0x8(%rbp)",
+        "callq  0x00400000",
+        "retq",
+    };
+    int num = sizeof(lines) / sizeof(lines[0]);
+    int rounds = 100000;
+
+    void (*parsers[2])(const char *, inst_t *) = {&parse_instruction_dfa, &parse_instruction};
+    const char *names[2] = {"character DFA", "tokenizer"};
+
+    inst_t inst;
+    for (int k = 0; k < 2; ++ k)
+    {
+        clock_t start = clock();
+        for (int r = 0; r < rounds; ++ r)
+        {
+            for (int i = 0; i < num; ++ i)
+            {
+                parsers[k](lines[i], &inst);
+            }
+        }
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        printf("%-16s %12.0f lines/s\n", names[k], (double)rounds * num / seconds);
+    }
+}
+
+// the run loop before the block cache: the text of the instruction at RIP
+// is fetched and parsed in every cycle
+static void baseline_cycle(char (*text)[MAX_INSTRUCTION_CHAR], uint64_t base)
+{
+    inst_t inst;
+    parse_instruction(text[(va2pa(cpu_pc.rip) - va2pa(base)) / INSTRUCTION_SIZE], &inst);
+    inst.op(&(inst.src), &(inst.dst));
+}
+
+// retired instructions per second of the baseline fetch & parse per cycle,
+// of one instruction per `cpu_run`, i.e. a block lookup for every
+// instruction, and of one long `cpu_run` following the chained blocks
+static void BenchmarkRunLoop(){
+
+    // no timer interrupt: there is no kernel stack in this benchmark
+    timer_stop();
+
+    char assembly[5][MAX_INSTRUCTION_CHAR] = {
+        "mov    -0x8(%rbp),%rax",   // 0
+        "add    %rax,-0x10(%rbp)",  // 1
+        "push   %rax",              // 2
+        "pop    %rbx",              // 3
+        "jmp    0x00401000",        // 4: jump to 0
+    };
+    for (int i = 0; i < 5; ++ i)
+    {
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00401000), assembly[i]);
+    }
+
+    uint64_t rounds = 10000000;
+    double ips[3];
+    const char *names[3] = {"fetch & parse", "instruction_cycle", "cpu_run"};
+
+    for (int k = 0; k < 3; ++ k)
+    {
+        cpu_reg.rbp = 0x7ffffffee110;
+        cpu_reg.rsp = 0x7ffffffee100;
+        cpu_pc.rip = 0x00401000;
+
+        clock_t start = clock();
+        if (k == 0)
+        {
+            for (uint64_t r = 0; r < rounds; ++ r)
+            {
+                baseline_cycle(assembly, 0x00401000);
+            }
+        }
+        else if (k == 1)
+        {
+            for (uint64_t r = 0; r < rounds; ++ r)
+            {
+                instruction_cycle();
+            }
+        }
+        else
+        {
+            cpu_run(rounds);
+        }
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        ips[k] = (double)rounds / seconds;
+        printf("%-18s %12.0f inst/s\n", names[k], ips[k]);
+    }
+    printf("chained blocks speedup %.1fx over fetch & parse, %.1fx over instruction_cycle\n",
+        ips[2] / ips[0], ips[2] / ips[1]);
+}
+
 static void TestSumRecursiveCondition(){
     
     // ACTIVE_CORE = 0X0;
@@ -41,7 +184,7 @@ static void TestSumRecursiveCondition(){
     cpu_reg.rbp = 0x7ffffffee230;
     cpu_reg.rsp = 0x7ffffffee220;
     
-    cpu_flags.__flag_value = 0;
+    cpu_flags.__flags_value = 0;
     
     cpu_write64bits_dram(va2pa(0x7ffffffee230), 0x0000000008000650);//rbp
     cpu_write64bits_dram(va2pa(0x7ffffffee228), 0x0000000000000000);
@@ -53,9 +196,9 @@ static void TestSumRecursiveCondition(){
         "sub    $0x10,%rsp",        // 2
         "mov    %rdi,-0x8(%rbp)",   // 3
         "cmpq   $0x0,-0x8(%rbp)",   // 4
-        "jne    0x400200",          // 5: jump to 8
+        "jne    0x400080",          // 5: jump to 8
         "mov    $0x0,%eax",         // 6
-        "jmp    0x400380",          // 7: jump to 14
+        "jmp    0x4000e0",          // 7: jump to 14
         "mov    -0x8(%rbp),%rax",   // 8
         "sub    $0x1,%rax",         // 9
         "mov    %rax,%rdi",         // 10
@@ -72,15 +215,15 @@ static void TestSumRecursiveCondition(){
 
     for (int i = 0; i < 19; ++ i)
     {
-        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
-        // 每次偏移64个字节的长度
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+        // 每次偏移16个字节的长度
     }
-    // MAX_INSTRUCTION_CHAR * sizeof(char) = 64，就是0x40
-    cpu_pc.rip = MAX_INSTRUCTION_CHAR * sizeof(char) * 16 + 0x00400000;//main 函数开始的位置
+    // INSTRUCTION_SIZE = 16，就是0x10
+    cpu_pc.rip = INSTRUCTION_SIZE * 16 + 0x00400000;//main 函数开始的位置
 
     printf("begin\n");
     int time = 0;
-    while ((cpu_pc.rip <= 18 * 0x40 + 0x00400000) && time < MAX_NUM_INSTRUCTION_CYCLE){
+    while ((cpu_pc.rip <= 18 * INSTRUCTION_SIZE + 0x00400000) && time < MAX_NUM_INSTRUCTION_CYCLE){
 
         instruction_cycle();
         print_register();
@@ -151,6 +294,9 @@ static void TestAddFunctionCallAndComputation(){
 
     // core_t *ac = (core_t *)&cores[ACTIVE_CORE];
 
+    // no timer interrupt: there is no kernel stack in this test
+    timer_stop();
+
     //init state
     
     cpu_reg.rax = 0xabcd;
@@ -196,12 +342,12 @@ static void TestAddFunctionCallAndComputation(){
 
     for (int i = 0; i < 15; ++ i)
     {
-        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
-        // 每次偏移64个字节的长度
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+        // 每次偏移16个字节的长度
     }
-    // MAX_INSTRUCTION_CHAR * sizeof(char) = 64，就是0x40
+    // INSTRUCTION_SIZE = 16，就是0x10
     
-    cpu_pc.rip = MAX_INSTRUCTION_CHAR * sizeof(char) * 11 + 0x00400000;//main 函数开始的位置
+    cpu_pc.rip = INSTRUCTION_SIZE * 11 + 0x00400000;//main 函数开始的位置
 
     
     sprintf(assembly[13], "callq $%p\n", &assembly[0]);
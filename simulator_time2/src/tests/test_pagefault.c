@@ -20,6 +20,7 @@
 #include "header/instruction.h"
 #include "header/interrupt.h"
 #include "header/process.h"
+#include "header/machine.h"
 
 void map_pte4(pte4_t *pte, uint64_t ppn);
 void unmap_pte4(uint64_t ppn);
@@ -58,7 +59,6 @@ static void TestPageFaultHandlingCase1()
     
     cpu_pc.rip = 0x00400000;
 
-    address_t fault_addr = {.address_value = 0x7fff1234};
     address_t code_addr = {.address_value = cpu_pc.rip};
     
     page_map_init();
@@ -91,9 +91,10 @@ static void TestPageFaultHandlingCase1()
         "mov $1, %rax",
         "mov $2, %rax",
     };
-    memcpy(
-        (char *)(&pm[0 + code_addr.ppo]),
-        &code, sizeof(char) * 3 * MAX_INSTRUCTION_CHAR);
+    for (int i = 0; i < 3; ++ i)
+    {
+        cpu_writeinst_dram(0 + code_addr.ppo + i * INSTRUCTION_SIZE, code[i]);
+    }
     // virtual address 0x7fff1234 would trigger page fault
 
     // Mark all other page_map as allocated
@@ -120,10 +121,9 @@ static void TestPageFaultHandlingCase1()
     idt_init();
 
     // this should trigger page fault
-    for (int i = 0; i < 2; ++i)
-    {
-        instruction_cycle();
-    }
+    // the faulting `mov` is re-executed after page fault handling
+    uint64_t retired = cpu_run(2);
+    assert(retired == 2);
 
     printf("\033[32;1m\tPass\033[0m\n");
 }
@@ -134,7 +134,6 @@ static void TestPageFaultHandlingCase2()
 
     cpu_pc.rip = 0x00400000;
 
-    address_t fault_addr = {.address_value = 0x7fff1234};
     address_t code_addr = {.address_value = cpu_pc.rip};
     
     page_map_init();
@@ -167,9 +166,10 @@ static void TestPageFaultHandlingCase2()
         "mov $1, %rax",
         "mov $2, %rax",
     };
-    memcpy(
-        (char *)(&pm[0 + code_addr.ppo]),
-        &code, sizeof(char) * 3 * MAX_INSTRUCTION_CHAR);
+    for (int i = 0; i < 3; ++ i)
+    {
+        cpu_writeinst_dram(0 + code_addr.ppo + i * INSTRUCTION_SIZE, code[i]);
+    }
     // virtual address 0x7fff1234 would trigger page fault
 
     // Mark all other page_map as allocated
@@ -199,10 +199,9 @@ static void TestPageFaultHandlingCase2()
     idt_init();
 
     // this should trigger page fault
-    for (int i = 0; i < 2; ++i)
-    {
-        instruction_cycle();
-    }
+    // the faulting `mov` is re-executed after page fault handling
+    uint64_t retired = cpu_run(2);
+    assert(retired == 2);
 
     printf("\033[32;1m\tPass\033[0m\n");
 }
@@ -213,7 +212,6 @@ static void TestPageFaultHandlingCase3()
 
     cpu_pc.rip = 0x00400000;
 
-    address_t fault_addr = {.address_value = 0x7fff1234};
     address_t code_addr = {.address_value = cpu_pc.rip};
     
     page_map_init();
@@ -246,14 +244,14 @@ static void TestPageFaultHandlingCase3()
         "mov $1, %rax",
         "mov $2, %rax",
     };
-    memcpy(
-        (char *)(&pm[0 + code_addr.ppo]),
-        &code, sizeof(char) * 3 * MAX_INSTRUCTION_CHAR);
+    for (int i = 0; i < 3; ++ i)
+    {
+        cpu_writeinst_dram(0 + code_addr.ppo + i * INSTRUCTION_SIZE, code[i]);
+    }
     // virtual address 0x7fff1234 would trigger page fault
 
     // Mark all other page_map as allocated
     pte4_t other_process_pte4[MAX_NUM_PHYSICAL_PAGE];
-    char filename[128];
     for (int i = 1; i < MAX_NUM_PHYSICAL_PAGE; ++ i)
     {
         map_pte4(&other_process_pte4[i], i);
@@ -284,12 +282,189 @@ static void TestPageFaultHandlingCase3()
     idt_init();
 
     // this should trigger page fault
-    for (int i = 0; i < 2; ++i)
+    // the faulting `mov` is re-executed after page fault handling
+    uint64_t retired = cpu_run(2);
+    assert(retired == 2);
+
+    printf("\033[32;1m\tPass; Check the swapped out files.\033[0m\n");
+}
+
+static void TestPageFaultHugePage()
+{
+#if MAX_NUM_PHYSICAL_PAGE >= HUGE_PAGE_FRAMES
+    printf("================\nTesting page fault of a 2 MB page ...\n");
+
+    cpu_pc.rip = 0x00400000;
+
+    address_t fault_addr = {.address_value = 0x7fff1234};
+    address_t code_addr = {.address_value = cpu_pc.rip};
+
+    page_map_init();
+
+    // pcb is needed to trigger page fault
+    pcb_t p1;
+    memset(&p1, 0, sizeof(pcb_t));
+    p1.pid = 1;
+    // the next switched process would still be p1
+    p1.next = &p1;
+    p1.prev = &p1;
+
+    // prepare PGD
+    pte123_t p1_pgd[512];
+    memset(&p1_pgd, 0, sizeof(pte123_t) * 512);
+    p1.mm.pgd = &p1_pgd[0];
+
+    // prepare code page tables
+    pte123_t p1_pud[512];
+    pte123_t p1_pmd[512];
+    pte4_t   p1_pt[512];
+    memset(&p1_pud, 0, sizeof(pte123_t) * 512);
+    memset(&p1_pmd, 0, sizeof(pte123_t) * 512);
+    memset(&p1_pt, 0, sizeof(pte123_t) * 512);
+    link_page_table(&p1_pgd[0], &p1_pud[0], &p1_pmd[0], &p1_pt[0], 0, &code_addr);
+
+    // load code to frame 0
+    // both stores are in the 2 MB region 0x7fe00000
+    char code[2][MAX_INSTRUCTION_CHAR] = {
+        "mov %rax, 0x7fff1234",
+        "mov %rbx, 0x7fe01000",
+    };
+    for (int i = 0; i < 2; ++ i)
     {
-        instruction_cycle();
+        cpu_writeinst_dram(0 + code_addr.ppo + i * INSTRUCTION_SIZE, code[i]);
     }
+    cpu_reg.rax = 0x1234abcd;
+    cpu_reg.rbx = 0x5678ef01;
 
-    printf("\033[32;1m\tPass; Check the swapped out files.\033[0m\n");
+    // frame 0 is used by code, all the others are free
+    // so the first aligned 2 MB of free frames starts at frame HUGE_PAGE_FRAMES
+
+    // create kernel stacks for trap into kernel
+    uint8_t stack_buf[8192 * 2];
+    uint64_t p1_stack_bottom = (((uint64_t)&stack_buf[8192]) >> 13) << 13;
+    p1.kstack = (kstack_t *)p1_stack_bottom;
+    p1.kstack->threadinfo.pcb = &p1;
+
+    // run p1
+    tr_global_tss.ESP0 = p1_stack_bottom + KERNEL_STACK_SIZE;
+
+    cpu_controls.cr3 = p1.mm.pgd_paddr;
+    idt_init();
+
+    // the TLB lines of the cases before are of their page tables
+    tlb_flush();
+
+    // only the first store faults, the second is in the same 2 MB page
+    uint64_t retired = cpu_run(2);
+    assert(retired == 2);
+
+    uint64_t base = (uint64_t)HUGE_PAGE_FRAMES << PAGE_SHIFT_4K;
+    uint64_t mask = ((uint64_t)1 << PAGE_SHIFT_2M) - 1;
+    assert(cpu_read64bits_dram(base + (0x7fff1234 & mask)) == 0x1234abcd);
+    assert(cpu_read64bits_dram(base + (0x7fe01000 & mask)) == 0x5678ef01);
+
+    // the PMD entry maps the region with the PS bit
+    pte123_t *pud = (pte123_t *)(uint64_t)(p1_pgd[fault_addr.vpn1].paddr);
+    pte123_t *pmd = (pte123_t *)(uint64_t)(pud[fault_addr.vpn2].paddr);
+    assert(pmd[fault_addr.vpn3].present == 1);
+    assert(pmd[fault_addr.vpn3].smallpage == 1);
+    assert(pmd[fault_addr.vpn3].paddr == base);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
+}
+
+static void TestPageFaultParallel()
+{
+#ifdef USE_PARALLEL
+    printf("================\nTesting page fault of parallel cores ...\n");
+
+    address_t fault_addr = {.address_value = 0x7fff1234};
+    address_t code_addr = {.address_value = 0x00400000};
+
+    machine_t *m = machine_construct(2);
+    machine_t *old = machine_switch(m);
+
+    page_map_init();
+    idt_init();
+
+    // both cores fault on the same vaddr of their own process
+    char code[2][3][MAX_INSTRUCTION_CHAR] = {
+        {
+            "mov $0x10, %rbx",
+            "mov %rbx, 0x7fff1234",
+            "mov 0x7fff1234, %rcx",
+        },
+        {
+            "mov $0x20, %rbx",
+            "mov %rbx, 0x7fff1234",
+            "mov 0x7fff1234, %rcx",
+        },
+    };
+
+    pcb_t p[2];
+    pte123_t pgd[2][512];
+    pte123_t pud[2][512];
+    pte123_t pmd[2][512];
+    pte4_t   pt[2][512];
+    memset(&pgd, 0, sizeof(pgd));
+    memset(&pud, 0, sizeof(pud));
+    memset(&pmd, 0, sizeof(pmd));
+    memset(&pt, 0, sizeof(pt));
+
+    // create kernel stacks for trap into kernel
+    uint8_t stack_buf[2][8192 * 2];
+
+    for (int k = 0; k < 2; ++ k)
+    {
+        core_switch(k);
+        timer_stop();
+
+        memset(&p[k], 0, sizeof(pcb_t));
+        p[k].pid = k + 1;
+        // the next switched process would still be p[k]
+        p[k].next = &p[k];
+        p[k].prev = &p[k];
+        p[k].mm.pgd = &pgd[k][0];
+
+        // load code to frame k
+        link_page_table(&pgd[k][0], &pud[k][0], &pmd[k][0], &pt[k][0], k, &code_addr);
+        for (int i = 0; i < 3; ++ i)
+        {
+            cpu_writeinst_dram(k * PAGE_SIZE + code_addr.ppo + i * INSTRUCTION_SIZE, code[k][i]);
+        }
+
+        uint64_t bottom = (((uint64_t)&stack_buf[k][8192]) >> 13) << 13;
+        p[k].kstack = (kstack_t *)bottom;
+        p[k].kstack->threadinfo.pcb = &p[k];
+        tr_global_tss.ESP0 = bottom + KERNEL_STACK_SIZE;
+
+        cpu_controls.cr3 = p[k].mm.pgd_paddr;
+        cpu_pc.rip = code_addr.address_value;
+    }
+    core_switch(0);
+
+    // the faults stop both cores in the first quantum, and the kernel
+    // is entered at the barrier in the order of core id
+    assert(machine_run_parallel(4, 3) == 6);
+
+    for (int k = 0; k < 2; ++ k)
+    {
+        assert(m->cores[k].reg.rcx == 0x10 * (k + 1));
+
+        // core 0 gets the lower free ppn
+        core_switch(k);
+        uint64_t paddr = va2pa(fault_addr.address_value);
+        assert(paddr == (2 + k) * PAGE_SIZE + fault_addr.ppo);
+        assert(cpu_read64bits_dram(paddr) == 0x10 * (k + 1));
+    }
+    core_switch(0);
+
+    machine_switch(old);
+    machine_free(m);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
 }
 
 int main()
@@ -297,5 +472,7 @@ int main()
     TestPageFaultHandlingCase1();
     TestPageFaultHandlingCase2();
     TestPageFaultHandlingCase3();
+    TestPageFaultHugePage();
+    TestPageFaultParallel();
     return 0;
 }
\ No newline at end of file
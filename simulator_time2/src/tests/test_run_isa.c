@@ -16,9 +16,22 @@
 #include "header/memory.h"
 #include "header/common.h"
 #include "header/algorithm.h"
+#include "header/address.h"
 #include "header/instruction.h"
 #include "header/interrupt.h"
 #include "header/process.h"
+#include "header/machine.h"
+#include "header/linker.h"
+
+// from inst.c
+void parse_instruction(const char *inst_str, inst_t *inst);
+void parse_instruction_dfa(const char *inst_str, inst_t *inst);
+void assemble_instruction(const char *inst_str, uint8_t *code);
+inst_t *decode_instruction(uint64_t pc_paddr);
+void decoded_cache_invalidate(uint64_t paddr);
+
+// from isa.c
+void illegal_handler(od_t *src_od, od_t *dst_od);
 
 static void print_register()
 {
@@ -82,7 +95,7 @@ static void TestSyscallPrintHelloWorld()
     // copy to physical memory
     for (int i = 0; i < 12; ++ i)
     {
-        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
     }
     cpu_pc.rip = 0x00400000;
 
@@ -90,13 +103,14 @@ static void TestSyscallPrintHelloWorld()
     uint8_t kstack_buf[8192 * 2];
     uint64_t k_temp = (uint64_t)&kstack_buf[8192];
 
-    kstack_t *kstack = (kstack_t *)(((k_temp >> 13) << 13) + KERNEL_STACK_SIZE);
+    kstack_t *kstack = (kstack_t *)((k_temp >> 13) << 13);
     tss_s0_t tss;
 
     tss.ESP0 = (uint64_t)kstack + KERNEL_STACK_SIZE;
-    cpu_task_register = (uint64_t)&tss;
+    tr_global_tss.ESP0 = tss.ESP0;
 
     pcb_t curr;
+    memset(&curr, 0, sizeof(pcb_t));
     curr.prev = &curr;
     curr.next = &curr;
     curr.kstack = kstack;
@@ -123,6 +137,9 @@ static void TestSyscallPrintHelloWorld()
 static void TestAddFunctionCallAndComputation()
 {
     printf("Testing add function call ...\n");
+
+    // no timer interrupt: there is no kernel stack in this test
+    timer_stop();
  
     // init state
     cpu_reg.rax = 0xabcd;
@@ -167,21 +184,17 @@ static void TestAddFunctionCallAndComputation()
     // copy to physical memory
     for (int i = 0; i < 15; ++ i)
     {
-        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
     }
-    cpu_pc.rip = MAX_INSTRUCTION_CHAR * sizeof(char) * 11 + 0x00400000;
+    cpu_pc.rip = INSTRUCTION_SIZE * 11 + 0x00400000;
 
     printf("begin\n");
-    int time = 0;
-    while (time < 15)
-    {
-        instruction_cycle();
+    uint64_t retired = cpu_run(15);
+    assert(retired == 15);
 #ifdef DEBUG_INSTRUCTION_CYCLE_INFO_REG_STACK
-        print_register();
-        print_stack();
+    print_register();
+    print_stack();
 #endif
-        time ++;
-    } 
 
     // gdb state ret from func
     assert(cpu_reg.rax == 0x1234abcd);
@@ -206,6 +219,9 @@ static void TestSumRecursiveCondition()
 {
     printf("Testing sum recursive function call ...\n");
 
+    // no timer interrupt: there is no kernel stack in this test
+    timer_stop();
+
     // init state
     cpu_reg.rax = 0x8000630;
     cpu_reg.rbx = 0x0;
@@ -228,9 +244,9 @@ static void TestSumRecursiveCondition()
         "sub    $0x10,%rsp",        // 2
         "mov    %rdi,-0x8(%rbp)",   // 3
         "cmpq   $0x0,-0x8(%rbp)",   // 4
-        "jne    0x400200",          // 5: jump to 8
+        "jne    0x400080",          // 5: jump to 8
         "mov    $0x0,%eax",         // 6
-        "jmp    0x400380",          // 7: jump to 14
+        "jmp    0x4000e0",          // 7: jump to 14
         "mov    -0x8(%rbp),%rax",   // 8
         "sub    $0x1,%rax",         // 9
         "mov    %rax,%rdi",         // 10
@@ -247,13 +263,13 @@ static void TestSumRecursiveCondition()
     // copy to physical memory
     for (int i = 0; i < 19; ++ i)
     {
-        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
     }
-    cpu_pc.rip = MAX_INSTRUCTION_CHAR * sizeof(char) * 16 + 0x00400000;
+    cpu_pc.rip = INSTRUCTION_SIZE * 16 + 0x00400000;
 
     printf("begin\n");
     int time = 0;
-    while ((cpu_pc.rip <= 18 * 0x40 + 0x00400000) &&
+    while ((cpu_pc.rip <= 18 * INSTRUCTION_SIZE + 0x00400000) &&
            time < MAX_NUM_INSTRUCTION_CYCLE)
     {
         instruction_cycle();
@@ -280,11 +296,1469 @@ static void TestSumRecursiveCondition()
     printf("\033[32;1m\tPass\033[0m\n");
 }
 
+static void TestOperandForms()
+{
+    printf("Testing operand forms ...\n");
+
+    // no timer interrupt: there is no kernel stack in this test
+    timer_stop();
+
+    // init state
+    cpu_reg.rax = 0x5;
+    cpu_reg.rbx = 0x3;
+    cpu_reg.rbp = 0x7ffffffee110;
+
+    cpu_write64bits_dram(va2pa(0x7ffffffee108), 0x000000000000000a);
+
+    char assembly[5][MAX_INSTRUCTION_CHAR] = {
+        "sub    %rbx,%rax",         // 0: rax = 0x2
+        "add    $0x4,-0x8(%rbp)",   // 1: [rbp - 8] = 0xe
+        "add    -0x8(%rbp),%rax",   // 2: rax = 0x10
+        "mov    $0x7,-0x8(%rbp)",   // 3: [rbp - 8] = 0x7
+        "cmpq   $0x7,-0x8(%rbp)",   // 4: ZF = 1
+    };
+
+    // copy to physical memory
+    for (int i = 0; i < 5; ++ i)
+    {
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+    }
+    cpu_pc.rip = 0x00400000;
+
+    uint64_t retired = cpu_run(5);
+    assert(retired == 5);
+
+    assert(cpu_reg.rax == 0x10);
+    assert(cpu_reg.rbx == 0x3);
+    assert(cpu_read64bits_dram(va2pa(0x7ffffffee108)) == 0x7);
+    assert(cpu_flags.ZF == 1);
+    assert(cpu_pc.rip == 5 * INSTRUCTION_SIZE + 0x00400000);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestSuperinstructionFusion()
+{
+    printf("Testing superinstruction fusion ...\n");
+
+    // no timer interrupt: there is no kernel stack in this test
+    timer_stop();
+
+    // the same program as sum recursive function call,
+    // but executed in blocks so that the pairs are fused
+    cpu_reg.rax = 0x8000630;
+    cpu_reg.rbx = 0x0;
+    cpu_reg.rcx = 0x8000650;
+    cpu_reg.rdx = 0x7ffffffee328;
+    cpu_reg.rsi = 0x7ffffffee318;
+    cpu_reg.rdi = 0x1;
+    cpu_reg.rbp = 0x7ffffffee230;
+    cpu_reg.rsp = 0x7ffffffee220;
+
+    cpu_flags.__flags_value = 0;
+
+    cpu_write64bits_dram(va2pa(0x7ffffffee230), 0x0000000008000650);    // rbp
+    cpu_write64bits_dram(va2pa(0x7ffffffee228), 0x0000000000000000);
+    cpu_write64bits_dram(va2pa(0x7ffffffee220), 0x00007ffffffee310);    // rsp
+
+    char assembly[19][MAX_INSTRUCTION_CHAR] = {
+        "push   %rbp",              // 0: fused with 1
+        "mov    %rsp,%rbp",         // 1
+        "sub    $0x10,%rsp",        // 2
+        "mov    %rdi,-0x8(%rbp)",   // 3
+        "cmpq   $0x0,-0x8(%rbp)",   // 4: fused with 5
+        "jne    0x400080",          // 5: jump to 8
+        "mov    $0x0,%eax",         // 6
+        "jmp    0x4000e0",          // 7: jump to 14
+        "mov    -0x8(%rbp),%rax",   // 8
+        "sub    $0x1,%rax",         // 9
+        "mov    %rax,%rdi",         // 10
+        "callq  0x00400000",        // 11
+        "mov    -0x8(%rbp),%rdx",   // 12: fused with 13
+        "add    %rdx,%rax",         // 13
+        "leaveq ",                  // 14: fused with 15
+        "retq   ",                  // 15
+        "mov    $0x3,%edi",         // 16
+        "callq  0x00400000",        // 17
+        "mov    %rax,-0x8(%rbp)",   // 18
+    };
+
+    for (int i = 0; i < 19; ++ i)
+    {
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+    }
+    cpu_pc.rip = INSTRUCTION_SIZE * 16 + 0x00400000;
+
+    uint64_t hit[NUM_FUSION];
+    memcpy(hit, fusion_hit, sizeof(hit));
+
+    // sum(3): 2 + 14 * 3 + 10 + 1 instructions
+    uint64_t retired = cpu_run(55);
+    assert(retired == 55);
+    print_fusion_hit();
+
+    // the fused pairs retire the same as the instructions one by one
+    assert(cpu_pc.rip == 19 * INSTRUCTION_SIZE + 0x00400000);
+    assert(cpu_reg.rax == 0x6);
+    assert(cpu_reg.rdx == 0x3);
+    assert(cpu_reg.rdi == 0x0);
+    assert(cpu_reg.rbp == 0x7ffffffee230);
+    assert(cpu_reg.rsp == 0x7ffffffee220);
+    assert(cpu_read64bits_dram(va2pa(0x7ffffffee228)) == 0x0000000000000006);
+
+    for (int i = FUSION_PUSH_MOV; i < NUM_FUSION; ++ i)
+    {
+        assert(fusion_hit[i] > hit[i]);
+    }
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestJitHotBlock()
+{
+    printf("Testing JIT of hot blocks ...\n");
+
+    // no timer interrupt: there is no kernel stack in this test
+    timer_stop();
+
+    // compile each block at its second execution
+    jit_set_threshold(1);
+
+    char assembly[19][MAX_INSTRUCTION_CHAR] = {
+        "push   %rbp",              // 0
+        "mov    %rsp,%rbp",         // 1
+        "sub    $0x10,%rsp",        // 2
+        "mov    %rdi,-0x8(%rbp)",   // 3
+        "cmpq   $0x0,-0x8(%rbp)",   // 4
+        "jne    0x400080",          // 5: jump to 8
+        "mov    $0x0,%eax",         // 6
+        "jmp    0x4000e0",          // 7: jump to 14
+        "mov    -0x8(%rbp),%rax",   // 8
+        "sub    $0x1,%rax",         // 9
+        "mov    %rax,%rdi",         // 10
+        "callq  0x00400000",        // 11
+        "mov    -0x8(%rbp),%rdx",   // 12
+        "add    %rdx,%rax",         // 13
+        "leaveq ",                  // 14
+        "retq   ",                  // 15
+        "mov    $0x3,%edi",         // 16
+        "callq  0x00400000",        // 17
+        "mov    %rax,-0x8(%rbp)",   // 18
+    };
+
+    for (int i = 0; i < 19; ++ i)
+    {
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+    }
+
+    // round 0: sum(3) = 6
+    // round 1: `add` is rewritten to `sub`, the host code must not be used,
+    //          sub(3) = -6
+    for (int round = 0; round < 2; ++ round)
+    {
+        if (round == 1)
+        {
+            cpu_writeinst_dram(va2pa(13 * INSTRUCTION_SIZE + 0x00400000), "sub    %rdx,%rax");
+        }
+
+        cpu_reg.rax = 0x8000630;
+        cpu_reg.rbx = 0x0;
+        cpu_reg.rcx = 0x8000650;
+        cpu_reg.rdx = 0x7ffffffee328;
+        cpu_reg.rsi = 0x7ffffffee318;
+        cpu_reg.rdi = 0x1;
+        cpu_reg.rbp = 0x7ffffffee230;
+        cpu_reg.rsp = 0x7ffffffee220;
+
+        cpu_flags.__flags_value = 0;
+
+        cpu_write64bits_dram(va2pa(0x7ffffffee230), 0x0000000008000650);    // rbp
+        cpu_write64bits_dram(va2pa(0x7ffffffee228), 0x0000000000000000);
+        cpu_write64bits_dram(va2pa(0x7ffffffee220), 0x00007ffffffee310);    // rsp
+
+        cpu_pc.rip = INSTRUCTION_SIZE * 16 + 0x00400000;
+
+        uint64_t retired = cpu_run(55);
+        assert(retired == 55);
+
+        uint64_t sum = round == 0 ? 0x6 : -0x6;
+        assert(cpu_pc.rip == 19 * INSTRUCTION_SIZE + 0x00400000);
+        assert(cpu_reg.rax == sum);
+        assert(cpu_reg.rdx == 0x3);
+        assert(cpu_reg.rdi == 0x0);
+        assert(cpu_reg.rbp == 0x7ffffffee230);
+        assert(cpu_reg.rsp == 0x7ffffffee220);
+        assert(cpu_read64bits_dram(va2pa(0x7ffffffee228)) == sum);
+    }
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestJitSameAsInterpreter()
+{
+    printf("Testing host code against the interpreter ...\n");
+
+    // no timer interrupt: there is no kernel stack in this test
+    timer_stop();
+
+    // the block is interpreted at its first execution,
+    // and runs by host code from the second
+    jit_set_threshold(1);
+
+    char assembly[7][MAX_INSTRUCTION_CHAR] = {
+        "push   %rsp",              // 0: the old rsp is pushed
+        "push   $0x1234",           // 1
+        "push   %rbp",              // 2
+        "pop    %rax",              // 3
+        "pop    %rbx",              // 4
+        "pop    %rcx",              // 5
+        "callq  0x00400000",        // 6: the return address is pushed
+    };
+    for (int i = 0; i < 7; ++ i)
+    {
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+    }
+
+    cpu_reg_t reg[2];
+    uint64_t ret_addr[2];
+    for (int round = 0; round < 2; ++ round)
+    {
+        memset(&cpu_reg, 0, sizeof(cpu_reg));
+        cpu_reg.rbp = 0x7ffffffee110;
+        cpu_reg.rsp = 0x7ffffffee100;
+        cpu_flags.__flags_value = 0;
+        cpu_pc.rip = 0x00400000;
+
+        assert(cpu_run(7) == 7);
+        assert(cpu_pc.rip == 0x00400000);
+        reg[round] = cpu_reg;
+        ret_addr[round] = cpu_read64bits_dram(va2pa(cpu_reg.rsp));
+    }
+
+    assert(reg[0].rax == 0x7ffffffee110);
+    assert(reg[0].rbx == 0x1234);
+    assert(reg[0].rcx == 0x7ffffffee100);
+    assert(reg[0].rsp == 0x7ffffffee0f8);
+    assert(ret_addr[0] == 7 * INSTRUCTION_SIZE + 0x00400000);
+
+    assert(memcmp(&reg[0], &reg[1], sizeof(cpu_reg_t)) == 0);
+    assert(ret_addr[0] == ret_addr[1]);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestSelfModifyingBlock()
+{
+#ifndef USE_SRAM_CACHE
+    // not with the SRAM cache: the fetch reads DRAM, not the cache
+    printf("Testing stores into the running block ...\n");
+
+    // no timer interrupt: there is no kernel stack in this test
+    timer_stop();
+
+    // compile the block at its second execution
+    jit_set_threshold(1);
+
+    char assembly[4][MAX_INSTRUCTION_CHAR] = {
+        "mov    %rcx,(%rsi)",       // 0
+        "mov    %rdx,0x8(%rsi)",    // 1
+        "mov    $0x1,%rax",         // 2: rewritten by 0 and 1
+        "jmp    0x00400000",        // 3: jump to 0
+    };
+    for (int i = 0; i < 4; ++ i)
+    {
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+    }
+
+    // the block is hot, its stores go to the data page
+    cpu_reg.rsi = 0x00402000;
+    cpu_pc.rip = 0x00400000;
+    for (int round = 0; round < 3; ++ round)
+    {
+        assert(cpu_run(4) == 4);
+        assert(cpu_reg.rax == 0x1);
+    }
+
+    // the stores rewrite instruction 2 of the running block
+    uint8_t code[INSTRUCTION_SIZE];
+    assemble_instruction("mov    $0x2,%rax", code);
+    memcpy(&cpu_reg.rcx, &code[0], sizeof(uint64_t));
+    memcpy(&cpu_reg.rdx, &code[8], sizeof(uint64_t));
+    cpu_reg.rsi = 0x00400020;
+    assert(cpu_run(4) == 4);
+    assert(cpu_reg.rax == 0x2);
+    assert(cpu_pc.rip == 0x00400000);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
+}
+
+// the events handled: (time, data)
+static uint64_t event_record[4][2];
+static int event_record_count = 0;
+
+static void record_event(uint64_t data)
+{
+    event_record[event_record_count][0] = global_time;
+    event_record[event_record_count][1] = data;
+    event_record_count += 1;
+}
+
+static void TestEventQueue()
+{
+    printf("Testing simulated-time events ...\n");
+
+    // no timer interrupt: there is no kernel stack in this test
+    timer_stop();
+
+    char assembly[4][MAX_INSTRUCTION_CHAR] = {
+        "nop",                      // 0
+        "nop",                      // 1
+        "nop",                      // 2
+        "jmp    0x00400000",        // 3: jump to 0
+    };
+
+    for (int i = 0; i < 4; ++ i)
+    {
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+    }
+    cpu_pc.rip = 0x00400000;
+
+    // posted out of order, handled by time
+    uint64_t t0 = global_time;
+    event_post(t0 + 7, &record_event, 1);
+    event_post(t0 + 3, &record_event, 2);
+    event_post(t0 + 7, &record_event, 3);
+    event_post(t0 + 20, &record_event, 4);
+    event_cancel(&record_event);
+    event_post(t0 + 7, &record_event, 1);
+    event_post(t0 + 3, &record_event, 2);
+    event_post(t0 + 7, &record_event, 3);
+
+    uint64_t retired = cpu_run(10);
+    assert(retired == 10);
+    assert(global_time == t0 + 10);
+
+    // the events are handled right after the instructions before them
+    assert(event_record_count == 3);
+    assert(event_record[0][0] == t0 + 3 && event_record[0][1] == 2);
+    assert(event_record[1][0] == t0 + 7 && event_record[1][1] == 1);
+    assert(event_record[2][0] == t0 + 7 && event_record[2][1] == 3);
+    assert(event_deadline() == 0xffffffffffffffff);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestEnqueueStartsTimer()
+{
+    printf("Testing the timer restarted by a new runnable process ...\n");
+
+    // one process: tickless, as `os_schedule` leaves it
+    timer_stop();
+    pcb_t p1, p2;
+    memset(&p1, 0, sizeof(pcb_t));
+    memset(&p2, 0, sizeof(pcb_t));
+    p1.next = &p1;
+    p1.prev = &p1;
+    assert(event_deadline() == 0xffffffffffffffff);
+
+    os_enqueue(&p1, &p2);
+    assert(p1.next == &p2 && p1.prev == &p2);
+    assert(p2.next == &p1 && p2.prev == &p1);
+    assert(event_deadline() != 0xffffffffffffffff);
+
+    timer_stop();
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestProfile()
+{
+#ifdef USE_PROFILE
+    printf("Testing profiler ...\n");
+
+    timer_stop();
+
+    char assembly[4][MAX_INSTRUCTION_CHAR] = {
+        "nop",                      // 0
+        "add    $0x1,%rax",         // 1
+        "nop",                      // 2
+        "jmp    0x00400000",        // 3: jump to 0
+    };
+
+    for (int i = 0; i < 4; ++ i)
+    {
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+    }
+    cpu_pc.rip = 0x00400000;
+
+    uint64_t slot = va2pa(0x00400000) / INSTRUCTION_SIZE;
+    uint64_t inst_count[4];
+    for (int i = 0; i < 4; ++ i)
+    {
+        inst_count[i] = profile_inst_count[slot + i];
+    }
+    uint64_t block_count = profile_block_count[slot];
+#ifndef USE_JIT
+    uint64_t add_count = profile_kind_count[INST_ADD];
+#endif
+
+    // 10 times of the loop
+    assert(cpu_run(40) == 40);
+
+    for (int i = 0; i < 4; ++ i)
+    {
+        assert(profile_inst_count[slot + i] - inst_count[i] == 10);
+        assert(profile_inst_rip[slot + i] == 0x00400000 + i * INSTRUCTION_SIZE);
+    }
+    assert(profile_block_count[slot] - block_count == 10);
+#ifndef USE_JIT
+    // the hot loop is in host code
+    assert(profile_kind_count[INST_ADD] - add_count == 10);
+#endif
+
+    profile_report();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
+}
+
+static void TestMachineContext()
+{
+    printf("Testing machine context ...\n");
+
+    char assembly[2][2][MAX_INSTRUCTION_CHAR] = {
+        {
+            "add    $0x1,%rax",         // 0
+            "jmp    0x00400000",        // 1: jump to 0
+        },
+        {
+            "add    $0x2,%rax",         // 0
+            "jmp    0x00400000",        // 1: jump to 0
+        },
+    };
+
+    // the same code address in two machines
+    machine_t *m[2];
+    machine_t *old = machine;
+    for (int k = 0; k < 2; ++ k)
+    {
+        m[k] = machine_construct(1);
+        machine_switch(m[k]);
+        timer_stop();
+
+        for (int i = 0; i < 2; ++ i)
+        {
+            cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[k][i]);
+        }
+        cpu_pc.rip = 0x00400000;
+        cpu_reg.rax = 0;
+    }
+
+    // interleaved runs
+    machine_switch(m[0]);
+    assert(cpu_run(10) == 10);
+    machine_switch(m[1]);
+    assert(cpu_run(4) == 4);
+    machine_switch(m[0]);
+    assert(cpu_run(10) == 10);
+
+    assert(m[0]->cores[0].reg.rax == 10);
+    assert(m[0]->cores[0].time == 20);
+    assert(m[1]->cores[0].reg.rax == 4);
+    assert(m[1]->cores[0].time == 4);
+
+    machine_switch(old);
+    machine_free(m[0]);
+    machine_free(m[1]);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestMultiCore()
+{
+    printf("Testing multi-core ...\n");
+
+    char assembly[2][3][MAX_INSTRUCTION_CHAR] = {
+        {
+            "add    $0x1,%rax",         // 0
+            "mov    %rax,0x8000",       // 1
+            "jmp    0x00400000",        // 2: jump to 0
+        },
+        {
+            "mov    0x8000,%rbx",       // 0
+            "jmp    0x00400100",        // 1: jump to 0
+        },
+    };
+    uint64_t entry[2] = {0x00400000, 0x00400100};
+    int num_inst[2] = {3, 2};
+
+    machine_t *m = machine_construct(2);
+    machine_t *old = machine_switch(m);
+
+    // the cores share the DRAM
+    for (int k = 0; k < 2; ++ k)
+    {
+        core_switch(k);
+        timer_stop();
+        for (int i = 0; i < num_inst[k]; ++ i)
+        {
+            cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + entry[k]), assembly[k][i]);
+        }
+        cpu_pc.rip = entry[k];
+    }
+
+    // core 0: add, mov, jmp | core 1: mov, jmp, mov |
+    // core 0: add, mov, jmp | core 1: jmp, mov, jmp
+    assert(machine_run(3, 6) == 12);
+
+    assert(m->cores[0].reg.rax == 2);
+    assert(m->cores[1].reg.rbx == 2);
+    assert(m->cores[0].time == 6);
+    assert(m->cores[1].time == 6);
+
+    machine_switch(old);
+    machine_free(m);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestParallelCores()
+{
+#ifdef USE_PARALLEL
+    printf("Testing parallel cores ...\n");
+
+    char assembly[2][4][MAX_INSTRUCTION_CHAR] = {
+        {
+            "add    $0x1,%rax",         // 0
+            "mov    %rax,0x8000",       // 1
+            "mov    0x8000,%rcx",       // 2: its own store
+            "jmp    0x00400000",        // 3: jump to 0
+        },
+        {
+            "mov    0x8000,%rbx",       // 0: the store of core 0
+            "jmp    0x00400100",        // 1: jump to 0
+        },
+    };
+    uint64_t entry[2] = {0x00400000, 0x00400100};
+    int num_inst[2] = {4, 2};
+
+    machine_t *m = machine_construct(2);
+    machine_t *old = machine_switch(m);
+
+    for (int k = 0; k < 2; ++ k)
+    {
+        core_switch(k);
+        timer_stop();
+        for (int i = 0; i < num_inst[k]; ++ i)
+        {
+            cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + entry[k]), assembly[k][i]);
+        }
+        cpu_pc.rip = entry[k];
+    }
+    core_switch(0);
+
+    // the store of core 0 is seen by core 1 in the next quantum
+    assert(machine_run_parallel(4, 8) == 16);
+
+    assert(m->cores[0].reg.rax == 2);
+    assert(m->cores[0].reg.rcx == 2);
+    assert(m->cores[1].reg.rbx == 1);
+    assert(cpu_read64bits_dram(va2pa(0x8000)) == 2);
+
+    machine_switch(old);
+    machine_free(m);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
+}
+
+static void TestCheckpoint()
+{
+    printf("Testing checkpoint and restore ...\n");
+
+    char assembly[3][MAX_INSTRUCTION_CHAR] = {
+        "add    $0x1,%rax",         // 0
+        "mov    %rax,0x8000",       // 1
+        "jmp    0x00400000",        // 2: jump to 0
+    };
+    char *path = "./files/machine.snapshot";
+
+    machine_t *m = machine_construct(1);
+    machine_t *old = machine_switch(m);
+    timer_stop();
+    for (int i = 0; i < 3; ++ i)
+    {
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+    }
+    cpu_pc.rip = 0x00400000;
+
+    // the kernel objects are saved with the machine
+    uint64_t *object = KERNEL_malloc(sizeof(uint64_t));
+    *object = 0x1234;
+
+    assert(cpu_run(9) == 9);
+    assert(machine_checkpoint(path) == 0);
+
+    // the address is taken by the machine itself
+    assert(machine_restore(path) == NULL);
+
+    assert(cpu_run(9) == 9);
+    uint64_t rax = cpu_reg.rax;
+    uint64_t time = global_time;
+    uint64_t data = cpu_read64bits_dram(va2pa(0x8000));
+    assert(rax == 6 && data == 6);
+
+    machine_switch(old);
+    machine_free(m);
+
+    // the same run from the snapshot
+    m = machine_restore(path);
+    assert(m != NULL);
+    machine_switch(m);
+    assert(cpu_reg.rax == 3);
+    assert(global_time == 9);
+    assert(*object == 0x1234);
+
+    assert(cpu_run(9) == 9);
+    assert(cpu_reg.rax == rax);
+    assert(global_time == time);
+    assert(cpu_read64bits_dram(va2pa(0x8000)) == data);
+
+    machine_switch(old);
+    machine_free(m);
+    remove(path);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestSampling()
+{
+    printf("Testing sampled simulation ...\n");
+
+    // 832 lines of 64 bytes, more than the SRAM cache:
+    // each store misses and the load after it hits
+    char assembly[7][MAX_INSTRUCTION_CHAR] = {
+        "mov    $0x2000,%rbx",      // 0
+        "add    $0x40,%rbx",        // 1
+        "mov    %rbx,(%rbx)",       // 2
+        "mov    (%rbx),%rcx",       // 3
+        "cmpq   $0xf000,%rbx",      // 4
+        "jne    0x00400010",        // 5: jump to 1
+        "jmp    0x00400000",        // 6: jump to 0
+    };
+
+    // the same run, detailed and sampled
+    machine_t *m[2];
+    machine_t *old = machine;
+    for (int k = 0; k < 2; ++ k)
+    {
+        m[k] = machine_construct(1);
+        machine_switch(m[k]);
+        timer_stop();
+        for (int i = 0; i < 7; ++ i)
+        {
+            cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+        }
+        cpu_pc.rip = 0x00400000;
+    }
+
+    machine_switch(m[0]);
+    assert(cpu_run(10000) == 10000);
+
+    machine_switch(m[1]);
+    sample_start(1000, 100, 200);
+    assert(machine->sim_mode == SIM_FAST);
+    assert(cpu_run(10000) == 10000);
+    sample_stop();
+    assert(machine->sim_mode == SIM_DETAIL);
+
+    assert(sample_num_window() == 10);
+    double ci = 1.0;
+    double rate = sample_mean(SAMPLE_CACHE_MISS_RATE, &ci);
+#ifdef USE_SRAM_CACHE
+    assert(rate == 0.5 && ci == 0.0);
+    assert(sample_mean(SAMPLE_CACHE_MPKI, NULL) > 0.0);
+#else
+    assert(rate == 0.0 && ci == 0.0);
+#endif
+    sample_report();
+
+    // fast-forward does not change the result
+    assert(m[0]->cores[0].reg.rbx == m[1]->cores[0].reg.rbx);
+    assert(m[0]->cores[0].reg.rcx == m[1]->cores[0].reg.rcx);
+    for (uint64_t a = 0x2000; a <= 0xf000; a += 0x40)
+    {
+        machine_switch(m[0]);
+        uint64_t x = cpu_read64bits_dram(a);
+        machine_switch(m[1]);
+        assert(cpu_read64bits_dram(a) == x);
+    }
+
+    machine_switch(old);
+    machine_free(m[0]);
+    machine_free(m[1]);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestParseNames()
+{
+    printf("Testing operator and register names ...\n");
+
+    struct
+    {
+        char *str;
+        inst_op_t opcode;
+    } ops[] =
+    {
+        {"movq   %rax,%rbx",        INST_MOV    },
+        {"mov    %rax,%rbx",        INST_MOV    },
+        {"push   %rbp",             INST_PUSH   },
+        {"pushq  %rbp",             INST_PUSH   },
+        {"pop    %rbp",             INST_POP    },
+        {"leaveq",                  INST_LEAVE  },
+        {"callq  0x00400000",       INST_CALL   },
+        {"retq",                    INST_RET    },
+        {"add    %rax,%rbx",        INST_ADD    },
+        {"sub    %rax,%rbx",        INST_SUB    },
+        {"cmpq   $0x1,%rax",        INST_CMP    },
+        {"jne    0x00400000",       INST_JNE    },
+        {"jmp    0x00400000",       INST_JMP    },
+        {"lea    0x8(%rax),%rbx",   INST_LEA    },
+        {"int    $0x80",            INST_INT    },
+        {"nop",                     INST_NOP    },
+    };
+    inst_t inst;
+    for (int i = 0; i < sizeof(ops) / sizeof(ops[0]); ++ i)
+    {
+        parse_instruction(ops[i].str, &inst);
+        assert(inst.opcode == ops[i].opcode);
+    }
+
+    // the registers with digits
+    parse_instruction("mov    %r15b,%r8", &inst);
+    assert(inst.src.reg1 == (uint64_t)&cpu_reg.r15b);
+    assert(inst.dst.reg1 == (uint64_t)&cpu_reg.r8);
+
+    parse_instruction("lea    0x8(%r12,%r13,4),%r14d", &inst);
+    assert(inst.src.reg1 == (uint64_t)&cpu_reg.r12);
+    assert(inst.src.reg2 == (uint64_t)&cpu_reg.r13);
+    assert(inst.src.scal == 4);
+    assert(inst.dst.reg1 == (uint64_t)&cpu_reg.r14d);
+
+    parse_instruction("mov    (,%sil,2),%bph", &inst);
+    assert(inst.src.reg2 == (uint64_t)&cpu_reg.sil);
+    assert(inst.dst.reg1 == (uint64_t)&cpu_reg.bph);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static int same_operand(od_t *a, od_t *b)
+{
+    return a->type == b->type && a->imm == b->imm && a->scal == b->scal &&
+        a->reg1 == b->reg1 && a->reg2 == b->reg2;
+}
+
+static void TestTokenizer()
+{
+    printf("Testing tokenizer ...\n");
+
+    const char *lines[] = {
+        "push   %rbp",
+        "mov    %rsp,%rbp",
+        "mov   %rdi, -0x18(%rbp)",
+        "mov\t-0x20(%rbp),%rax",
+        "  add    %rdx,%rax",
+        "mov    $0x1234,%rax",
+        "mov    $-0x8,%rax",
+        "movq   $10,0x10(%rsp)",
+        "lea    0x8(%r12,%r13,4),%r14d",
+        "lea    -0x4(%rax,%rbx),%rcx",
+        "mov    (,%sil,2),%bph",
+        "mov    0x0(,%rax,8),%rbx",
+        "mov    (%rax),%rbx",
+        "mov    1234,%rax",
+        "cmpq   $0x1,-0x8(%rbp)",
+        "callq  0x00400000",
+        "jne    0x00400040",
+        "int    $0x80",
+        "pushq  $0x1",
+        "leaveq",
+        "retq",
+        "nop",
+    };
+    for (int i = 0; i < sizeof(lines) / sizeof(lines[0]); ++ i)
+    {
+        inst_t a, b;
+        memset(&a, 0, sizeof(inst_t));
+        memset(&b, 0, sizeof(inst_t));
+        parse_instruction_dfa(lines[i], &a);
+        parse_instruction(lines[i], &b);
+        assert(a.opcode == b.opcode);
+        assert(a.op == b.op);
+        assert(same_operand(&a.src, &b.src) == 1);
+        assert(same_operand(&a.dst, &b.dst) == 1);
+    }
+
+    // the DFA stops at the end of dst, the tokenizer also skips the trailing spaces
+    inst_t a, b;
+    parse_instruction("add    %rdx,%rax", &a);
+    parse_instruction("add    %rdx,%rax \t\r\n", &b);
+    assert(same_operand(&a.src, &b.src) == 1);
+    assert(same_operand(&a.dst, &b.dst) == 1);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestDecodeIllegal()
+{
+    printf("Testing decoding of guest bytes that are no instruction ...\n");
+
+    uint64_t paddr = va2pa(0x00403000);
+    uint8_t code[INSTRUCTION_SIZE];
+
+    // the opcode out of range
+    memset(code, 0, INSTRUCTION_SIZE);
+    code[0] = 0xfe;
+    memcpy(&pm[paddr], code, INSTRUCTION_SIZE);
+    decoded_cache_invalidate(paddr);
+    inst_t *inst = decode_instruction(paddr);
+    assert(inst->op == &illegal_handler);
+    assert(inst->opcode < NUM_INSTRTYPE);
+
+    // the register index out of range
+    assemble_instruction("mov    %rax,%rbx", code);
+    code[3] = 0xfe;
+    memcpy(&pm[paddr], code, INSTRUCTION_SIZE);
+    decoded_cache_invalidate(paddr);
+    inst = decode_instruction(paddr);
+    assert(inst->op == &illegal_handler);
+
+    // the same bytes with a valid register still decode
+    assemble_instruction("mov    %rax,%rbx", code);
+    memcpy(&pm[paddr], code, INSTRUCTION_SIZE);
+    decoded_cache_invalidate(paddr);
+    inst = decode_instruction(paddr);
+    assert(inst->op != &illegal_handler);
+    assert(inst->opcode == INST_MOV);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestTaggedTlb()
+{
+#if defined(USE_TLB_HARDWARE) && defined(USE_PAGETABLE_VA2PA)
+    printf("Testing ASID-tagged TLB ...\n");
+
+    // two processes map the same virtual page to different physical pages
+    static pte123_t pgd[2][PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pud[2][PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pmd[2][PAGE_TABLE_ENTRY_NUM];
+    static pte4_t pt[2][PAGE_TABLE_ENTRY_NUM];
+
+    address_t vaddr = {.address_value = 0x00400010};
+    for (int i = 0; i < 2; ++ i)
+    {
+        pgd[i][vaddr.vpn1].paddr = (uint64_t)&pud[i][0];
+        pgd[i][vaddr.vpn1].present = 1;
+        pud[i][vaddr.vpn2].paddr = (uint64_t)&pmd[i][0];
+        pud[i][vaddr.vpn2].present = 1;
+        pmd[i][vaddr.vpn3].paddr = (uint64_t)&pt[i][0];
+        pmd[i][vaddr.vpn3].present = 1;
+        pt[i][vaddr.vpn4].ppn = i + 1;
+        pt[i][vaddr.vpn4].present = 1;
+    }
+
+    uint64_t a = (1 << PHYSICAL_PAGE_OFFSET_LENGTH) + 0x10;
+    uint64_t b = (2 << PHYSICAL_PAGE_OFFSET_LENGTH) + 0x10;
+    uint64_t *miss = &(active_core->sim_count[SIM_TLB_MISS]);
+    uint64_t m = *miss;
+
+    mmu_write_cr3((uint64_t)pgd[0], 1);
+    assert(va2pa(vaddr.address_value) == a);
+    assert(*miss == m + 1);
+    assert(va2pa(vaddr.address_value) == a);
+    assert(*miss == m + 1);
+
+    // switched without flushing: the line of ASID 1 is kept
+    mmu_write_cr3((uint64_t)pgd[1], 2);
+    assert(va2pa(vaddr.address_value) == b);
+    assert(*miss == m + 2);
+    mmu_write_cr3((uint64_t)pgd[0], 1);
+    assert(va2pa(vaddr.address_value) == a);
+    assert(*miss == m + 2);
+
+    // only the line of ASID 1 is invalidated
+    tlb_invlpg(vaddr.address_value, 1);
+    assert(va2pa(vaddr.address_value) == a);
+    assert(*miss == m + 3);
+    mmu_write_cr3((uint64_t)pgd[1], 2);
+    assert(va2pa(vaddr.address_value) == b);
+    assert(*miss == m + 3);
+
+    tlb_flush_asid(2);
+    assert(va2pa(vaddr.address_value) == b);
+    assert(*miss == m + 4);
+
+    // ASID 0 is flushed by each CR3 write
+    mmu_write_cr3((uint64_t)pgd[0], 0);
+    assert(va2pa(vaddr.address_value) == a);
+    assert(va2pa(vaddr.address_value) == a);
+    assert(*miss == m + 5);
+    mmu_write_cr3((uint64_t)pgd[1], 0);
+    assert(va2pa(vaddr.address_value) == b);
+    assert(*miss == m + 6);
+
+    tlb_flush();
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
+}
+
+static void TestTlbPolicy()
+{
+#if defined(USE_TLB_HARDWARE) && defined(USE_PAGETABLE_VA2PA)
+    printf("Testing TLB policy and geometry ...\n");
+
+    // 16 pages from 0x00400000 to physical pages 0x10 - 0x1f
+    static pte123_t pgd[PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pud[PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pmd[PAGE_TABLE_ENTRY_NUM];
+    static pte4_t pt[PAGE_TABLE_ENTRY_NUM];
+
+    address_t vaddr = {.address_value = 0x00400000};
+    pgd[vaddr.vpn1].paddr = (uint64_t)&pud[0];
+    pgd[vaddr.vpn1].present = 1;
+    pud[vaddr.vpn2].paddr = (uint64_t)&pmd[0];
+    pud[vaddr.vpn2].present = 1;
+    pmd[vaddr.vpn3].paddr = (uint64_t)&pt[0];
+    pmd[vaddr.vpn3].present = 1;
+    for (int i = 0; i < 16; ++ i)
+    {
+        pt[vaddr.vpn4 + i].ppn = 0x10 + i;
+        pt[vaddr.vpn4 + i].present = 1;
+    }
+    mmu_write_cr3((uint64_t)pgd, 3);
+
+#define PAGE(i) (0x00400000 + (i) * PAGE_SIZE)
+    tlb_stat_t t0;
+
+    // the dTLB: one set of 4 ways, LRU
+    tlb_configure(TLB_L1D, 1, 4, 1, TLB_LRU);
+    t0 = tlb_stat(TLB_L1D, 3);
+    for (int i = 0; i < 4; ++ i)
+    {
+        va2pa(PAGE(i));
+    }
+    va2pa(PAGE(0));
+    va2pa(PAGE(4));     // replaces page 1
+    va2pa(PAGE(0));
+    assert(tlb_stat(TLB_L1D, 3).hit == t0.hit + 2);
+    assert(tlb_stat(TLB_L1D, 3).miss == t0.miss + 5);
+    assert(tlb_stat(TLB_L1D, 3).eviction == t0.eviction + 1);
+    va2pa(PAGE(1));
+    assert(tlb_stat(TLB_L1D, 3).miss == t0.miss + 6);
+
+    // the page of the line and the offset of the address
+    assert(va2pa(PAGE(4) + 0x123) == ((0x14 << PHYSICAL_PAGE_OFFSET_LENGTH) | 0x123));
+
+    // pseudo-LRU: used in order 0, 1, 2, 3, the tree points to page 0
+    tlb_configure(TLB_L1D, 1, 4, 1, TLB_PLRU);
+    t0 = tlb_stat(TLB_L1D, 3);
+    for (int i = 0; i < 5; ++ i)
+    {
+        va2pa(PAGE(i));
+    }
+    for (int i = 1; i < 5; ++ i)
+    {
+        va2pa(PAGE(i));
+    }
+    assert(tlb_stat(TLB_L1D, 3).hit == t0.hit + 4);
+    assert(tlb_stat(TLB_L1D, 3).eviction == t0.eviction + 1);
+    va2pa(PAGE(0));
+    assert(tlb_stat(TLB_L1D, 3).miss == t0.miss + 6);
+
+    // 4 sets of 2 ways: pages 0, 4, 8 share set 0
+    tlb_configure(TLB_L1D, 4, 2, 1, TLB_LRU);
+    t0 = tlb_stat(TLB_L1D, 3);
+    int pages[6] = {0, 4, 8, 1, 2, 3};
+    for (int i = 0; i < 6; ++ i)
+    {
+        va2pa(PAGE(pages[i]));
+    }
+    assert(tlb_stat(TLB_L1D, 3).miss == t0.miss + 6);
+    assert(tlb_stat(TLB_L1D, 3).eviction == t0.eviction + 1);
+    for (int i = 1; i < 6; ++ i)
+    {
+        va2pa(PAGE(pages[i]));
+    }
+    assert(tlb_stat(TLB_L1D, 3).hit == t0.hit + 5);
+
+    // random: the free ways are used first, the new line is kept
+    tlb_configure(TLB_L1D, 1, 4, 1, TLB_RANDOM);
+    t0 = tlb_stat(TLB_L1D, 3);
+    for (int i = 0; i < 8; ++ i)
+    {
+        va2pa(PAGE(i % 4));
+    }
+    assert(tlb_stat(TLB_L1D, 3).miss == t0.miss + 4);
+    assert(tlb_stat(TLB_L1D, 3).hit == t0.hit + 4);
+    va2pa(PAGE(4));
+    va2pa(PAGE(4));
+    assert(tlb_stat(TLB_L1D, 3).eviction == t0.eviction + 1);
+    assert(tlb_stat(TLB_L1D, 3).hit == t0.hit + 5);
+
+    // a larger geometry is allocated again, and starts empty
+    tlb_configure(TLB_L1D, 64, 8, 1, TLB_LRU);
+    t0 = tlb_stat(TLB_L1D, 3);
+    va2pa(PAGE(4));
+    assert(tlb_stat(TLB_L1D, 3).miss == t0.miss + 1);
+    for (int i = 0; i < 16; ++ i)
+    {
+        va2pa(PAGE(i));
+    }
+    assert(tlb_stat(TLB_L1D, 3).eviction == t0.eviction);
+    assert(tlb_stat(TLB_L1D, 3).hit == t0.hit + 1);
+
+    // the lookups are counted for the address space of CR3
+    mmu_write_cr3((uint64_t)pgd, 9);
+    t0 = tlb_stat(TLB_L1D, 3);
+    tlb_stat_t t9 = tlb_stat(TLB_L1D, 9);
+    va2pa(PAGE(0));
+    va2pa(PAGE(0));
+    assert(tlb_stat(TLB_L1D, 9).miss == t9.miss + 1);
+    assert(tlb_stat(TLB_L1D, 9).hit == t9.hit + 1);
+    assert(tlb_stat(TLB_L1D, 3).miss == t0.miss);
+    assert(tlb_stat(TLB_L1D, 3).hit == t0.hit);
+#undef PAGE
+
+    tlb_configure(TLB_L1D, 16, 4, 1, TLB_PLRU);
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
+}
+
+static void TestTlbLevels()
+{
+#if defined(USE_TLB_HARDWARE) && defined(USE_PAGETABLE_VA2PA)
+    printf("Testing TLB levels ...\n");
+
+    // 16 pages from 0x00400000 to physical pages 0x10 - 0x1f
+    static pte123_t pgd[PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pud[PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pmd[PAGE_TABLE_ENTRY_NUM];
+    static pte4_t pt[PAGE_TABLE_ENTRY_NUM];
+
+    address_t vaddr = {.address_value = 0x00400000};
+    pgd[vaddr.vpn1].paddr = (uint64_t)&pud[0];
+    pgd[vaddr.vpn1].present = 1;
+    pud[vaddr.vpn2].paddr = (uint64_t)&pmd[0];
+    pud[vaddr.vpn2].present = 1;
+    pmd[vaddr.vpn3].paddr = (uint64_t)&pt[0];
+    pmd[vaddr.vpn3].present = 1;
+    for (int i = 0; i < 16; ++ i)
+    {
+        pt[vaddr.vpn4 + i].ppn = 0x10 + i;
+        pt[vaddr.vpn4 + i].present = 1;
+    }
+    mmu_write_cr3((uint64_t)pgd, 4);
+    tlb_flush();
+
+#define PAGE(i) (0x00400000 + (i) * PAGE_SIZE)
+    // the dTLB holds 2 pages
+    tlb_configure(TLB_L1D, 1, 2, 1, TLB_LRU);
+    uint64_t *walk = &(active_core->sim_count[SIM_TLB_MISS]);
+    uint64_t w = *walk;
+
+    // the page walk fills L2 and the dTLB, the fetch finds it in L2
+    assert(va2pa(PAGE(8)) == (0x18 << PHYSICAL_PAGE_OFFSET_LENGTH));
+    assert(va2pa_fetch(PAGE(8)) == (0x18 << PHYSICAL_PAGE_OFFSET_LENGTH));
+    assert(*walk == w + 1);
+    assert(tlb_stat(TLB_L1I, 4).miss == 1);
+    assert(tlb_stat(TLB_L2, 4).hit == 1);
+
+    // the data pages thrash the dTLB, not the iTLB, and hit in L2
+    for (int i = 0; i < 4; ++ i)
+    {
+        va2pa(PAGE(i));
+    }
+    for (int i = 0; i < 4; ++ i)
+    {
+        va2pa(PAGE(i));
+    }
+    va2pa_fetch(PAGE(8));
+    assert(*walk == w + 5);
+    assert(tlb_stat(TLB_L1D, 4).hit == 0);
+    assert(tlb_stat(TLB_L1D, 4).miss == 9);
+    assert(tlb_stat(TLB_L1I, 4).hit == 1);
+    assert(tlb_stat(TLB_L2, 4).hit == 5);
+
+    // each lookup of L2 costs its latency
+    tlb_stat_t l2 = tlb_stat(TLB_L2, 4);
+    assert(l2.cycle == 7 * (l2.hit + l2.miss));
+
+    // the run loop fetches by the iTLB, the load by the dTLB
+    // pages 12 and 13 are moved into the physical memory
+    pt[vaddr.vpn4 + 12].ppn = 0x5;
+    pt[vaddr.vpn4 + 13].ppn = 0x6;
+    cpu_writeinst_dram(0x5 << PHYSICAL_PAGE_OFFSET_LENGTH, "mov    0x0040d000,%rax");
+    cpu_write64bits_dram(0x6 << PHYSICAL_PAGE_OFFSET_LENGTH, 0x66);
+    cpu_pc.rip = PAGE(12);
+    assert(cpu_run(1) == 1);
+    assert(cpu_reg.rax == 0x66);
+    assert(tlb_stat(TLB_L1I, 4).miss == 2);
+    assert(tlb_stat(TLB_L1D, 4).miss == 10);
+    assert(*walk == w + 7);
+#undef PAGE
+
+    tlb_configure(TLB_L1D, 16, 4, 1, TLB_PLRU);
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
+}
+
+static void TestPageWalkCache()
+{
+#if defined(USE_TLB_HARDWARE) && defined(USE_PAGETABLE_VA2PA)
+    printf("Testing page walk caches ...\n");
+
+    // 0x00400000 and 0x00600000 are in 2 PTs of the same PMD
+    static pte123_t pgd[PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pud[PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pmd[PAGE_TABLE_ENTRY_NUM];
+    static pte4_t pt[2][PAGE_TABLE_ENTRY_NUM];
+
+    uint64_t base[2] = {0x00400000, 0x00600000};
+    for (int j = 0; j < 2; ++ j)
+    {
+        address_t vaddr = {.address_value = base[j]};
+        pgd[vaddr.vpn1].paddr = (uint64_t)&pud[0];
+        pgd[vaddr.vpn1].present = 1;
+        pud[vaddr.vpn2].paddr = (uint64_t)&pmd[0];
+        pud[vaddr.vpn2].present = 1;
+        pmd[vaddr.vpn3].paddr = (uint64_t)&pt[j][0];
+        pmd[vaddr.vpn3].present = 1;
+        for (int i = 0; i < 4; ++ i)
+        {
+            pt[j][vaddr.vpn4 + i].ppn = 0x10 * (j + 1) + i;
+            pt[j][vaddr.vpn4 + i].present = 1;
+        }
+    }
+    mmu_write_cr3((uint64_t)pgd, 5);
+    tlb_flush();
+
+    uint64_t w[4];
+    for (int k = 0; k < 4; ++ k)
+    {
+        w[k] = page_walk_count(k);
+    }
+
+    // the first walk reads all levels, the next in the same PT reads one
+    assert(va2pa(base[0]) == (0x10 << PHYSICAL_PAGE_OFFSET_LENGTH));
+    assert(va2pa(base[0] + PAGE_SIZE) == (0x11 << PHYSICAL_PAGE_OFFSET_LENGTH));
+    assert(page_walk_count(0) == w[0] + 1);
+    assert(page_walk_count(3) == w[3] + 1);
+
+    // the other PT of the same PMD
+    assert(va2pa(base[1]) == (0x20 << PHYSICAL_PAGE_OFFSET_LENGTH));
+    assert(page_walk_count(2) == w[2] + 1);
+
+    // the upper levels of the page are invalidated with its TLB line
+    tlb_invlpg(base[0] + 2 * PAGE_SIZE, 5);
+    assert(va2pa(base[0] + 2 * PAGE_SIZE) == (0x12 << PHYSICAL_PAGE_OFFSET_LENGTH));
+    assert(page_walk_count(0) == w[0] + 2);
+
+    // and the PDE of the other PT is still cached
+    assert(va2pa(base[1] + PAGE_SIZE) == (0x21 << PHYSICAL_PAGE_OFFSET_LENGTH));
+    assert(page_walk_count(3) == w[3] + 2);
+
+    // the entries of another address space are not used
+    mmu_write_cr3((uint64_t)pgd, 6);
+    va2pa(base[0] + 3 * PAGE_SIZE);
+    assert(page_walk_count(0) == w[0] + 3);
+
+    // another PMD of the same PUD: only the PML4 entry is cached
+    static pte123_t pmd1[PAGE_TABLE_ENTRY_NUM];
+    static pte4_t pt1[PAGE_TABLE_ENTRY_NUM];
+    address_t far = {.address_value = 0x40000000};
+    pud[far.vpn2].paddr = (uint64_t)&pmd1[0];
+    pud[far.vpn2].present = 1;
+    pmd1[far.vpn3].paddr = (uint64_t)&pt1[0];
+    pmd1[far.vpn3].present = 1;
+    pt1[far.vpn4].ppn = 0x30;
+    pt1[far.vpn4].present = 1;
+    assert(va2pa(far.address_value) == (0x30 << PHYSICAL_PAGE_OFFSET_LENGTH));
+    assert(page_walk_count(1) == w[1] + 1);
+
+    // the caches are flushed with the TLB
+    tlb_flush();
+    va2pa(base[0] + 3 * PAGE_SIZE);
+    assert(page_walk_count(0) == w[0] + 4);
+
+    tlb_flush();
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
+}
+
+#if defined(USE_TLB_HARDWARE) && defined(USE_PAGETABLE_VA2PA)
+static uint64_t page_walk_total()
+{
+    uint64_t sum = 0;
+    for (int k = 0; k < 4; ++ k)
+    {
+        sum += page_walk_count(k);
+    }
+    return sum;
+}
+#endif
+
+static void TestHugePage()
+{
+#if defined(USE_TLB_HARDWARE) && defined(USE_PAGETABLE_VA2PA)
+    printf("Testing huge pages ...\n");
+
+    // 0x00400000 - 2 MB page at 0x00200000
+    // 0x00600000 - 4 KB pages
+    // 0x40000000 - 1 GB page at 0x80000000
+    static pte123_t pgd[PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pud[PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pmd[PAGE_TABLE_ENTRY_NUM];
+    static pte4_t pt[PAGE_TABLE_ENTRY_NUM];
+
+    address_t small = {.address_value = 0x00600000};
+    address_t large = {.address_value = 0x00400000};
+    address_t giant = {.address_value = 0x40000000};
+    pgd[small.vpn1].paddr = (uint64_t)&pud[0];
+    pgd[small.vpn1].present = 1;
+    pud[small.vpn2].paddr = (uint64_t)&pmd[0];
+    pud[small.vpn2].present = 1;
+    pmd[small.vpn3].paddr = (uint64_t)&pt[0];
+    pmd[small.vpn3].present = 1;
+    pt[small.vpn4].ppn = 0x7;
+    pt[small.vpn4].present = 1;
+
+    pmd[large.vpn3].paddr = 0x00200000;
+    pmd[large.vpn3].smallpage = 1;
+    pmd[large.vpn3].present = 1;
+    pud[giant.vpn2].paddr = 0x80000000;
+    pud[giant.vpn2].smallpage = 1;
+    pud[giant.vpn2].present = 1;
+
+    mmu_write_cr3((uint64_t)pgd, 7);
+    tlb_flush();
+    uint64_t walks = page_walk_total();
+    tlb_stat_t l1d = tlb_stat(TLB_L1D, 7);
+
+    // the walk stops at PMD, the offset is of 2 MB
+    assert(va2pa(0x00412345) == 0x00212345);
+    assert(page_walk_total() == walks + 1);
+
+    // one line covers the whole 2 MB page
+    assert(va2pa(0x00400008) == 0x00200008);
+    assert(va2pa(0x005ff010) == 0x003ff010);
+    assert(page_walk_total() == walks + 1);
+    assert(tlb_stat(TLB_L1D, 7).hit == l1d.hit + 2);
+
+    // the walk stops at PUD, the offset is of 1 GB
+    assert(va2pa(0x43456789) == 0x83456789);
+    assert(va2pa(0x7fffff00) == 0xbfffff00);
+    assert(page_walk_total() == walks + 2);
+
+    // the 4 KB pages next to the large ones
+    assert(va2pa(0x00600010) == (0x7 << PHYSICAL_PAGE_OFFSET_LENGTH) + 0x10);
+    assert(page_walk_total() == walks + 3);
+
+    // the iTLB is filled from the L2 line of the large page
+    assert(va2pa_fetch(0x00500000) == 0x00300000);
+    assert(page_walk_total() == walks + 3);
+
+    // any address in the page invalidates the line
+    tlb_invlpg(0x00543210, 7);
+    assert(va2pa(0x00400000) == 0x00200000);
+    assert(page_walk_total() == walks + 4);
+
+    tlb_flush();
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
+}
+
+static void TestSoftmmu()
+{
+#ifdef USE_SOFTMMU
+    printf("Testing software TLB ...\n");
+
+#if defined(USE_NAVIE_VA2PA) && !defined(USE_SRAM_CACHE)
+    // the page 0x00402000 is cached for stores, then has code
+    // not with the SRAM cache: the fetch reads DRAM, not the cache
+    char assembly[3][MAX_INSTRUCTION_CHAR] = {
+        "mov    %rbx,0x00402000",
+        "mov    %rcx,0x00402010",
+        "mov    %rdx,0x00402018",
+    };
+    for (int i = 0; i < 3; ++ i)
+    {
+        cpu_writeinst_dram(va2pa(i * INSTRUCTION_SIZE + 0x00400000), assembly[i]);
+    }
+
+    cpu_reg.rbx = 0x1234;
+    cpu_pc.rip = 0x00400000;
+    assert(cpu_run(1) == 1);
+    assert(cpu_read64bits_dram(va2pa(0x00402000)) == 0x1234);
+
+    cpu_writeinst_dram(va2pa(0x00402010), "mov    $0x1,%rax");
+    cpu_pc.rip = 0x00402010;
+    assert(cpu_run(1) == 1);
+    assert(cpu_reg.rax == 0x1);
+
+    // the stores rewrite the decoded instruction
+    uint8_t code[INSTRUCTION_SIZE];
+    assemble_instruction("mov    $0x2,%rax", code);
+    memcpy(&cpu_reg.rcx, &code[0], sizeof(uint64_t));
+    memcpy(&cpu_reg.rdx, &code[8], sizeof(uint64_t));
+    cpu_pc.rip = 0x00400010;
+    assert(cpu_run(2) == 2);
+    cpu_pc.rip = 0x00402010;
+    assert(cpu_run(1) == 1);
+    assert(cpu_reg.rax == 0x2);
+#endif
+
+#if defined(USE_TLB_HARDWARE) && defined(USE_PAGETABLE_VA2PA)
+    // the data page is mapped to another physical page
+    static pte123_t pgd[PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pud[PAGE_TABLE_ENTRY_NUM];
+    static pte123_t pmd[PAGE_TABLE_ENTRY_NUM];
+    static pte4_t pt[PAGE_TABLE_ENTRY_NUM];
+
+    address_t text = {.address_value = 0x00400000};
+    address_t data = {.address_value = 0x00401000};
+    pgd[text.vpn1].paddr = (uint64_t)&pud[0];
+    pgd[text.vpn1].present = 1;
+    pud[text.vpn2].paddr = (uint64_t)&pmd[0];
+    pud[text.vpn2].present = 1;
+    pmd[text.vpn3].paddr = (uint64_t)&pt[0];
+    pmd[text.vpn3].present = 1;
+    pt[text.vpn4].ppn = 1;
+    pt[text.vpn4].present = 1;
+    pt[data.vpn4].ppn = 2;
+    pt[data.vpn4].present = 1;
+
+    mmu_write_cr3((uint64_t)pgd, 8);
+    // the TLB model is not simulated, the software TLB is used
+    sim_set_mode(SIM_FAST);
+    cpu_write64bits_dram(2 << PHYSICAL_PAGE_OFFSET_LENGTH, 0x22);
+    cpu_write64bits_dram(3 << PHYSICAL_PAGE_OFFSET_LENGTH, 0x33);
+    cpu_writeinst_dram(1 << PHYSICAL_PAGE_OFFSET_LENGTH, "mov    0x00401000,%rax");
+
+    cpu_pc.rip = 0x00400000;
+    assert(cpu_run(1) == 1);
+    assert(cpu_reg.rax == 0x22);
+
+    pt[data.vpn4].ppn = 3;
+    tlb_invlpg(data.address_value, 8);
+    cpu_pc.rip = 0x00400000;
+    assert(cpu_run(1) == 1);
+    assert(cpu_reg.rax == 0x33);
+
+    sim_set_mode(SIM_DETAIL);
+    tlb_flush();
+#endif
+
+    printf("\033[32;1m\tPass\033[0m\n");
+#endif
+}
+
+static void TestProgramImage()
+{
+    printf("Testing program image ...\n");
+
+    // the EOF of the linker
+    elf_t eof;
+    memset(&eof, 0, sizeof(elf_t));
+    char *lines[] = {
+        "mov    0x00400030,%rax",   // .text 0: rax = value[0]
+        "add    0x00400038,%rax",   // .text 1: rax += value[1]
+        "jmp    0x00400020",        // .text 2: jump to itself
+        "0x0000000000000005",       // .data 0
+        "0x0000000000000007",       // .data 1
+    };
+    for (int i = 0; i < 5; ++ i)
+    {
+        strcpy(eof.buffer[i], lines[i]);
+    }
+    eof.line_count = 5;
+
+    sh_entry_t sht[3] = {
+        {".text",   0x00400000, 0, 3},
+        {".data",   0x00400030, 3, 2},
+        {".symtab", 0x0,        5, 2},
+    };
+    eof.sht_count = 3;
+    eof.sht = sht;
+
+    st_entry_t symt[2] = {
+        {"main",    STB_GLOBAL, STT_FUNC,   ".text", 0, 3},
+        {"value",   STB_GLOBAL, STT_OBJECT, ".data", 0, 2},
+    };
+    eof.symt_count = 2;
+    eof.symt = symt;
+
+    char *path = "./files/program.image";
+    write_image(path, &eof);
+
+    machine_t *m = machine_construct(1);
+    machine_t *old = machine_switch(m);
+    timer_stop();
+
+    assert(load_image(path) == 0x00400000);
+    assert(cpu_pc.rip == 0x00400000);
+    assert(cpu_read64bits_dram(va2pa(0x00400038)) == 7);
+
+    assert(cpu_run(4) == 4);
+    assert(cpu_reg.rax == 12);
+    assert(cpu_pc.rip == 0x00400020);
+
+    machine_switch(old);
+    machine_free(m);
+    remove(path);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
 int main()
 {
-    //TestAddFunctionCallAndComputation();
-    //TestSumRecursiveCondition();
+    // the tests translating by `vaddr % PHYSICAL_MEMORY_SPACE` (run_isa)
+#ifdef USE_NAVIE_VA2PA
+    TestAddFunctionCallAndComputation();
+    TestSumRecursiveCondition();
+    TestOperandForms();
+    TestSuperinstructionFusion();
+    TestJitHotBlock();
+    TestJitSameAsInterpreter();
+    TestSelfModifyingBlock();
+    TestEventQueue();
+    TestEnqueueStartsTimer();
+    TestProfile();
+    TestMachineContext();
+    TestMultiCore();
+    TestParallelCores();
+    TestCheckpoint();
+    TestSampling();
+    TestProgramImage();
+    TestDecodeIllegal();
+#else
+    // no timer interrupt: there is no kernel stack in the tests below
+    timer_stop();
+#endif
+    TestParseNames();
+    TestTokenizer();
 
+    // the tests building their own page tables (run_isa_tlb)
+    TestTaggedTlb();
+    TestTlbPolicy();
+    TestTlbLevels();
+    TestPageWalkCache();
+    TestHugePage();
+    TestSoftmmu();
+
+#ifdef USE_NAVIE_VA2PA
     TestSyscallPrintHelloWorld();
+#endif
     return 0;
-}
\ No newline at end of file
+}